@@ -0,0 +1,644 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <string>
+
+// The io_uring receive path is built in on Linux so it can be compared with epoll
+#ifdef __linux__
+#define ASR_NET_IO_URING
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+#include <asr_net.h>
+#ifdef _WIN32
+#include <psapi.h>
+#endif
+
+// Micro benchmarks for the optional wire features. Run with the name of a
+// benchmark, or with no arguments to run them all.
+
+enum class BenchMsgTypes : uint32_t
+{
+	Echo
+};
+
+class EchoServer : public asr::net::server_interface<BenchMsgTypes>
+{
+public:
+	EchoServer(uint16_t nPort) : asr::net::server_interface<BenchMsgTypes>(nPort)
+	{
+
+	}
+
+	~EchoServer()
+	{
+		m_bUpdating = false;
+		if (m_threadUpdate.joinable())
+			m_threadUpdate.join();
+	}
+
+	// Handles messages on a thread of its own until destroyed
+	void StartUpdating()
+	{
+		m_threadUpdate = std::thread([this]()
+			{
+				while (m_bUpdating)
+					UpdateFor(std::chrono::milliseconds(10));
+			});
+	}
+
+protected:
+	bool OnClientConnect(std::shared_ptr<asr::net::connection<BenchMsgTypes>>) override
+	{
+		return true;
+	}
+
+	void OnMessage(std::shared_ptr<asr::net::connection<BenchMsgTypes>> client, asr::net::message<BenchMsgTypes>& msg) override
+	{
+		client->Send(msg);
+	}
+
+private:
+	std::atomic<bool> m_bUpdating{ true };
+	std::thread m_threadUpdate;
+};
+
+class EchoClient : public asr::net::client_interface<BenchMsgTypes>
+{
+};
+
+// Runs fn for at least tMin and returns the seconds taken per call
+template <typename F>
+double TimePerCall(F&& fn, std::chrono::milliseconds tMin = std::chrono::milliseconds(300))
+{
+	size_t nCalls = 0;
+	auto tStart = std::chrono::steady_clock::now();
+	auto tNow = tStart;
+	do
+	{
+		fn();
+		nCalls++;
+		tNow = std::chrono::steady_clock::now();
+	} while (tNow - tStart < tMin);
+	return std::chrono::duration<double>(tNow - tStart).count() / nCalls;
+}
+
+std::vector<uint8_t> MakeBody(size_t nSize, bool bText, uint32_t nSeed = 0x12345678)
+{
+	// Text-like bodies repeat a small vocabulary, others are noise
+	static const char* vWords[] = { "player", "position", "health", "id", "name", "score", "team", "velocity" };
+	std::vector<uint8_t> vBody;
+	vBody.reserve(nSize);
+	while (vBody.size() < nSize)
+	{
+		nSeed = nSeed * 1664525 + 1013904223;
+		if (bText)
+		{
+			const std::string sToken = std::string("\"") + vWords[(nSeed >> 16) % 8] + "\":" + std::to_string((nSeed >> 8) % 1000) + ",";
+			for (char c : sToken)
+				vBody.push_back(uint8_t(c));
+		}
+		else
+			vBody.push_back(uint8_t(nSeed >> 24));
+	}
+	vBody.resize(nSize);
+	return vBody;
+}
+
+// Fixed ports can be held by anything, an earlier run's connections included, so
+// walk forward from nPort until make succeeds. nPort is left on the one used
+template <typename F>
+auto OnFreePort(uint16_t& nPort, F&& make) -> decltype(make(nPort))
+{
+	for (int i = 0; i < 100; i++, nPort++)
+	{
+		try
+		{
+			if (auto p = make(nPort))
+				return p;
+		}
+		catch (std::exception&)
+		{
+		}
+	}
+	return nullptr;
+}
+
+std::unique_ptr<EchoServer> StartEchoServer(uint16_t& nPort, uint8_t nCapabilities, bool bIoUring = false)
+{
+	return OnFreePort(nPort, [nCapabilities, bIoUring](uint16_t nTryPort)
+		{
+			auto pServer = std::make_unique<EchoServer>(nTryPort);
+			pServer->SetCapabilities(nCapabilities);
+			pServer->SetIoUring(bIoUring);
+			if (!pServer->Start())
+				return std::unique_ptr<EchoServer>();
+			pServer->StartUpdating();
+			return pServer;
+		});
+}
+
+// Round trips echo messages of nSize bytes, keeping nWindow in flight
+double EchoMessagesPerSecond(uint8_t nCapabilities, size_t nSize, bool bText, uint16_t& nPort)
+{
+	std::unique_ptr<EchoServer> pServer = StartEchoServer(nPort, nCapabilities);
+	if (!pServer)
+		return 0.0;
+
+	EchoClient client;
+	client.Connect("127.0.0.1", nPort);
+	double dRate = 0.0;
+	if (client.WaitForConnection(std::chrono::seconds(2)))
+	{
+		asr::net::message<BenchMsgTypes> msg;
+		msg.header.id = BenchMsgTypes::Echo;
+		const std::vector<uint8_t> vBody = MakeBody(nSize, bText);
+		msg.body.assign(vBody.data(), vBody.data() + vBody.size());
+		msg.header.size = uint32_t(msg.body.size());
+
+		const size_t nCount = std::max<size_t>(20000, (16 << 20) / (nSize + 64));
+		const size_t nWindow = 64;
+		size_t nSent = 0, nReceived = 0;
+		auto tStart = std::chrono::steady_clock::now();
+		while (nReceived < nCount)
+		{
+			while (nSent < nCount && nSent - nReceived < nWindow)
+			{
+				client.Send(msg);
+				nSent++;
+			}
+			if (client.Incoming().wait_for(std::chrono::seconds(2)))
+			{
+				client.Incoming().pop_front();
+				nReceived++;
+			}
+			else
+				break;
+		}
+		double dSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+		if (nReceived == nCount)
+			dRate = nCount / dSeconds;
+	}
+
+	client.Disconnect();
+	return dRate;
+}
+
+// Loopback timings are noisy, so keep the best of a few runs
+double BestEchoMessagesPerSecond(uint8_t nCapabilities, size_t nSize, bool bText, uint16_t& nPort)
+{
+	double dBest = 0.0;
+	for (int i = 0; i < 3; i++)
+	{
+		dBest = std::max(dBest, EchoMessagesPerSecond(nCapabilities, nSize, bText, nPort));
+		nPort++;
+	}
+	return dBest;
+}
+
+void BenchChecksum()
+{
+	std::cout << "checksum: crc32c over one message body\n";
+	std::cout << std::setw(10) << "bytes" << std::setw(14) << "hw ns" << std::setw(14) << "sw ns" << std::setw(12) << "hw GB/s" << std::setw(12) << "sw GB/s\n";
+	for (size_t nSize : { 16, 64, 256, 1024, 4096, 65536 })
+	{
+		const std::vector<uint8_t> vBody = MakeBody(nSize, false);
+		volatile uint32_t nSink = 0;
+		double dHardware = TimePerCall([&]() { nSink = nSink + asr::net::crc32c::Value(vBody.data(), vBody.size()); });
+		double dSoftware = TimePerCall([&]() { nSink = nSink + ~asr::net::crc32c::detail::ExtendSoftware(~0u, vBody.data(), vBody.size()); });
+		std::cout << std::setw(10) << nSize
+			<< std::setw(14) << std::fixed << std::setprecision(1) << dHardware * 1e9
+			<< std::setw(14) << dSoftware * 1e9
+			<< std::setw(12) << std::setprecision(2) << nSize / dHardware / 1e9
+			<< std::setw(12) << nSize / dSoftware / 1e9 << "\n";
+	}
+
+	std::cout << "checksum: loopback echo, messages per second\n";
+	std::cout << std::setw(10) << "bytes" << std::setw(14) << "off" << std::setw(14) << "on" << std::setw(12) << "change\n";
+	uint16_t nPort = 60700;
+	for (size_t nSize : { 64, 1024, 16384 })
+	{
+		double dOff = BestEchoMessagesPerSecond(asr::net::wire::compact_header, nSize, false, nPort);
+		double dOn = BestEchoMessagesPerSecond(asr::net::wire::compact_header | asr::net::wire::checksum, nSize, false, nPort);
+		std::cout << std::setw(10) << nSize
+			<< std::setw(14) << std::setprecision(0) << dOff
+			<< std::setw(14) << dOn
+			<< std::setw(11) << std::setprecision(1) << (dOff > 0.0 ? (dOn / dOff - 1.0) * 100.0 : 0.0) << "%\n";
+	}
+}
+
+// Compresses the bodies in turn through one stream, as a connection would, and returns
+// bytes in over bytes out. Bodies that don't compress go out as they are
+double CompressionRatio(const std::vector<std::vector<uint8_t>>& vBodies, bool bSharedWindow)
+{
+	asr::net::lz::encoder encoder;
+	size_t nIn = 0, nOut = 0;
+	for (auto& vBody : vBodies)
+	{
+		if (!bSharedWindow)
+			encoder = asr::net::lz::encoder();
+
+		nIn += vBody.size();
+		nOut += encoder.Compress(vBody.data(), vBody.size()) ? encoder.Output().size() : vBody.size();
+	}
+	return double(nIn) / nOut;
+}
+
+void BenchCompression()
+{
+	std::cout << "compression: lz stream over 64 different bodies, MB/s of uncompressed bytes\n";
+	std::cout << std::setw(10) << "bytes" << std::setw(8) << "kind" << std::setw(10) << "ratio" << std::setw(10) << "alone"
+		<< std::setw(12) << "comp MB/s" << std::setw(14) << "decomp MB/s\n";
+	const std::pair<size_t, bool> vCases[] = { { 40, true }, { 256, true }, { 4096, true }, { 65536, true }, { 4096, false } };
+	for (auto& [nSize, bText] : vCases)
+	{
+		std::vector<std::vector<uint8_t>> vBodies;
+		for (uint32_t i = 0; i < 64; i++)
+			vBodies.push_back(MakeBody(nSize, bText, 0x12345678 + i * 7919));
+
+		const size_t nBytes = nSize * vBodies.size();
+		double dCompress = TimePerCall([&]()
+			{
+				asr::net::lz::encoder encoder;
+				for (auto& vBody : vBodies)
+					encoder.Compress(vBody.data(), vBody.size());
+			});
+
+		// Only what the encoder kept is sent compressed, and the decoder must see it in order
+		asr::net::lz::encoder encoder;
+		std::vector<std::vector<uint8_t>> vCompressed;
+		for (auto& vBody : vBodies)
+			if (encoder.Compress(vBody.data(), vBody.size()))
+				vCompressed.push_back(encoder.Output());
+
+		double dDecompress = 0.0;
+		if (!vCompressed.empty())
+		{
+			size_t nDecompressed = 0;
+			dDecompress = TimePerCall([&]()
+				{
+					asr::net::lz::decoder decoder;
+					nDecompressed = 0;
+					for (auto& vIn : vCompressed)
+						if (decoder.Decompress(vIn.data(), vIn.size(), nSize))
+							nDecompressed += decoder.Size();
+				}) / nDecompressed;
+		}
+
+		std::cout << std::setw(10) << nSize << std::setw(8) << (bText ? "text" : "noise")
+			<< std::setw(10) << std::fixed << std::setprecision(2) << CompressionRatio(vBodies, true)
+			<< std::setw(10) << CompressionRatio(vBodies, false)
+			<< std::setw(12) << std::setprecision(0) << nBytes / dCompress / 1e6
+			<< std::setw(14) << (dDecompress > 0.0 ? 1.0 / dDecompress / 1e6 : 0.0) << "\n";
+	}
+
+	std::cout << "compression: loopback echo of text bodies, messages per second\n";
+	std::cout << std::setw(10) << "bytes" << std::setw(14) << "off" << std::setw(14) << "on" << std::setw(12) << "change\n";
+	uint16_t nPort = 60900;
+	for (size_t nSize : { 256, 4096, 16384 })
+	{
+		double dOff = BestEchoMessagesPerSecond(asr::net::wire::compact_header, nSize, true, nPort);
+		double dOn = BestEchoMessagesPerSecond(asr::net::wire::compact_header | asr::net::wire::compression, nSize, true, nPort);
+		std::cout << std::setw(10) << nSize
+			<< std::setw(14) << std::setprecision(0) << dOff
+			<< std::setw(14) << dOn
+			<< std::setw(11) << std::setprecision(1) << (dOff > 0.0 ? (dOn / dOff - 1.0) * 100.0 : 0.0) << "%\n";
+	}
+}
+
+void BenchNetsim()
+{
+	std::cout << "netsim: 16 byte echo round trips through the impairment proxy, ms\n";
+	std::cout << std::setw(10) << "profile" << std::setw(10) << "base" << std::setw(10) << "median" << std::setw(10) << "p95" << std::setw(10) << "max\n";
+
+	const std::pair<const char*, asr::net::impairment_profile> vProfiles[] =
+	{
+		{ "lan", asr::net::impairment_profile::lan() },
+		{ "broadband", asr::net::impairment_profile::broadband() },
+		{ "mobile", asr::net::impairment_profile::mobile() }
+	};
+
+	uint16_t nPort = 60800;
+	for (auto& [sName, profile] : vProfiles)
+	{
+		std::unique_ptr<EchoServer> pServer = StartEchoServer(nPort, 0);
+		if (!pServer)
+			continue;
+
+		const asio::ip::tcp::endpoint upstream(asio::ip::address_v4::loopback(), nPort);
+		uint16_t nProxyPort = nPort + 1;
+		std::unique_ptr<asr::net::netsim_proxy> pProxy = OnFreePort(nProxyPort, [&](uint16_t nTryPort)
+			{
+				auto pProxy = std::make_unique<asr::net::netsim_proxy>(nTryPort, upstream);
+				pProxy->SetProfile(profile);
+				if (!pProxy->Start())
+					return std::unique_ptr<asr::net::netsim_proxy>();
+				return pProxy;
+			});
+		if (!pProxy)
+			continue;
+
+		EchoClient client;
+		client.Connect("127.0.0.1", nProxyPort);
+		std::vector<double> vRoundTrips;
+		if (client.WaitForConnection(std::chrono::seconds(5)))
+		{
+			asr::net::message<BenchMsgTypes> msg;
+			msg.header.id = BenchMsgTypes::Echo;
+			msg.body.resize(16);
+			msg.header.size = 16;
+
+			for (int i = 0; i < 40; i++)
+			{
+				auto tStart = std::chrono::steady_clock::now();
+				client.Send(msg);
+				if (!client.Incoming().wait_for(std::chrono::seconds(5)))
+					break;
+				client.Incoming().pop_front();
+				vRoundTrips.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tStart).count());
+			}
+		}
+		client.Disconnect();
+		nPort = nProxyPort + 1;
+
+		if (vRoundTrips.empty())
+		{
+			std::cout << std::setw(10) << sName << "  no replies\n";
+			continue;
+		}
+
+		std::sort(vRoundTrips.begin(), vRoundTrips.end());
+		std::cout << std::setw(10) << sName
+			<< std::setw(10) << std::fixed << std::setprecision(1) << 2.0 * std::chrono::duration<double, std::milli>(profile.tLatency).count()
+			<< std::setw(10) << vRoundTrips[vRoundTrips.size() / 2]
+			<< std::setw(10) << vRoundTrips[vRoundTrips.size() * 95 / 100]
+			<< std::setw(10) << vRoundTrips.back() << "\n";
+	}
+}
+
+// Bare client connections to one server, all run by one thread of their own. A
+// client_interface each would bring a thread each
+class ClientSwarm
+{
+public:
+	using BenchConnection = asr::net::connection<BenchMsgTypes>;
+
+	ClientSwarm(size_t nClients, uint16_t nPort, uint8_t nCapabilities)
+	{
+		asio::ip::tcp::resolver resolver(m_context);
+		auto endpoints = resolver.resolve("127.0.0.1", std::to_string(nPort));
+		for (size_t i = 0; i < nClients; i++)
+		{
+			m_vClients.push_back(std::make_unique<BenchConnection>(BenchConnection::owner::client, m_context, asio::ip::tcp::socket(m_context), m_qIn));
+			m_vClients.back()->SetCapabilities(nCapabilities);
+			m_vClients.back()->SetValidatedHandler([this]() { m_nValidated++; });
+			m_vClients.back()->ConnectToServer(endpoints);
+		}
+		m_threadContext = std::thread([this]() { m_context.run(); });
+	}
+
+	~ClientSwarm()
+	{
+		for (auto& pClient : m_vClients)
+			pClient->Disconnect();
+		m_context.stop();
+		m_threadContext.join();
+	}
+
+	// True once every handshake is done
+	bool WaitForValidation(std::chrono::seconds tTimeout)
+	{
+		auto tDeadline = std::chrono::steady_clock::now() + tTimeout;
+		while (m_nValidated < m_vClients.size() && std::chrono::steady_clock::now() < tDeadline)
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		return m_nValidated == m_vClients.size();
+	}
+
+	BenchConnection& operator [] (size_t i)
+	{
+		return *m_vClients[i];
+	}
+
+	// Messages from the server to any of the clients
+	asr::net::tsqueue<asr::net::owned_message<BenchMsgTypes>>& Incoming()
+	{
+		return m_qIn;
+	}
+
+private:
+	asio::io_context m_context;
+	asr::net::tsqueue<asr::net::owned_message<BenchMsgTypes>> m_qIn;
+	std::vector<std::unique_ptr<BenchConnection>> m_vClients;
+	std::atomic<size_t> m_nValidated{ 0 };
+	std::thread m_threadContext;
+};
+
+// Both ends of every connection live in this process, so it may need more descriptors
+void RaiseFileLimit()
+{
+#ifdef __linux__
+	rlimit limit{};
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+	{
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+#endif
+}
+
+// Resident set size of the process in bytes, 0 where it isn't known
+size_t ResidentBytes()
+{
+#if defined(__linux__)
+	std::ifstream statm("/proc/self/statm");
+	size_t nPages = 0, nResident = 0;
+	statm >> nPages >> nResident;
+	return nResident * size_t(sysconf(_SC_PAGESIZE));
+#elif defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS counters{};
+	if (K32GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return counters.WorkingSetSize;
+	return 0;
+#else
+	return 0;
+#endif
+}
+
+// Echo rate with nClients connections to one server, each keeping a message in flight
+double ManyConnectionEchoesPerSecond(bool bIoUring, size_t nClients, uint16_t& nPort)
+{
+	std::unique_ptr<EchoServer> pServer = StartEchoServer(nPort, asr::net::wire::compact_header, bIoUring);
+	if (!pServer)
+		return 0.0;
+
+	ClientSwarm swarm(nClients, nPort, asr::net::wire::compact_header);
+	auto& qIn = swarm.Incoming();
+
+	double dRate = 0.0;
+	if (swarm.WaitForValidation(std::chrono::seconds(20)))
+	{
+		// The body says which connection a reply belongs to, so it can go straight back out
+		for (uint32_t i = 0; i < nClients; i++)
+		{
+			asr::net::message<BenchMsgTypes> msg;
+			msg.header.id = BenchMsgTypes::Echo;
+			msg.body.resize(64);
+			std::memcpy(msg.body.data(), &i, sizeof(i));
+			msg.header.size = uint32_t(msg.body.size());
+			swarm[i].Send(std::move(msg));
+		}
+
+		// Warm up, then count for a fixed time
+		size_t nReceived = 0;
+		auto tStart = std::chrono::steady_clock::now();
+		auto tCount = tStart + std::chrono::milliseconds(500);
+		auto tEnd = tCount + std::chrono::seconds(2);
+		size_t nAtCount = 0;
+		bool bCounting = false;
+		while (true)
+		{
+			if (!qIn.wait_for(std::chrono::seconds(2)))
+				break;
+
+			asr::net::message<BenchMsgTypes> msg = qIn.pop_front().msg;
+			uint32_t nClient = 0;
+			std::memcpy(&nClient, msg.body.data(), sizeof(nClient));
+			swarm[nClient].Send(std::move(msg));
+			nReceived++;
+
+			auto tNow = std::chrono::steady_clock::now();
+			if (!bCounting && tNow >= tCount)
+			{
+				bCounting = true;
+				nAtCount = nReceived;
+			}
+			else if (bCounting && tNow >= tEnd)
+			{
+				dRate = (nReceived - nAtCount) / std::chrono::duration<double>(tNow - tCount).count();
+				break;
+			}
+		}
+	}
+
+	return dRate;
+}
+
+void BenchIoUring()
+{
+	std::cout << "io_uring: 64 byte echoes with every connection keeping one in flight, messages per second\n";
+
+#ifdef ASR_NET_HAS_IO_URING
+	RaiseFileLimit();
+
+	asio::io_context context;
+	if (!asr::net::uring_receiver::Create(context))
+	{
+		std::cout << "io_uring unavailable, needs Linux 6.0\n";
+		return;
+	}
+
+	std::cout << std::setw(12) << "connections" << std::setw(14) << "epoll" << std::setw(14) << "io_uring" << std::setw(12) << "change\n";
+	uint16_t nPort = 61000;
+	for (size_t nClients : { 100, 1000, 4000 })
+	{
+		rlimit limit{};
+		if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < 2 * nClients + 64)
+		{
+			std::cout << std::setw(12) << nClients << "  not enough file descriptors\n";
+			continue;
+		}
+
+		double dEpoll = ManyConnectionEchoesPerSecond(false, nClients, nPort);
+		nPort++;
+		double dUring = ManyConnectionEchoesPerSecond(true, nClients, nPort);
+		nPort++;
+		std::cout << std::setw(12) << nClients
+			<< std::setw(14) << std::fixed << std::setprecision(0) << dEpoll
+			<< std::setw(14) << dUring
+			<< std::setw(11) << std::setprecision(1) << (dEpoll > 0.0 ? (dUring / dEpoll - 1.0) * 100.0 : 0.0) << "%\n";
+	}
+#else
+	std::cout << "io_uring is only built on Linux\n";
+#endif
+}
+
+// Memory held by connections that sit idle after their handshake, with time probes and
+// resume on so everything an idle connection could hold is in play
+void BenchIdle()
+{
+	const size_t nClients = 2000;
+	const uint8_t nCapabilities = asr::net::wire::compact_header | asr::net::wire::time_sync | asr::net::wire::resume;
+	std::cout << "idle: " << nClients << " loopback connections left idle, bytes per connection\n";
+	RaiseFileLimit();
+
+	uint16_t nPort = 61100;
+	const size_t nBefore = ResidentBytes();
+	std::unique_ptr<EchoServer> pServer = StartEchoServer(nPort, nCapabilities);
+	if (!pServer)
+		return;
+
+	ClientSwarm swarm(nClients, nPort, nCapabilities);
+	if (!swarm.WaitForValidation(std::chrono::seconds(20)))
+	{
+		std::cout << "handshakes did not finish, too few file descriptors?\n";
+		return;
+	}
+
+	// Long enough for probing to stop and the server's sweeps to give back queue storage
+	std::this_thread::sleep_for(std::chrono::seconds(5));
+
+	// Both ends of every connection are counted
+	const size_t nConnections = 2 * nClients;
+	const size_t nAfter = ResidentBytes();
+	std::cout << std::setw(14) << "rss" << std::setw(14) << "footprint" << std::setw(14) << "recv lent\n";
+	std::cout << std::setw(14) << (nAfter > nBefore ? (nAfter - nBefore) / nConnections : 0)
+		<< std::setw(14) << asr::net::connection<BenchMsgTypes>::GetFootprintPerConnection()
+		<< std::setw(14) << asr::net::recv_buffer_pool::BytesLent() / nConnections << "\n";
+	std::cout << "rss also covers the kernel's socket buffers and asio's per socket state, footprint does not\n";
+}
+
+int main(int argc, char* argv[])
+{
+	const std::string sBench = argc > 1 ? argv[1] : "";
+	bool bRan = false;
+
+	// Keep connection chatter out of the tables
+	asr::net::log::SetLevel(asr::net::log::level::warn);
+
+	if (sBench.empty() || sBench == "checksum")
+	{
+		BenchChecksum();
+		bRan = true;
+	}
+
+	if (sBench.empty() || sBench == "compression")
+	{
+		BenchCompression();
+		bRan = true;
+	}
+
+	if (sBench.empty() || sBench == "netsim")
+	{
+		BenchNetsim();
+		bRan = true;
+	}
+
+	if (sBench.empty() || sBench == "io_uring")
+	{
+		BenchIoUring();
+		bRan = true;
+	}
+
+	if (sBench.empty() || sBench == "idle")
+	{
+		BenchIdle();
+		bRan = true;
+	}
+
+	if (!bRan)
+	{
+		std::cout << "Unknown benchmark " << sBench << ", expected one of: checksum, compression, netsim, io_uring, idle\n";
+		return 1;
+	}
+	return 0;
+}
\ No newline at end of file
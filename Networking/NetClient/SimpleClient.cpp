@@ -60,7 +60,8 @@ int main()
 
 		if (c.IsConnected())
 		{
-			if (!c.Incoming().empty())
+			// Sleep until a message arrives, but wake up regularly to poll the keyboard
+			if (c.Incoming().wait_for(std::chrono::milliseconds(10)))
 			{
 				auto msg = c.Incoming().pop_front().msg;
 
@@ -78,6 +79,10 @@ int main()
 					std::chrono::system_clock::time_point timeThen;
 					msg >> timeThen;
 					std::cout << "Ping: " << std::chrono::duration<double>(timeNow - timeThen).count() << "\n";
+
+					// The connection's own estimate, kept up to date in the background
+					std::cout << "RTT: " << std::chrono::duration<double, std::milli>(c.GetRoundTripTime()).count() << "ms"
+						<< " jitter: " << std::chrono::duration<double, std::milli>(c.GetJitter()).count() << "ms\n";
 				}
 				break;
 
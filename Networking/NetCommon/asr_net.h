@@ -1,9 +1,30 @@
 #pragma once
 
 #include "net_common.h"
+#include "net_transport.h"
+#include "net_buffer.h"
 #include "net_message.h"
+#include "net_wire.h"
+#include "net_crc32c.h"
+#include "net_lz.h"
+#include "net_trace.h"
+#include "net_log.h"
+#include "net_ratelimit.h"
+#include "net_snapshot.h"
+#include "net_timesync.h"
+#include "net_uring.h"
+#include "net_session.h"
+#include "net_interest.h"
+#include "net_shm.h"
+#include "net_netsim.h"
+#include "net_outbox.h"
+#include "net_connector.h"
 #include "net_connection.h"
 #include "net_client.h"
 #include "net_server.h"
+#include "net_sharded.h"
+#include "net_cluster.h"
 
-#include "net_tsqueue.h"
\ No newline at end of file
+#include "net_readiness.h"
+#include "net_tsqueue.h"
+#include "net_mpsc.h"
\ No newline at end of file
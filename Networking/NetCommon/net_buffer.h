@@ -0,0 +1,380 @@
+#pragma once
+#include "net_common.h"
+
+namespace asr
+{
+	namespace net
+	{
+		// Byte buffer with the parts of the std::vector interface messages use, which keeps
+		// up to N bytes inside the object itself and only goes to the heap beyond that.
+		// Most messages are a handful of bytes, so most never allocate
+		template <size_t N>
+		class small_buffer
+		{
+			static_assert(N > 0, "small_buffer needs some inline space");
+
+		public:
+			using value_type = uint8_t;
+			using size_type = size_t;
+			using iterator = uint8_t*;
+			using const_iterator = const uint8_t*;
+
+			small_buffer() = default;
+
+			small_buffer(const small_buffer& other)
+			{
+				assign(other.begin(), other.end());
+			}
+
+			small_buffer(small_buffer&& other) noexcept
+			{
+				take(other);
+			}
+
+			~small_buffer()
+			{
+				release();
+			}
+
+			small_buffer& operator = (const small_buffer& other)
+			{
+				if (this != &other)
+					assign(other.begin(), other.end());
+				return *this;
+			}
+
+			small_buffer& operator = (small_buffer&& other) noexcept
+			{
+				if (this != &other)
+				{
+					release();
+					take(other);
+				}
+				return *this;
+			}
+
+		public:
+			uint8_t* data() { return m_pData; }
+			const uint8_t* data() const { return m_pData; }
+
+			size_t size() const { return m_nSize; }
+			size_t capacity() const { return m_nCapacity; }
+			bool empty() const { return m_nSize == 0; }
+
+			// True while the contents live inside the object
+			bool is_inline() const { return m_pData == m_aInline; }
+
+			iterator begin() { return m_pData; }
+			iterator end() { return m_pData + m_nSize; }
+			const_iterator begin() const { return m_pData; }
+			const_iterator end() const { return m_pData + m_nSize; }
+
+			uint8_t& operator [] (size_t i) { return m_pData[i]; }
+			const uint8_t& operator [] (size_t i) const { return m_pData[i]; }
+
+			void reserve(size_t nCapacity)
+			{
+				if (nCapacity > m_nCapacity)
+					grow(nCapacity);
+			}
+
+			// New bytes are zeroed, as std::vector would
+			void resize(size_t nSize)
+			{
+				if (nSize > m_nCapacity)
+					grow(std::max(nSize, m_nCapacity * 2));
+				if (nSize > m_nSize)
+					std::memset(m_pData + m_nSize, 0, nSize - m_nSize);
+				m_nSize = nSize;
+			}
+
+			void clear()
+			{
+				m_nSize = 0;
+			}
+
+			// Returns to inline storage, freeing any heap block
+			void shrink_to_fit()
+			{
+				if (is_inline() || m_nSize > N)
+					return;
+
+				uint8_t* pHeap = m_pData;
+				std::memcpy(m_aInline, pHeap, m_nSize);
+				delete[] pHeap;
+				m_pData = m_aInline;
+				m_nCapacity = N;
+			}
+
+			void assign(const uint8_t* pFirst, const uint8_t* pLast)
+			{
+				size_t nSize = size_t(pLast - pFirst);
+				if (nSize > m_nCapacity)
+				{
+					// Fill the new block before the old one goes, the range may be part of it
+					uint8_t* pHeap = new uint8_t[nSize];
+					std::memcpy(pHeap, pFirst, nSize);
+					release();
+					m_pData = pHeap;
+					m_nCapacity = nSize;
+				}
+				else if (nSize > 0)
+				{
+					std::memmove(m_pData, pFirst, nSize);
+				}
+				m_nSize = nSize;
+			}
+
+			void assign(size_t nCount, uint8_t n)
+			{
+				m_nSize = 0;
+				resize(nCount);
+				std::memset(m_pData, n, nCount);
+			}
+
+			void push_back(uint8_t n)
+			{
+				if (m_nSize == m_nCapacity)
+					grow(m_nCapacity * 2);
+				m_pData[m_nSize++] = n;
+			}
+
+			iterator insert(const_iterator pos, const uint8_t* pFirst, const uint8_t* pLast)
+			{
+				size_t nAt = size_t(pos - m_pData);
+				size_t nCount = size_t(pLast - pFirst);
+
+				// A range out of this buffer would move or be freed under us, so copy it first
+				if (nCount > 0 && aliases(pFirst, pLast))
+				{
+					small_buffer copy;
+					copy.assign(pFirst, pLast);
+					return insert(m_pData + nAt, copy.begin(), copy.end());
+				}
+
+				if (m_nSize + nCount > m_nCapacity)
+					grow(std::max(m_nSize + nCount, m_nCapacity * 2));
+
+				std::memmove(m_pData + nAt + nCount, m_pData + nAt, m_nSize - nAt);
+				if (nCount > 0)
+					std::memcpy(m_pData + nAt, pFirst, nCount);
+				m_nSize += nCount;
+				return m_pData + nAt;
+			}
+
+			friend bool operator == (const small_buffer& a, const small_buffer& b)
+			{
+				return a.m_nSize == b.m_nSize && (a.m_nSize == 0 || std::memcmp(a.m_pData, b.m_pData, a.m_nSize) == 0);
+			}
+
+			friend bool operator != (const small_buffer& a, const small_buffer& b)
+			{
+				return !(a == b);
+			}
+
+		private:
+			// True if [pFirst, pLast) overlaps this buffer's storage
+			bool aliases(const uint8_t* pFirst, const uint8_t* pLast) const
+			{
+				std::less<const uint8_t*> less;
+				return less(pFirst, m_pData + m_nCapacity) && less(m_pData, pLast);
+			}
+
+			void grow(size_t nCapacity)
+			{
+				uint8_t* pHeap = new uint8_t[nCapacity];
+				if (m_nSize > 0)
+					std::memcpy(pHeap, m_pData, m_nSize);
+				release();
+				m_pData = pHeap;
+				m_nCapacity = nCapacity;
+			}
+
+			void release()
+			{
+				if (!is_inline())
+					delete[] m_pData;
+				m_pData = m_aInline;
+				m_nCapacity = N;
+			}
+
+			// Heap blocks change hands, inline contents are copied
+			void take(small_buffer& other)
+			{
+				if (other.is_inline())
+				{
+					std::memcpy(m_aInline, other.m_aInline, other.m_nSize);
+				}
+				else
+				{
+					m_pData = other.m_pData;
+					m_nCapacity = other.m_nCapacity;
+					other.m_pData = other.m_aInline;
+					other.m_nCapacity = N;
+				}
+				m_nSize = other.m_nSize;
+				other.m_nSize = 0;
+			}
+
+		private:
+			uint8_t* m_pData = m_aInline;
+			size_t m_nSize = 0;
+			size_t m_nCapacity = N;
+			uint8_t m_aInline[N];
+		};
+
+		// Receive buffers shared by the connections a thread runs. A connection only borrows
+		// one while bytes are arriving, so idle connections hold none
+		class recv_buffer_pool
+		{
+		public:
+			// Buffers kept per thread for the next connection to wake up
+			static constexpr size_t MaxPooled = 16;
+			static constexpr size_t MaxPooledCapacity = 64 * 1024;
+
+			static std::vector<uint8_t> Acquire(size_t nSize)
+			{
+				std::vector<uint8_t> v;
+				std::vector<std::vector<uint8_t>>& vPool = Pool();
+				if (!vPool.empty())
+				{
+					v = std::move(vPool.back());
+					vPool.pop_back();
+				}
+
+				v.resize(nSize);
+				Lent().fetch_add(v.capacity(), std::memory_order_relaxed);
+				return v;
+			}
+
+			// Resizes a borrowed buffer, keeping BytesLent right if it has to reallocate
+			static void Grow(std::vector<uint8_t>& v, size_t nSize)
+			{
+				const size_t nCapacity = v.capacity();
+				v.resize(nSize);
+				Lent().fetch_add(v.capacity() - nCapacity, std::memory_order_relaxed);
+			}
+
+			// Leaves v empty and holding nothing
+			static void Release(std::vector<uint8_t>& v)
+			{
+				if (v.capacity() == 0)
+					return;
+
+				Lent().fetch_sub(v.capacity(), std::memory_order_relaxed);
+
+				// One grown for a large message is not worth keeping around
+				std::vector<std::vector<uint8_t>>& vPool = Pool();
+				if (vPool.size() < MaxPooled && v.capacity() <= MaxPooledCapacity)
+					vPool.push_back(std::move(v));
+				v = std::vector<uint8_t>();
+			}
+
+			// Bytes of receive buffer currently held by connections, across every thread
+			static size_t BytesLent()
+			{
+				return Lent().load(std::memory_order_relaxed);
+			}
+
+		private:
+			static std::vector<std::vector<uint8_t>>& Pool()
+			{
+				thread_local std::vector<std::vector<uint8_t>> vPool;
+				return vPool;
+			}
+
+			static std::atomic<size_t>& Lent()
+			{
+				static std::atomic<size_t> nLent{ 0 };
+				return nLent;
+			}
+		};
+
+		// std::deque with the parts of its interface the connection queues use, which holds no
+		// storage until something is queued and gives it back once left idle, see trim. An
+		// empty std::deque can cost several hundred bytes, multiplied by every idle connection
+		template <typename T>
+		class lazy_deque
+		{
+		public:
+			using iterator = typename std::deque<T>::iterator;
+
+			bool empty() const { return !m_pItems || m_pItems->empty(); }
+			size_t size() const { return m_pItems ? m_pItems->size() : 0; }
+
+			T& front() { return m_pItems->front(); }
+			const T& front() const { return m_pItems->front(); }
+
+			// Value initialised iterators compare equal, so an empty queue iterates as one
+			iterator begin() { return m_pItems ? m_pItems->begin() : iterator(); }
+			iterator end() { return m_pItems ? m_pItems->end() : iterator(); }
+
+			void push_back(T&& item)
+			{
+				Items().push_back(std::move(item));
+			}
+
+			void push_back(const T& item)
+			{
+				Items().push_back(item);
+			}
+
+			// Storage is kept when the last item goes, a busy queue empties and refills constantly
+			void pop_front()
+			{
+				m_pItems->pop_front();
+			}
+
+			// Moves [first, last) in ahead of everything queued
+			template <typename It>
+			void prepend(It first, It last)
+			{
+				if (first != last)
+					Items().insert(Items().begin(), std::make_move_iterator(first), std::make_move_iterator(last));
+			}
+
+			void clear()
+			{
+				m_pItems.reset();
+			}
+
+			template <typename Pred>
+			void remove_if(Pred pred)
+			{
+				if (m_pItems)
+					m_pItems->erase(std::remove_if(m_pItems->begin(), m_pItems->end(), pred), m_pItems->end());
+			}
+
+			// Gives the storage back if the queue is empty and nothing has been queued since
+			// the last trim, so only a queue left alone between two sweeps loses it
+			void trim()
+			{
+				if (m_pItems && m_pItems->empty() && !m_bUsed)
+					m_pItems.reset();
+				m_bUsed = false;
+			}
+
+		private:
+			std::deque<T>& Items()
+			{
+				m_bUsed = true;
+				if (!m_pItems)
+					m_pItems = std::make_unique<std::deque<T>>();
+				return *m_pItems;
+			}
+
+		private:
+			std::unique_ptr<std::deque<T>> m_pItems;
+			bool m_bUsed = false;
+		};
+
+		// Rough size of what make_shared<U> allocates: the object behind a control block of a
+		// vtable pointer and two counts, padded out to the object's alignment
+		template <typename U>
+		constexpr size_t SharedAllocationSize()
+		{
+			constexpr size_t nControl = sizeof(void*) + 2 * sizeof(uint32_t);
+			return (nControl + alignof(U) - 1) / alignof(U) * alignof(U) + sizeof(U);
+		}
+	}
+}
\ No newline at end of file
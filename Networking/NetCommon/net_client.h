@@ -4,12 +4,14 @@
 #include "net_message.h"
 #include "net_tsqueue.h"
 #include "net_connection.h"
+#include "net_connector.h"
+#include "net_log.h"
 
 namespace asr
 {
 	namespace net
 	{
-		template <typename T>
+		template <typename T, typename Transport = tcp_transport>
 		class client_interface
 		{
 		public:
@@ -25,45 +27,50 @@ namespace asr
 			}
 
 		public:
-			// Connect to server with hostname/ip-address and port
-			bool Connect(const std::string& host, const uint16_t port)
+			// Connect to server with hostname/ip-address and port. Returns once the attempt has
+			// started, use WaitForConnection or GetConnectStatus to see how it went
+			bool Connect(const std::string& host, const uint16_t port, const connect_options& options = {})
 			{
-				try
-				{
-					// Resolve hostname/ip-address into physical address
-					asio::ip::tcp::resolver resolver(m_context);
-					asio::ip::tcp::resolver::results_type endpoints = resolver.resolve(host, std::to_string(port));
+				return Connect(std::vector<server_address>{ { host, port } }, options);
+			}
 
-					// Create connection
-					m_connection = std::make_unique<connection<T>>(
-						connection<T>::owner::client,
-						m_context,
-						asio::ip::tcp::socket(m_context),
-						m_qMessagesIn
-						);
+			// Connect to the first server of a list that answers, trying each in turn
+			bool Connect(const std::vector<server_address>& vServers, const connect_options& options = {})
+			{
+				std::vector<connect_target<Transport>> vTargets;
+				for (auto& server : vServers)
+					vTargets.push_back({ server.sHost, server.nPort, {} });
 
-					// Tell the connection to connect to the server
-					m_connection->ConnectToServer(endpoints);
+				return StartConnect(std::move(vTargets), options);
+			}
 
-					// Start context thread
-					thrContext = std::thread([this]() {m_context.run(); });
-				}
-				catch (std::exception& e)
-				{
-					std::cerr << "Client Exception: " << e.what() << "\n";
-					return false;
-				}
+			// Connect to a server at a transport endpoint, such as a socket path
+			bool Connect(const typename Transport::protocol::endpoint& endpoint, const connect_options& options = {})
+			{
+				return Connect(std::array<typename Transport::protocol::endpoint, 1>{ endpoint }, options);
+			}
 
-				return true;
+			// Connect to the first reachable endpoint of a sequence
+			template <typename EndpointSequence>
+			bool Connect(const EndpointSequence& endpoints, const connect_options& options = {})
+			{
+				connect_target<Transport> target;
+				for (const typename Transport::protocol::endpoint& endpoint : endpoints)
+					target.vEndpoints.push_back(endpoint);
+
+				return StartConnect({ std::move(target) }, options);
 			}
 
 			// Disconnect from server
 			void Disconnect()
 			{
 				// If connection exists and is connected
-				if (IsConnected())
 				{
-					m_connection->Disconnect();
+					std::scoped_lock lock(m_muxConnection);
+					if (m_connection && m_connection->IsConnected())
+					{
+						m_connection->Disconnect();
+					}
 				}
 
 				// Stop the context and its threads
@@ -71,28 +78,296 @@ namespace asr
 				if (thrContext.joinable())
 					thrContext.join();
 
-				// Destroy the connection object
-				m_connection.release();
+				// Nothing else is running now, so the attempt can be stopped from here
+				m_nConnectGeneration++;
+				if (auto pRace = std::move(m_pRace))
+					pRace->Cancel();
+				asio::error_code ec;
+				m_timerConnect.cancel(ec);
+				SetConnectStatus(connect_status::idle);
+
+				// Anything not yet acknowledged stays with the session for the next Connect.
+				// Handlers the stopped context still holds run on the next Connect, so the
+				// connection is kept alive with the others retired rather than destroyed
+				std::scoped_lock lock(m_muxConnection);
+				if (m_connection)
+				{
+					m_connection->DetachSession();
+					m_vRetired.push_back(std::move(m_connection));
+				}
 			}
 
-			// Chceks if client is connected to a server
+			// Chceks if client is connected to a server. Also true while a Connect is still
+			// trying, so a client can send straight away and have it go out once connected
 			bool IsConnected()
 			{
+				if (m_nConnectStatus == connect_status::connecting)
+					return true;
+
+				std::scoped_lock lock(m_muxConnection);
 				if (m_connection)
 					return m_connection->IsConnected();
 				else
 					return false;
 			}
 
+			connect_status GetConnectStatus() const
+			{
+				return m_nConnectStatus;
+			}
+
+			// Blocks until the current Connect succeeds or gives up, true if connected
+			bool WaitForConnection(std::chrono::milliseconds tTimeout)
+			{
+				std::unique_lock<std::mutex> ul(m_muxConnect);
+				m_cvConnect.wait_for(ul, tTimeout, [this]() { return m_nConnectStatus != connect_status::connecting; });
+				return m_nConnectStatus == connect_status::connected;
+			}
+
+			// Capabilities accepted from the server during the handshake, set before Connect()
+			void SetCapabilities(uint8_t nCapabilities)
+			{
+				m_nCapabilities = nCapabilities;
+			}
+
+			// Limits on what the server may send, set before Connect()
+			void SetIngressLimits(const ingress_limits& limits)
+			{
+				m_ingressLimits = limits;
+			}
+
+			// Smallest body compressed if the server offers compression, set before Connect()
+			void SetCompressionThreshold(size_t nBytes)
+			{
+				m_nCompressionThreshold = nBytes;
+			}
+
+			// True if the last Connect picked up where the one before left off, with nothing
+			// lost either way. Otherwise the server sees a new client and state must be resynced
+			bool IsResumed() const
+			{
+				std::scoped_lock lock(m_muxConnection);
+				return m_connection ? m_connection->IsResumed() : false;
+			}
+
+			// The next Connect starts a new session instead of resuming this one
+			void ResetSession()
+			{
+				m_pSession.reset();
+			}
+
+		private:
+			bool StartConnect(std::vector<connect_target<Transport>> vTargets, const connect_options& options)
+			{
+				try
+				{
+					// Tidy up after any earlier connection, keeping its session to resume
+					Disconnect();
+					m_context.restart();
+
+					if (vTargets.empty())
+					{
+						SetConnectStatus(connect_status::failed);
+						return false;
+					}
+
+					m_vTargets = std::move(vTargets);
+					m_connectOptions = options;
+					m_tConnectDeadline = std::chrono::steady_clock::now() + options.tTimeout;
+					m_nTargetsTried = 0;
+					m_nFirstTarget = options.bSpreadLoad ? std::uniform_int_distribution<size_t>(0, m_vTargets.size() - 1)(m_rngTargets) : 0;
+
+					{
+						std::scoped_lock lock(m_muxConnection);
+						CreateConnection();
+					}
+					SetConnectStatus(connect_status::connecting);
+
+					uint64_t nGeneration = m_nConnectGeneration;
+					asio::post(m_context, [this, nGeneration]() { TryNextServer(nGeneration); });
+
+					// Start context thread
+					thrContext = std::thread([this]() {m_context.run(); });
+				}
+				catch (std::exception& e)
+				{
+					ASR_NET_LOG(error, "Client Exception: ", e.what());
+					SetConnectStatus(connect_status::failed);
+					return false;
+				}
+
+				return true;
+			}
+
+			// Called with m_muxConnection held
+			void CreateConnection()
+			{
+				if (!m_pSession)
+					m_pSession = std::make_shared<session::state<T>>();
+
+				// Create connection
+				m_connection = std::make_unique<connection<T, Transport>>(
+					connection<T, Transport>::owner::client,
+					m_context,
+					typename Transport::protocol::socket(m_context),
+					m_qMessagesIn
+					);
+
+				m_connection->SetCapabilities(m_nCapabilities);
+				m_connection->SetIngressLimits(m_ingressLimits);
+				m_connection->SetCompressionThreshold(m_nCompressionThreshold);
+				m_connection->SetSession(m_pSession);
+
+				// Runs on the asio thread once the server has accepted us
+				uint64_t nGeneration = m_nConnectGeneration;
+				m_connection->SetValidatedHandler(
+					[this, nGeneration]()
+					{
+						if (nGeneration != m_nConnectGeneration)
+							return;
+
+						asio::error_code ec;
+						m_timerConnect.cancel(ec);
+						SetConnectStatus(connect_status::connected);
+					}
+				);
+
+				// The server dropped us mid handshake, no need to wait out its deadline
+				connection<T, Transport>* pConnection = m_connection.get();
+				m_connection->SetHandshakeFailedHandler(
+					[this, nGeneration, pConnection]()
+					{
+						if (nGeneration != m_nConnectGeneration || pConnection != m_connection.get()
+							|| m_nConnectStatus != connect_status::connecting)
+							return;
+
+						ASR_NET_LOG(info, "Connect fail: handshake failed");
+						FailOver(nGeneration);
+					}
+				);
+			}
+
+			// Asio thread. Carries anything sent meanwhile over to a fresh connection and
+			// moves on to the next server. Sends are held off while the connection is swapped,
+			// so none land on the retired one after its session has gone
+			void FailOver(uint64_t nGeneration)
+			{
+				if (auto pRace = std::move(m_pRace))
+					pRace->Cancel();
+				asio::error_code ec;
+				m_timerConnect.cancel(ec);
+
+				{
+					std::scoped_lock lock(m_muxConnection);
+					m_connection->DetachSession();
+					m_vRetired.push_back(std::move(m_connection));
+					CreateConnection();
+				}
+				TryNextServer(nGeneration);
+			}
+
+			// Asio thread. Gives the next server in the list its turn, each has its own deadline
+			// covering resolve, connect and handshake, all inside the overall one
+			void TryNextServer(uint64_t nGeneration)
+			{
+				if (nGeneration != m_nConnectGeneration)
+					return;
+
+				auto tNow = std::chrono::steady_clock::now();
+				if (m_nTargetsTried >= m_vTargets.size() || tNow >= m_tConnectDeadline)
+				{
+					ASR_NET_LOG(info, "Connect fail: no server answered");
+					SetConnectStatus(connect_status::failed);
+					return;
+				}
+
+				const connect_target<Transport>& target = m_vTargets[(m_nFirstTarget + m_nTargetsTried++) % m_vTargets.size()];
+				size_t nAttempt = m_nTargetsTried;
+				auto tServerDeadline = std::min(m_tConnectDeadline, tNow + m_connectOptions.tServerTimeout);
+
+				// A server that accepts but never completes the handshake is given up on too
+				m_timerConnect.expires_at(tServerDeadline);
+				m_timerConnect.async_wait(
+					[this, nGeneration, nAttempt](std::error_code ec)
+					{
+						// The race may have failed over already, or the handshake just finished
+						if (ec || !IsCurrentAttempt(nGeneration, nAttempt) || m_nConnectStatus != connect_status::connecting)
+							return;
+
+						ASR_NET_LOG(info, "Connect fail: server timed out");
+						FailOver(nGeneration);
+					}
+				);
+
+				m_pRace = std::make_shared<connect_race<Transport>>(m_context, target, m_connectOptions.tAttemptDelay, tServerDeadline,
+					[this, nGeneration, nAttempt](std::error_code ec, typename Transport::protocol::socket socket)
+					{
+						// Cancelled, by whoever took m_pRace first
+						if (!m_pRace || !IsCurrentAttempt(nGeneration, nAttempt))
+							return;
+
+						m_pRace.reset();
+						if (ec)
+						{
+							ASR_NET_LOG(info, "Connect fail: ", ec.message());
+							asio::error_code ecIgnored;
+							m_timerConnect.cancel(ecIgnored);
+							TryNextServer(nGeneration);
+							return;
+						}
+
+						m_connection->ConnectToServer(std::move(socket));
+					}
+				);
+				m_pRace->Start();
+			}
+
+			bool IsCurrentAttempt(uint64_t nGeneration, size_t nAttempt) const
+			{
+				return nGeneration == m_nConnectGeneration && nAttempt == m_nTargetsTried;
+			}
+
+			void SetConnectStatus(connect_status nStatus)
+			{
+				{
+					std::scoped_lock lock(m_muxConnect);
+					m_nConnectStatus = nStatus;
+				}
+				m_cvConnect.notify_all();
+			}
+
 		public:
 			// Send a message to the server
-			void Send(const message<T>& msg)
+			void Send(message<T> msg)
 			{
-				m_connection->Send(msg);
+				std::scoped_lock lock(m_muxConnection);
+				if (m_connection)
+					m_connection->Send(std::move(msg));
+			}
+
+			// Smoothed round trip time to the server, zero until measured
+			std::chrono::nanoseconds GetRoundTripTime() const
+			{
+				std::scoped_lock lock(m_muxConnection);
+				return m_connection ? m_connection->GetRoundTripTime() : std::chrono::nanoseconds(0);
+			}
+
+			// Mean deviation of the round trip time
+			std::chrono::nanoseconds GetJitter() const
+			{
+				std::scoped_lock lock(m_muxConnection);
+				return m_connection ? m_connection->GetJitter() : std::chrono::nanoseconds(0);
+			}
+
+			// How far the server's steady_clock is ahead of ours
+			std::chrono::nanoseconds GetClockOffset() const
+			{
+				std::scoped_lock lock(m_muxConnection);
+				return m_connection ? m_connection->GetClockOffset() : std::chrono::nanoseconds(0);
 			}
 
 			// Retrieve queue of messages from sever
-			tsqueue<owned_message<T>>& Incoming()
+			tsqueue<owned_message<T, Transport>>& Incoming()
 			{
 				return m_qMessagesIn;
 			}
@@ -102,12 +377,41 @@ namespace asr
 			asio::io_context m_context;
 			// Thread to execute its work commands
 			std::thread thrContext;
-			// Single connection object which handles data transfer
-			std::unique_ptr<connection<T>> m_connection;
+			// Single connection object which handles data transfer. Swapped on the asio thread
+			// when a Connect moves on to the next server, so read from other threads under the lock
+			std::unique_ptr<connection<T, Transport>> m_connection;
+			mutable std::mutex m_muxConnection;
+			// Wire capabilities this client is willing to use, the server decides which are enabled
+			uint8_t m_nCapabilities = wire::compact_header | wire::checksum | wire::time_sync | wire::resume | wire::compression;
+			// Limits on what the server may send
+			ingress_limits m_ingressLimits;
+			size_t m_nCompressionThreshold = connection<T, Transport>::DefaultCompressionThreshold;
+			// Session carried from one connection to the next
+			std::shared_ptr<session::state<T>> m_pSession;
+
+			// The servers of the current Connect, and how far through them it has got
+			std::vector<connect_target<Transport>> m_vTargets;
+			connect_options m_connectOptions;
+			std::chrono::steady_clock::time_point m_tConnectDeadline;
+			size_t m_nFirstTarget = 0;
+			size_t m_nTargetsTried = 0;
+			std::mt19937_64 m_rngTargets{ std::random_device{}() };
+
+			// Bumped by Disconnect, so handlers of an abandoned attempt do nothing
+			uint64_t m_nConnectGeneration = 0;
+			std::shared_ptr<connect_race<Transport>> m_pRace;
+			asio::steady_timer m_timerConnect{ m_context };
+
+			// Connections failed over from or disconnected, kept until the client goes as asio may still refer to them
+			std::vector<std::unique_ptr<connection<T, Transport>>> m_vRetired;
+
+			std::atomic<connect_status> m_nConnectStatus{ connect_status::idle };
+			std::mutex m_muxConnect;
+			std::condition_variable m_cvConnect;
 
 		private:
 			// Thread safe queue of incoming messages from server
-			tsqueue<owned_message<T>> m_qMessagesIn;
+			tsqueue<owned_message<T, Transport>> m_qMessagesIn;
 		};
 	}
 }
\ No newline at end of file
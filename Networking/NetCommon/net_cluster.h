@@ -0,0 +1,533 @@
+#pragma once
+#include "net_common.h"
+#include "net_message.h"
+#include "net_connection.h"
+#include "net_server.h"
+#include "net_log.h"
+
+namespace asr
+{
+	namespace net
+	{
+		namespace cluster
+		{
+			// What a message between nodes is for, carried at the end of its body
+			enum class kind : uint8_t
+			{
+				client,
+				broadcast,
+				publish,
+				node,
+				subscribe,
+				unsubscribe,
+				reset
+			};
+
+			// Appended to the body of every message between nodes, [target][origin][kind].
+			// The target is a client ID or a topic
+			constexpr size_t EnvelopeSize = 2 * sizeof(uint32_t) + sizeof(uint8_t);
+
+			// ID given to connections from other nodes, never handed to a client
+			constexpr uint32_t PeerLinkID = 0;
+
+			// Points each node puts on the ring, more spread the clients more evenly
+			constexpr size_t RingReplicas = 64;
+
+			// Dropped links to other nodes are dialled again this often
+			constexpr std::chrono::seconds RedialInterval{ 1 };
+
+			// Links between nodes don't need time sync or resumption
+			constexpr uint8_t LinkCapabilities = wire::compact_header | wire::checksum;
+
+			// splitmix64 finaliser, spreads IDs that only differ in a few bits
+			inline uint64_t Mix(uint64_t v)
+			{
+				v += 0x9E3779B97F4A7C15;
+				v = (v ^ (v >> 30)) * 0xBF58476D1CE4E5B9;
+				v = (v ^ (v >> 27)) * 0x94D049BB133111EB;
+				return v ^ (v >> 31);
+			}
+
+			// Consistent hashing of client IDs onto nodes. Adding or removing a node only
+			// moves the clients that land next to its points
+			class hash_ring
+			{
+			public:
+				void Add(uint32_t nNode, size_t nReplicas = RingReplicas)
+				{
+					for (size_t i = 0; i < nReplicas; i++)
+						m_vPoints.push_back({ Mix((uint64_t(nNode) << 32) | i), nNode });
+					std::sort(m_vPoints.begin(), m_vPoints.end());
+				}
+
+				void Remove(uint32_t nNode)
+				{
+					m_vPoints.erase(std::remove_if(m_vPoints.begin(), m_vPoints.end(),
+						[nNode](const point& p) { return p.nNode == nNode; }), m_vPoints.end());
+				}
+
+				// Node owning nKey, the first point clockwise from its hash
+				uint32_t NodeFor(uint32_t nKey) const
+				{
+					if (m_vPoints.empty())
+						return 0;
+
+					point key{ Mix(~uint64_t(nKey)), 0 };
+					auto it = std::lower_bound(m_vPoints.begin(), m_vPoints.end(), key);
+					return it != m_vPoints.end() ? it->nNode : m_vPoints.front().nNode;
+				}
+
+			private:
+				struct point
+				{
+					uint64_t nHash;
+					uint32_t nNode;
+
+					bool operator < (const point& rhs) const
+					{
+						return nHash < rhs.nHash || (nHash == rhs.nHash && nNode < rhs.nNode);
+					}
+				};
+
+				std::vector<point> m_vPoints;
+			};
+		}
+
+		// A server that is one node of several sharing a space, on one host or many. Every
+		// node dials every other node's peer port and sends over that link, so messages only
+		// cross between nodes once however many clients they are for. Client IDs are handed
+		// out so they hash to the node they are on, letting any node route to any client.
+		// Derive from this and override OnMessage etc. as with server_interface
+		template <typename T, typename Transport = tcp_transport>
+		class cluster_server : public server_interface<T, Transport>
+		{
+		public:
+			using connection_ptr = std::shared_ptr<connection<T, Transport>>;
+
+			// Node IDs start at 1. nPeerPort of 0 runs a node on its own, without accepting other nodes
+			cluster_server(uint16_t nPort, uint32_t nNodeID, uint16_t nPeerPort = 0)
+				: server_interface<T, Transport>(nPort), m_nNodeID(nNodeID), m_timerRedial(this->m_asioContext), m_peerAcceptor(this->m_asioContext)
+			{
+				if (nPeerPort != 0)
+					m_peerAcceptor = typename Transport::protocol::acceptor(this->m_asioContext, Transport::ListenEndpoint(nPeerPort));
+
+				m_ring.Add(m_nNodeID);
+			}
+
+			virtual ~cluster_server()
+			{
+				this->Stop();
+			}
+
+		public:
+			// Another node of the cluster, every node must be told about every other before Start().
+			// Links are only accepted from the hosts sHost resolves to
+			void AddPeer(uint32_t nNodeID, const std::string& sHost, uint16_t nPeerPort)
+			{
+				m_vPeers.push_back({ nNodeID, sHost, nPeerPort, {}, nullptr });
+				m_ring.Add(nNodeID);
+			}
+
+			bool Start()
+			{
+				try
+				{
+					for (auto& p : m_vPeers)
+					{
+						typename Transport::protocol::resolver resolver(this->m_asioContext);
+						for (auto& entry : resolver.resolve(p.sHost, std::to_string(p.nPort)))
+							p.vEndpoints.push_back(entry.endpoint());
+					}
+
+					if (m_peerAcceptor.is_open())
+						WaitForPeerConnection();
+
+					Redial();
+				}
+				catch (std::exception& e)
+				{
+					ASR_NET_LOG(error, "[CLUSTER] Exception: ", e.what());
+					return false;
+				}
+
+				ASR_NET_LOG(info, "[CLUSTER] Node ", m_nNodeID, " with ", m_vPeers.size(), " peers");
+				return server_interface<T, Transport>::Start();
+			}
+
+			uint32_t NodeID() const
+			{
+				return m_nNodeID;
+			}
+
+			// Node a client lives on
+			uint32_t NodeOf(uint32_t nClientID) const
+			{
+				return m_ring.NodeFor(nClientID);
+			}
+
+			// Sends to a client wherever it lives
+			void MessageClientByID(uint32_t nClientID, const message<T>& msg)
+			{
+				uint32_t nNode = NodeOf(nClientID);
+				if (nNode == m_nNodeID)
+					SendLocal(nClientID, msg);
+				else
+					SendToPeers(Wrap(msg, cluster::kind::client, nClientID), nNode);
+			}
+
+			// Sends to every client on every node
+			void MessageAllNodes(const message<T>& msg, connection_ptr pIgnoreClient = nullptr)
+			{
+				this->MessageAllClients(msg, pIgnoreClient);
+				SendToPeers(Wrap(msg, cluster::kind::broadcast, 0));
+			}
+
+			// Hands a message to another node's OnNodeMessage
+			void MessageNode(uint32_t nNodeID, const message<T>& msg)
+			{
+				SendToPeers(Wrap(msg, cluster::kind::node, 0), nNodeID);
+			}
+
+			void Subscribe(connection_ptr client, uint32_t nTopic)
+			{
+				if (!client)
+					return;
+
+				auto& vClients = m_mapTopicClients[nTopic];
+				if (std::find(vClients.begin(), vClients.end(), client->GetID()) != vClients.end())
+					return;
+
+				vClients.push_back(client->GetID());
+
+				// Other nodes only need to know when the first client here subscribes
+				if (vClients.size() == 1)
+				{
+					std::scoped_lock lock(m_muxPeers);
+					m_setLocalTopics.insert(nTopic);
+					SendToPeersLocked(Control(cluster::kind::subscribe, nTopic), 0);
+				}
+			}
+
+			void Unsubscribe(connection_ptr client, uint32_t nTopic)
+			{
+				auto it = m_mapTopicClients.find(nTopic);
+				if (!client || it == m_mapTopicClients.end())
+					return;
+
+				auto& vClients = it->second;
+				vClients.erase(std::remove(vClients.begin(), vClients.end(), client->GetID()), vClients.end());
+				if (vClients.empty())
+					DropTopic(it);
+			}
+
+			// Sends to the subscribers of a topic on every node, crossing once to each node
+			// that has any
+			void Publish(uint32_t nTopic, const message<T>& msg)
+			{
+				PublishLocal(nTopic, msg);
+
+				auto it = m_mapTopicNodes.find(nTopic);
+				if (it == m_mapTopicNodes.end() || it->second.empty())
+					return;
+
+				message<T> msgWrapped = Wrap(msg, cluster::kind::publish, nTopic);
+				for (uint32_t nNode : it->second)
+					SendToPeers(msgWrapped, nNode);
+			}
+
+		protected:
+			// Called for messages sent with MessageNode
+			virtual void OnNodeMessage(uint32_t /*nFromNode*/, message<T>& /*msg*/)
+			{
+
+			}
+
+			// Only IDs that hash to this node, so every node agrees where a client lives
+			uint32_t NextClientID() override
+			{
+				uint32_t nID = 0;
+				do
+				{
+					nID = this->nIDCounter++;
+				} while (nID == cluster::PeerLinkID || m_ring.NodeFor(nID) != m_nNodeID);
+				return nID;
+			}
+
+			// Called on the asio thread once a client is validated or resumed, a resumed
+			// connection takes its ID over from the one it replaces
+			void TrackClient(const connection_ptr& client) override
+			{
+				std::scoped_lock lock(m_muxClients);
+				m_mapClients[client->GetID()] = client;
+			}
+
+			// Only if the entry is still this connection's
+			void UntrackClient(const connection_ptr& client) override
+			{
+				std::scoped_lock lock(m_muxClients);
+				auto it = m_mapClients.find(client->GetID());
+				if (it == m_mapClients.end())
+					return;
+
+				auto tracked = it->second.lock();
+				if (!tracked || tracked == client)
+					m_mapClients.erase(it);
+			}
+
+			// Traffic from other nodes never reaches OnMessage
+			bool InterceptMessage(connection_ptr client, message<T>& msg) override
+			{
+				if (client->GetID() != cluster::PeerLinkID)
+					return false;
+
+				if (msg.body.size() < cluster::EnvelopeSize)
+					return true;
+
+				uint8_t nKind = 0;
+				uint32_t nOrigin = 0, nTarget = 0;
+				msg >> nKind >> nOrigin >> nTarget;
+
+				switch (cluster::kind(nKind))
+				{
+				case cluster::kind::client:
+					SendLocal(nTarget, msg);
+					break;
+				case cluster::kind::broadcast:
+					this->MessageAllClients(msg);
+					break;
+				case cluster::kind::publish:
+					PublishLocal(nTarget, msg);
+					break;
+				case cluster::kind::node:
+					OnNodeMessage(nOrigin, msg);
+					break;
+				case cluster::kind::subscribe:
+					m_mapTopicNodes[nTarget].insert(nOrigin);
+					break;
+				case cluster::kind::unsubscribe:
+					m_mapTopicNodes[nTarget].erase(nOrigin);
+					break;
+				case cluster::kind::reset:
+					// The node dialled us again, its subscriptions follow
+					for (auto& [nTopic, setNodes] : m_mapTopicNodes)
+						setNodes.erase(nOrigin);
+					break;
+				}
+				return true;
+			}
+
+		private:
+			struct peer
+			{
+				uint32_t nNodeID = 0;
+				std::string sHost;
+				uint16_t nPort = 0;
+				std::vector<typename Transport::protocol::endpoint> vEndpoints;
+
+				// Outgoing link, everything for this node is sent over it
+				std::unique_ptr<connection<T, Transport>> link;
+			};
+
+			message<T> Wrap(message<T> msg, cluster::kind nKind, uint32_t nTarget) const
+			{
+				msg << nTarget << m_nNodeID << uint8_t(nKind);
+				return msg;
+			}
+
+			message<T> Control(cluster::kind nKind, uint32_t nTopic) const
+			{
+				return Wrap(message<T>(), nKind, nTopic);
+			}
+
+			// nNode of 0 sends to every peer
+			void SendToPeers(const message<T>& msg, uint32_t nNode = 0)
+			{
+				std::scoped_lock lock(m_muxPeers);
+				SendToPeersLocked(msg, nNode);
+			}
+
+			void SendToPeersLocked(const message<T>& msg, uint32_t nNode)
+			{
+				for (auto& p : m_vPeers)
+					if ((nNode == 0 || p.nNodeID == nNode) && p.link)
+						p.link->Send(msg);
+			}
+
+			void PublishLocal(uint32_t nTopic, const message<T>& msg)
+			{
+				auto it = m_mapTopicClients.find(nTopic);
+				if (it == m_mapTopicClients.end())
+					return;
+
+				// Subscribers that have gone are dropped as they are found
+				auto& vClients = it->second;
+				vClients.erase(std::remove_if(vClients.begin(), vClients.end(),
+					[&](uint32_t nClientID) { return !SendLocal(nClientID, msg); }), vClients.end());
+
+				if (vClients.empty())
+					DropTopic(it);
+			}
+
+			void DropTopic(typename std::unordered_map<uint32_t, std::vector<uint32_t>>::iterator it)
+			{
+				uint32_t nTopic = it->first;
+				m_mapTopicClients.erase(it);
+
+				std::scoped_lock lock(m_muxPeers);
+				m_setLocalTopics.erase(nTopic);
+				SendToPeersLocked(Control(cluster::kind::unsubscribe, nTopic), 0);
+			}
+
+			// Returns false if the client isn't on this node
+			bool SendLocal(uint32_t nClientID, const message<T>& msg)
+			{
+				connection_ptr client = LocalClient(nClientID);
+				if (!client)
+					return false;
+
+				this->MessageClient(client, msg);
+				return true;
+			}
+
+			// Looked up by ID, kept up to date by TrackClient and UntrackClient
+			connection_ptr LocalClient(uint32_t nClientID)
+			{
+				std::scoped_lock lock(m_muxClients);
+				auto it = m_mapClients.find(nClientID);
+				if (it == m_mapClients.end())
+					return nullptr;
+
+				auto client = it->second.lock();
+				return client && !client->IsSuperseded() ? client : nullptr;
+			}
+
+			// ASYNC - Links from other nodes, their messages arrive with the client ones
+			void WaitForPeerConnection()
+			{
+				m_peerAcceptor.async_accept(
+					[this](std::error_code ec, typename server_interface<T, Transport>::socket_type socket)
+					{
+						asio::error_code ecRemote;
+						auto remote = socket.remote_endpoint(ecRemote);
+						if (!ec && (ecRemote || !IsPeerHost(remote)))
+						{
+							// Anything on the link is trusted as another node's, so only they may open one
+							ASR_NET_LOG(warn, "[CLUSTER] Refused link from ", remote, ", not a configured peer");
+							asio::error_code ecIgnored;
+							socket.close(ecIgnored);
+						}
+						else if (!ec)
+						{
+							ASR_NET_LOG(info, "[CLUSTER] Peer connected: ", remote);
+							Transport::ConfigureSocket(socket);
+
+							auto link = std::make_shared<connection<T, Transport>>(connection<T, Transport>::owner::server,
+								this->m_asioContext, std::move(socket), this->m_qMessagesIn);
+							link->SetCapabilities(cluster::LinkCapabilities);
+							link->ConnectToClient(nullptr, cluster::PeerLinkID);
+							m_vIncoming.push_back(std::move(link));
+						}
+						else
+						{
+							ASR_NET_LOG(warn, "[CLUSTER] Peer connection error: ", ec.message());
+						}
+
+						WaitForPeerConnection();
+					}
+				);
+			}
+
+			// Links are only accepted from the hosts peers were configured with. A node dials out
+			// from the address it is reached on unless its host routes otherwise
+			bool IsPeerHost(const typename Transport::protocol::endpoint& remote) const
+			{
+				for (auto& p : m_vPeers)
+					for (auto& endpoint : p.vEndpoints)
+						if (Transport::SameHost(endpoint, remote))
+							return true;
+				return false;
+			}
+
+			// Dials any node without a working link, then checks again later. Dead links are
+			// kept one more round so handlers still in flight never outlive them
+			void Redial()
+			{
+				m_vRetired.clear();
+
+				for (auto it = m_vIncoming.begin(); it != m_vIncoming.end();)
+				{
+					if (!(*it)->IsConnected())
+					{
+						m_vRetired.push_back(std::move(*it));
+						it = m_vIncoming.erase(it);
+					}
+					else
+					{
+						++it;
+					}
+				}
+
+				{
+					std::scoped_lock lock(m_muxPeers);
+					for (auto& p : m_vPeers)
+					{
+						if (p.link && p.link->IsConnected())
+							continue;
+
+						if (p.link)
+						{
+							ASR_NET_LOG(info, "[CLUSTER] Link to node ", p.nNodeID, " down, redialling");
+							m_vRetired.push_back(std::move(p.link));
+						}
+
+						p.link = std::make_unique<connection<T, Transport>>(connection<T, Transport>::owner::client,
+							this->m_asioContext, typename Transport::protocol::socket(this->m_asioContext), m_qLinkIn);
+						p.link->SetCapabilities(cluster::LinkCapabilities);
+						p.link->ConnectToServer(p.vEndpoints);
+
+						// The node forgets what we were subscribed to, then hears it afresh
+						p.link->Send(Control(cluster::kind::reset, 0));
+						for (uint32_t nTopic : m_setLocalTopics)
+							p.link->Send(Control(cluster::kind::subscribe, nTopic));
+					}
+				}
+
+				m_timerRedial.expires_after(cluster::RedialInterval);
+				m_timerRedial.async_wait(
+					[this](std::error_code ec)
+					{
+						if (!ec)
+							Redial();
+					}
+				);
+			}
+
+		private:
+			uint32_t m_nNodeID = 0;
+			cluster::hash_ring m_ring;
+
+			// Other nodes and the links to them, sent on from the Update thread and redialled
+			// from the asio thread. Topics with subscribers here, for new links
+			std::vector<peer> m_vPeers;
+			std::unordered_set<uint32_t> m_setLocalTopics;
+			std::mutex m_muxPeers;
+
+			// Links from other nodes, and dead links waiting out their handlers. Asio thread only
+			std::vector<std::shared_ptr<connection<T, Transport>>> m_vIncoming;
+			std::vector<std::shared_ptr<connection<T, Transport>>> m_vRetired;
+			asio::steady_timer m_timerRedial;
+			typename Transport::protocol::acceptor m_peerAcceptor;
+
+			// Nothing is sent back on outgoing links, but a connection needs somewhere to put it
+			tsqueue<owned_message<T, Transport>> m_qLinkIn;
+
+			// Local clients by ID, tracked from the asio thread and looked up from the Update one
+			std::unordered_map<uint32_t, std::weak_ptr<connection<T, Transport>>> m_mapClients;
+			std::mutex m_muxClients;
+
+			// Subscribers by topic, and the other nodes with subscribers
+			std::unordered_map<uint32_t, std::vector<uint32_t>> m_mapTopicClients;
+			std::unordered_map<uint32_t, std::unordered_set<uint32_t>> m_mapTopicNodes;
+		};
+	}
+}
\ No newline at end of file
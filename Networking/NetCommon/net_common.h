@@ -1,15 +1,34 @@
 #pragma once
 
 #include <memory>
+#include <new>
+#include <atomic>
+#include <string>
 #include <thread>
 #include <mutex>
 #include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <functional>
 #include <optional>
 #include <vector>
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <algorithm>
 #include <chrono>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <array>
+#include <iterator>
+#include <limits>
+#include <type_traits>
+#include <condition_variable>
+#include <random>
+#include <filesystem>
 
 #ifdef _WIN32
 #define _WIN32_WINNT 0x0A00
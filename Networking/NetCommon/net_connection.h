@@ -2,19 +2,42 @@
 
 #include "net_common.h"
 #include "net_tsqueue.h"
+#include "net_mpsc.h"
 #include "net_message.h"
+#include "net_wire.h"
+#include "net_crc32c.h"
+#include "net_lz.h"
+#include "net_ratelimit.h"
+#include "net_trace.h"
+#include "net_timesync.h"
+#include "net_uring.h"
+#include "net_session.h"
+#include "net_log.h"
 
 namespace asr
 {
 	namespace net
 	{
 		// Forward declare server interface
-		template<typename T>
+		template<typename T, typename Transport>
 		class server_interface;
 
-		template<typename T>
-		class connection : public std::enable_shared_from_this<connection<T>>
+		template<typename T, typename Transport>
+		class connection : public std::enable_shared_from_this<connection<T, Transport>>
 		{
+			// The server stages messages per connection to hand them out fairly
+			friend class server_interface<T, Transport>;
+
+		public:
+			using socket_type = typename Transport::protocol::socket;
+			using endpoint_type = typename Transport::protocol::endpoint;
+
+			// Bytes asked of the socket per read, messages that don't fit are read separately
+			static constexpr size_t ReceiveBufferSize = 16 * 1024;
+
+			// Smallest body compressed once compression is negotiated, unless set otherwise
+			static constexpr size_t DefaultCompressionThreshold = 128;
+
 		public:
 			enum class owner
 			{
@@ -22,38 +45,165 @@ namespace asr
 				client
 			};
 
-			connection(owner parent, asio::io_context& asioContext, asio::ip::tcp::socket socket, tsqueue<owned_message<T>>& qIn)
-				: m_asioContext(asioContext), m_socket(std::move(socket)), m_qMessagesIn(qIn)
+			connection(owner parent, asio::io_context& asioContext, socket_type socket, tsqueue<owned_message<T, Transport>>& qIn)
+				: m_asioContext(asioContext), m_socket(std::move(socket)), m_qMessagesIn(qIn), m_timerIngress(asioContext), m_timerProbe(asioContext), m_timerAck(asioContext)
 			{
 				m_nOwnerType = parent;
 
-				// Construct validation check data
-				if (m_nOwnerType == owner::server)
-				{
-					// Construct random data for the client validation
-					m_nHandshakeOut = uint64_t(std::chrono::system_clock::now().time_since_epoch().count());
+				// Validation data is constructed once the capabilities are known
+				m_nHandshakeIn = 0;
+				m_nHandshakeOut = 0;
 
-					// Calcualte the scrambled result
-					m_nHandshakeCheck = scramble(m_nHandshakeOut);
-				}
-				else
-				{
-					// Client doesn't have to do anything yet
-					m_nHandshakeIn = 0;
-					m_nHandshakeOut = 0;
-				}
+				LiveCount().fetch_add(1, std::memory_order_relaxed);
 			}
 
 			virtual ~connection()
-			{}
+			{
+#ifdef ASR_NET_HAS_IO_URING
+				if (m_nUringKey)
+					m_pUring->Forget(m_nUringKey);
+#endif
+				recv_buffer_pool::Release(m_vRecv);
+				LiveCount().fetch_sub(1, std::memory_order_relaxed);
+			}
+
+			// Rough bytes held per live connection: the object as make_shared allocates it, the
+			// send queue's placeholder node, its share of the sessions and of the receive
+			// buffers lent out. Queued messages, allocator overhead and asio's own per socket
+			// state are not counted
+			static size_t GetFootprintPerConnection()
+			{
+				size_t nLive = LiveCount().load(std::memory_order_relaxed);
+				if (nLive == 0)
+					return 0;
+
+				size_t nSessionBytes = session::state<T>::LiveCount().load(std::memory_order_relaxed) * SharedAllocationSize<session::state<T>>();
+				return SharedAllocationSize<connection>() + mpsc_queue<message<T>>::StubSize()
+					+ (nSessionBytes + recv_buffer_pool::BytesLent()) / nLive;
+			}
 
 			uint32_t GetID() const
 			{
 				return id;
 			}
 
+			// Capabilities this side is willing to use, must be set before connecting
+			void SetCapabilities(uint8_t nCapabilities)
+			{
+				m_nCapabilities = nCapabilities;
+			}
+
+			// Limits on what the remote may send, must be set before connecting
+			void SetIngressLimits(const ingress_limits& limits)
+			{
+				m_ingress.configure(limits);
+			}
+
+			// Bodies at least this big are sent compressed if compression is negotiated and
+			// it makes them smaller, must be set before connecting
+			void SetCompressionThreshold(size_t nBytes)
+			{
+				m_nCompressionThreshold = nBytes;
+			}
+
+#ifdef ASR_NET_HAS_IO_URING
+			// Receive through an io_uring rather than asio's reactor, must be set before connecting
+			void SetUring(std::shared_ptr<uring_receiver> pUring)
+			{
+				m_pUring = std::move(pUring);
+			}
+#endif
+
+			// Capabilities agreed with the remote during the handshake
+			uint8_t GetNegotiatedCapabilities() const
+			{
+				return m_nNegotiated;
+			}
+
+			// Smoothed round trip time, zero until the first probe returns. Needs time_sync
+			std::chrono::nanoseconds GetRoundTripTime() const
+			{
+				return m_clock.RoundTripTime();
+			}
+
+			// Mean deviation of the round trip time
+			std::chrono::nanoseconds GetJitter() const
+			{
+				return m_clock.Jitter();
+			}
+
+			// How far the remote's steady_clock is ahead of ours, subtract it from
+			// a remote time stamp to get local time
+			std::chrono::nanoseconds GetClockOffset() const
+			{
+				return m_clock.ClockOffset();
+			}
+
+			// True once there are estimates to read
+			bool HasTimeSync() const
+			{
+				return m_clock.HasSample();
+			}
+
+			// True if the handshake picked up the session of an earlier connection, so
+			// nothing was lost. Needs resume
+			bool IsResumed() const
+			{
+				return m_bResumed.load(std::memory_order_acquire);
+			}
+
+			// Token naming this connection's session, 0 if there isn't one
+			uint64_t SessionToken() const
+			{
+				return m_nSessionToken.load(std::memory_order_acquire);
+			}
+
+			// Client - session to resume if the server offers resume, must be set before connecting
+			void SetSession(std::shared_ptr<session::state<T>> pSession)
+			{
+				m_pSession = std::move(pSession);
+			}
+
+			// True once a resumed connection has taken over this one's session
+			bool IsSuperseded() const
+			{
+				return m_bSuperseded.load(std::memory_order_acquire);
+			}
+
+			// Closes the socket and hands anything still waiting to be written back to the
+			// session, for the next connection to send. Messages sent afterwards go to
+			// pSuccessor if given. Call from the asio thread, or once the context has stopped
+			void DetachSession(std::shared_ptr<connection> pSuccessor = nullptr)
+			{
+				asio::error_code ec;
+#ifdef ASR_NET_HAS_IO_URING
+				StopUring();
+#endif
+				m_socket.close(ec);
+
+				// Nothing goes out before the handshake completes, so all of it can be carried
+				session::state<T>* pSession = m_bValidated ? ActiveSession() : m_pSession.get();
+				m_bValidated = false;
+				m_pSuccessor = pSuccessor;
+				m_bSuperseded.store(pSuccessor != nullptr, std::memory_order_release);
+
+				message<T> msg;
+				while (m_qSend.pop(msg))
+					m_qMessagesOut.push_back(std::move(msg));
+
+				if (pSession)
+				{
+					for (auto& msgOut : m_qMessagesOut)
+						if (!IsControlMessage(msgOut))
+							pSession->Carry(std::move(msgOut));
+				}
+
+				m_qMessagesOut.clear();
+				m_pSession.reset();
+			}
+
 		public:
-			void ConnectToClient(asr::net::server_interface<T>* server, uint32_t uid = 0)
+			void ConnectToClient(asr::net::server_interface<T, Transport>* server, uint32_t uid = 0)
 			{
 				// Only servers can connect to clients
 				if (m_nOwnerType == owner::server)
@@ -63,6 +213,14 @@ namespace asr
 					{
 						// Gives the client a uid and primes asio to read a header
 						id = uid;
+						m_pServer = server;
+
+						// Construct random data for the client validation, advertising our capabilities
+						m_nHandshakeOut = wire::MakeChallenge(
+							uint64_t(std::chrono::system_clock::now().time_since_epoch().count()), m_nCapabilities);
+
+						// Calcualte the scrambled result
+						m_nHandshakeCheck = scramble(m_nHandshakeOut);
 
 						// Send validation packet to client
 						WriteValidation();
@@ -75,32 +233,65 @@ namespace asr
 				}
 			}
 
-			void ConnectToServer(const asio::ip::tcp::resolver::results_type& endpoints)
+			// Accepts any sequence of endpoints, such as resolver results
+			template <typename EndpointSequence>
+			void ConnectToServer(const EndpointSequence& endpoints)
 			{
 				// Only clients can connect to servers
 				if (m_nOwnerType == owner::client)
 				{
 					// Primes asio to attempt to connect to an endpoint
 					asio::async_connect(m_socket, endpoints, 
-						[this](std::error_code ec, asio::ip::tcp::endpoint endpoint)
+						[this](std::error_code ec, const endpoint_type&)
 						{
 							if (!ec)
 							{
+								Transport::ConfigureSocket(m_socket);
+
 								// Wait for server to send validation packet
 								ReadValidation();
 
 								// Primes asio to read headers from the server
 								//ReadHeader();
 							}
+							else
+							{
+								// No endpoint answered, so IsConnected reports the failure
+								ASR_NET_LOG(info, "Connect fail: ", ec.message());
+								CloseSocket();
+							}
 						}
 					);
 				}
 			}
 
+			// Client - the socket was connected elsewhere, such as by a connect_race, start the handshake
+			void ConnectToServer(socket_type socket)
+			{
+				if (m_nOwnerType == owner::client)
+				{
+					m_socket = std::move(socket);
+					Transport::ConfigureSocket(m_socket);
+					ReadValidation();
+				}
+			}
+
+			// Called on the asio thread once the handshake has completed
+			void SetValidatedHandler(std::function<void()> fnValidated)
+			{
+				m_fnValidated = std::move(fnValidated);
+			}
+
+			// Called on the asio thread if the remote breaks off before the handshake completes
+			void SetHandshakeFailedHandler(std::function<void()> fnHandshakeFailed)
+			{
+				m_fnHandshakeFailed = std::move(fnHandshakeFailed);
+			}
+
 			void Disconnect()
 			{
 				if (IsConnected())
-					asio::post(m_asioContext, [this]() {m_socket.close(); });
+					asio::post(m_asioContext, [this]() {CloseSocket(); });
 			}
 
 			bool IsConnected() const
@@ -109,64 +300,562 @@ namespace asr
 			}
 
 		public:
-			void Send(const message<T>& msg)
+			// Safe from any thread. Messages are handed to the asio thread through a lock free
+			// queue, which is only woken when it goes from empty to not
+			void Send(message<T> msg)
 			{
-				asio::post(m_asioContext,
-					[this, msg]()
+				ASR_NET_TRACE_EVENT(send_posted, id);
+				m_qSend.push(std::move(msg));
+
+				if (!m_bSendPosted.exchange(true, std::memory_order_acq_rel))
+					asio::post(m_asioContext, [this]() { DrainSendQueue(); });
+			}
+
+		private:
+			// Moves everything sent from other threads onto the out queue
+			void DrainSendQueue()
+			{
+				// Cleared first, so anything pushed from here on wakes us again
+				m_bSendPosted.exchange(false, std::memory_order_acq_rel);
+
+				message<T> msg;
+
+				// Replaced by a resumed connection, which sends in this one's place
+				if (!m_bValidated)
+				{
+					if (auto pSuccessor = m_pSuccessor.lock())
 					{
-						// If the messages out queue isn't empty then asio is handling it already
-						bool bWritingMessage = !m_qMessagesOut.empty();
-						m_qMessagesOut.push_back(msg);
+						while (m_qSend.pop(msg))
+							if (!pSuccessor->UsesReservedId(msg))
+								pSuccessor->QueueMessage(std::move(msg));
+						return;
+					}
+				}
+
+				bool bWritingMessage = !m_qMessagesOut.empty();
+				bool bQueued = false;
+				while (m_qSend.pop(msg))
+				{
+					if (UsesReservedId(msg))
+						continue;
+					m_qMessagesOut.push_back(std::move(msg));
+					bQueued = true;
+				}
+
+				if (!bWritingMessage && !m_qMessagesOut.empty() && m_bValidated)
+					WriteHeader();
+
+				if (bQueued)
+					OnTraffic();
+			}
+
+			// ControlId belongs to the library once time_sync or resume is negotiated, the remote
+			// would take an application message using it for one of its own. Until the handshake
+			// is done that isn't known, OnValidated checks whatever was queued meanwhile
+			bool UsesReservedId(const message<T>& msg) const
+			{
+				if (!m_bValidated || msg.header.id != wire::ControlId<T> || !wire::HasControlMessages(m_nNegotiated))
+					return false;
+
+				ASR_NET_LOG(error, "[", id, "] Message id is reserved for control messages, dropped.");
+				return true;
+			}
+
+			// Must be called from the asio thread
+			void QueueMessage(message<T> msg)
+			{
+				// If the messages out queue isn't empty then asio is handling it already
+				bool bWritingMessage = !m_qMessagesOut.empty();
+				m_qMessagesOut.push_back(std::move(msg));
+
+				// Only give a WriteHeader() workload if it's not already writing messages.
+				// Until validation finishes the wire format isn't known, so messages wait
+				if (!bWritingMessage && m_bValidated)
+					WriteHeader();
+			}
+
+			// Sends a time probe, then schedules the next one. Once warmed up, probing stops
+			// while nothing else is sent or received, so idle connections aren't woken
+			void SendProbe()
+			{
+				QueueMessage(timesync::MakeMessage<T>(timesync::kind::probe, 0, 0));
 
-						// Only give a WriteHeader() workload if it's not already writing messages
-						if (!bWritingMessage)
-							WriteHeader();
+				m_nProbesSent++;
+				m_bTrafficSinceProbe = false;
+				m_timerProbe.expires_after(m_nProbesSent < timesync::WarmupProbes ? timesync::WarmupInterval : timesync::ProbeInterval);
+				m_timerProbe.async_wait(
+					[this](std::error_code ec)
+					{
+						if (ec || !m_socket.is_open())
+							return;
+
+						if (m_nProbesSent >= timesync::WarmupProbes && !m_bTrafficSinceProbe)
+							m_bProbeParked = true;
+						else
+							SendProbe();
 					}
 				);
 			}
 
-		private:
-			// ASYNC - Prime context to read a message header
-			void ReadHeader()
+			// An application message went either way, picks probing up again if it had stopped
+			void OnTraffic()
+			{
+				m_bTrafficSinceProbe = true;
+				if (m_bProbeParked)
+				{
+					m_bProbeParked = false;
+					SendProbe();
+				}
+			}
+
+			// Asio thread, from the server's idle sweep. Gives back queue storage left unused
+			// since the last sweep
+			void TrimIdle()
+			{
+				m_qMessagesOut.trim();
+				if (m_pSession)
+					m_pSession->Trim();
+			}
+
+			// Acknowledges straight away once enough has arrived, otherwise shortly after
+			// the first message that hasn't been
+			void ScheduleAck()
+			{
+				if (m_pSession->Received() - m_nAckSent >= session::AckEvery)
+				{
+					SendAck();
+				}
+				else if (!m_bAckScheduled)
+				{
+					m_bAckScheduled = true;
+					m_timerAck.expires_after(session::AckInterval);
+					m_timerAck.async_wait(
+						[this](std::error_code ec)
+						{
+							m_bAckScheduled = false;
+							if (!ec && m_socket.is_open() && ActiveSession() && m_pSession->Received() != m_nAckSent)
+								SendAck();
+						}
+					);
+				}
+			}
+
+			void SendAck()
+			{
+				m_nAckSent = m_pSession->Received();
+				QueueMessage(session::MakeAck<T>(m_nAckSent));
+			}
+
+			// Answers probes and feeds replies to the estimator, and takes acknowledgements
+			void OnControlMessage()
+			{
+				int64_t tNow = timesync::Now();
+				message<T>& msg = m_msgTemporaryIn;
+				if (msg.body.empty())
+					return;
+
+				// Every control message ends with its kind
+				if (msg.body[msg.body.size() - 1] == uint8_t(session::kind::ack))
+				{
+					if (msg.body.size() == session::BodySize && ActiveSession())
+					{
+						uint8_t nKind = 0;
+						uint64_t nReceived = 0;
+						msg >> nKind >> nReceived;
+						m_pSession->Acknowledge(nReceived);
+					}
+					return;
+				}
+
+				if (msg.body.size() != timesync::BodySize)
+					return;
+
+				uint8_t nKind = 0;
+				int64_t t0 = 0, t1 = 0, t2 = 0;
+				msg >> nKind >> t2 >> t1 >> t0;
+
+				if (timesync::kind(nKind) == timesync::kind::probe)
+					QueueMessage(timesync::MakeMessage<T>(timesync::kind::reply, t0, tNow));
+				else if (timesync::kind(nKind) == timesync::kind::reply)
+					m_clock.AddSample(t0, t1, t2, tNow);
+			}
+
+			// Every close comes through here, as an io_uring receive would keep the socket open
+			void CloseSocket()
 			{
-				asio::async_read(m_socket, asio::buffer(&m_msgTemporaryIn.header, sizeof(message_header<T>)),
+				// A session's grace period starts when its connection fails, even if nothing
+				// is ever sent to it again
+				if (m_pServer && m_socket.is_open() && SessionToken() != 0)
+					m_pServer->SessionLost(this->shared_from_this());
+
+#ifdef ASR_NET_HAS_IO_URING
+				StopUring();
+#endif
+				m_socket.close();
+			}
+
+			// ASYNC - Prime context to read whatever the remote has sent. Reads fill a buffer,
+			// so a burst of small messages costs one completion rather than two per message
+			void ReadData()
+			{
+#ifdef ASR_NET_HAS_IO_URING
+				if (m_pUring)
+				{
+					ReceiveUring();
+					return;
+				}
+#endif
+
+				// With nothing partial buffered and nothing waiting on the socket, hand the buffer
+				// back and just wait until there is something to read
+				asio::error_code ec;
+				if (m_nRecvEnd == 0 && m_socket.available(ec) == 0 && !ec)
+				{
+					WaitForData();
+					return;
+				}
+
+				if (m_vRecv.empty())
+					m_vRecv = recv_buffer_pool::Acquire(ReceiveBufferSize);
+
+				m_socket.async_read_some(asio::buffer(m_vRecv.data() + m_nRecvEnd, m_vRecv.size() - m_nRecvEnd),
 					[this](std::error_code ec, std::size_t length)
 					{
 						if (!ec)
 						{
-							if (m_msgTemporaryIn.header.size > 0)
-							{
-								m_msgTemporaryIn.body.resize(m_msgTemporaryIn.header.size);
-								ReadBody();
-							}
-							else
-							{
-								AddToIncomingMessageQueue();
-							}
+							m_nRecvEnd += length;
+							ProcessReceived();
 						}
 						else
 						{
-							std::cout << "[" << id << "] Read header fail.\n";
-							m_socket.close();
+							ASR_NET_LOG(info, "[", id, "] Read fail.");
+							CloseSocket();
 						}
 					}
 					);
 			}
 
-			// ASYNC - Prime context to read a message body
-			void ReadBody()
+#ifdef ASR_NET_HAS_IO_URING
+			// The ring keeps receiving into buffers of its own, so this only arms it if need be
+			// and says more is wanted. Like WaitForData, nothing is held while idle
+			void ReceiveUring()
 			{
-				asio::async_read(m_socket, asio::buffer(m_msgTemporaryIn.body.data(), m_msgTemporaryIn.header.size),
-					[this](std::error_code ec, std::size_t length)
+				if (m_nRecvEnd == 0)
+				{
+					recv_buffer_pool::Release(m_vRecv);
+					m_msgTemporaryIn.body.clear();
+					m_msgTemporaryIn.body.shrink_to_fit();
+				}
+
+				m_bUringWanted = true;
+				if (m_nUringKey != 0)
+					return;
+
+				m_nUringKey = m_pUring->Receive(int(m_socket.native_handle()),
+					[this](int nResult, const uint8_t* pData, bool bMore)
+					{
+						OnUringReceive(nResult, pData, bMore);
+					}
+				);
+				if (m_nUringKey == 0)
+				{
+					ASR_NET_LOG(info, "[", id, "] Read fail.");
+					CloseSocket();
+				}
+			}
+
+			void OnUringReceive(int nResult, const uint8_t* pData, bool bMore)
+			{
+				if (!bMore)
+				{
+					m_nUringKey = 0;
+					m_bUringStopping = false;
+				}
+
+				if (nResult > 0)
+				{
+					// Appended to anything not yet taken out, which may have been left mid buffer
+					// while reading is paused. The buffer grows for messages bigger than it
+					size_t nLength = size_t(nResult);
+					if (m_vRecv.empty())
+						m_vRecv = recv_buffer_pool::Acquire(ReceiveBufferSize);
+					if (m_nRecvEnd + nLength > m_vRecv.size() && m_nRecvStart > 0)
+					{
+						std::memmove(m_vRecv.data(), m_vRecv.data() + m_nRecvStart, m_nRecvEnd - m_nRecvStart);
+						m_nRecvEnd -= m_nRecvStart;
+						m_nRecvStart = 0;
+					}
+					if (m_nRecvEnd + nLength > m_vRecv.size())
+						recv_buffer_pool::Grow(m_vRecv, m_nRecvEnd + nLength);
+					std::memcpy(m_vRecv.data() + m_nRecvEnd, pData, nLength);
+					m_nRecvEnd += nLength;
+
+					if (m_bUringWanted)
+					{
+						m_bUringWanted = false;
+						ProcessReceived();
+					}
+					else if (m_nUringKey != 0 && !m_bUringStopping)
+					{
+						// Reading is paused, leave the rest in the socket so the remote slows down
+						m_bUringStopping = true;
+						m_pUring->Stop(m_nUringKey);
+					}
+				}
+				else if (nResult == 0)
+				{
+					ASR_NET_LOG(info, "[", id, "] Read fail.");
+					CloseSocket();
+				}
+				else if (nResult == -ENOBUFS || nResult == -ECANCELED)
+				{
+					// Out of ring buffers for a moment, or stopped while paused
+					if (m_bUringWanted && m_nUringKey == 0 && m_socket.is_open())
+					{
+						m_bUringWanted = false;
+						ReceiveUring();
+					}
+				}
+				else
+				{
+					ASR_NET_LOG(info, "[", id, "] Read fail: ", std::strerror(-nResult));
+					CloseSocket();
+				}
+			}
+
+			void StopUring()
+			{
+				if (m_nUringKey)
+				{
+					m_pUring->Forget(m_nUringKey);
+					m_nUringKey = 0;
+				}
+			}
+#endif
+
+			// Connections alive in the process, for GetFootprintPerConnection
+			static std::atomic<size_t>& LiveCount()
+			{
+				static std::atomic<size_t> nLive{ 0 };
+				return nLive;
+			}
+
+			// ASYNC - Prime context to wake when the socket is readable, holding no buffer meanwhile
+			void WaitForData()
+			{
+				recv_buffer_pool::Release(m_vRecv);
+				m_msgTemporaryIn.body.clear();
+				m_msgTemporaryIn.body.shrink_to_fit();
+
+				m_socket.async_wait(socket_type::wait_read,
+					[this](std::error_code ec)
+					{
+						if (ec)
+						{
+							ASR_NET_LOG(info, "[", id, "] Read fail.");
+							CloseSocket();
+							return;
+						}
+
+						// Take what has arrived without another trip through the reactor
+						asio::error_code ecRead;
+						if (!m_socket.non_blocking())
+							m_socket.non_blocking(true, ecRead);
+
+						m_vRecv = recv_buffer_pool::Acquire(ReceiveBufferSize);
+						size_t length = m_socket.read_some(asio::buffer(m_vRecv.data(), m_vRecv.size()), ecRead);
+						if (ecRead == asio::error::would_block || ecRead == asio::error::try_again)
+						{
+							WaitForData();
+						}
+						else if (ecRead)
+						{
+							ASR_NET_LOG(info, "[", id, "] Read fail.");
+							CloseSocket();
+						}
+						else
+						{
+							m_nRecvEnd += length;
+							ProcessReceived();
+						}
+					}
+					);
+			}
+
+			// Takes every whole message out of the receive buffer, then reads more
+			void ProcessReceived()
+			{
+				const size_t nTrailer = (m_nNegotiated & wire::checksum) ? wire::ChecksumSize : 0;
+
+				while (true)
+				{
+					const uint8_t* p = m_vRecv.data() + m_nRecvStart;
+					const size_t nAvailable = m_nRecvEnd - m_nRecvStart;
+
+					// Header, legacy peers send the struct as is
+					size_t nHeader = 0;
+					if (m_nNegotiated & wire::compact_header)
+					{
+						if (wire::CountVarints(p, std::min(nAvailable, wire::MaxCompactHeaderSize)) < 2)
+						{
+							if (nAvailable < wire::MaxCompactHeaderSize)
+								break;
+
+							ASR_NET_LOG(warn, "[", id, "] Malformed header.");
+							CloseSocket();
+							return;
+						}
+
+						nHeader = wire::DecodeHeader(p, nAvailable, m_msgTemporaryIn.header,
+							wire::HasCompression(m_nNegotiated) ? &m_bCompressedIn : nullptr);
+						if (nHeader == 0)
+						{
+							ASR_NET_LOG(warn, "[", id, "] Malformed header.");
+							CloseSocket();
+							return;
+						}
+					}
+					else
+					{
+						if (nAvailable < sizeof(message_header<T>))
+							break;
+
+						std::memcpy(&m_msgTemporaryIn.header, p, sizeof(message_header<T>));
+						nHeader = sizeof(message_header<T>);
+					}
+
+					// A corrupted size would have us allocate and read the wrong amount, so the
+					// header's own check has to pass first
+					if (nTrailer)
+					{
+						if (nAvailable < nHeader + wire::HeaderCheckSize)
+							break;
+
+						if (!wire::HeaderCheckMatches(crc32c::Value(p, nHeader), p + nHeader))
+						{
+							ASR_NET_LOG(warn, "[", id, "] Header checksum mismatch.");
+							CloseSocket();
+							return;
+						}
+						nHeader += wire::HeaderCheckSize;
+					}
+
+					// Refuse oversized messages before allocating anything for them
+					const size_t nSize = m_msgTemporaryIn.header.size;
+					if (nSize > m_ingress.limits().nMaxMessageSize)
+					{
+						ASR_NET_LOG(warn, "[", id, "] Message too large (", nSize, " bytes).");
+						CloseSocket();
+						return;
+					}
+
+					const size_t nFrame = nHeader + nSize + nTrailer;
+					if (nAvailable < nFrame)
+					{
+						// Messages that can never fit the buffer are read straight into their body. The
+						// io_uring path grows the buffer instead, as the ring is still receiving
+						if (nFrame > m_vRecv.size())
+						{
+#ifdef ASR_NET_HAS_IO_URING
+							if (m_pUring)
+							{
+								recv_buffer_pool::Grow(m_vRecv, nFrame);
+								break;
+							}
+#endif
+							ReadLargeBody(nHeader);
+							return;
+						}
+						break;
+					}
+
+					// The checksum covers the header and its check exactly as they arrived, plus the body
+					if (nTrailer && crc32c::Value(p, nHeader + nSize) != wire::LoadChecksum(p + nHeader + nSize))
+					{
+						ASR_NET_LOG(warn, "[", id, "] Checksum mismatch.");
+						CloseSocket();
+						return;
+					}
+
+					if (m_bCompressedIn)
+					{
+						if (!Inflate(p + nHeader, nSize))
+							return;
+					}
+					else
+					{
+						m_msgTemporaryIn.body.assign(p + nHeader, p + nHeader + nSize);
+					}
+					m_nRecvStart += nFrame;
+
+					if (!AddToIncomingMessageQueue())
+						return;
+				}
+
+				// Move the start of any partial message to the front and read the rest
+				if (m_nRecvStart > 0)
+				{
+					std::memmove(m_vRecv.data(), m_vRecv.data() + m_nRecvStart, m_nRecvEnd - m_nRecvStart);
+					m_nRecvEnd -= m_nRecvStart;
+					m_nRecvStart = 0;
+				}
+
+				ReadData();
+			}
+
+			// ASYNC - Prime context to read the rest of a message too big for the receive buffer
+			// directly into its body, along with its checksum trailer if negotiated
+			void ReadLargeBody(size_t nHeader)
+			{
+				const uint8_t* p = m_vRecv.data() + m_nRecvStart;
+				const size_t nAvailable = m_nRecvEnd - m_nRecvStart;
+				const size_t nSize = m_msgTemporaryIn.header.size;
+				const size_t nTrailer = (m_nNegotiated & wire::checksum) ? wire::ChecksumSize : 0;
+
+				if (nTrailer)
+					m_nChecksumIn = crc32c::Value(p, nHeader);
+
+				// Keep what has already arrived
+				size_t nBodyHave = std::min(nSize, nAvailable - nHeader);
+				size_t nTrailerHave = std::min(nTrailer, nAvailable - nHeader - nBodyHave);
+				m_msgTemporaryIn.body.resize(nSize);
+				std::memcpy(m_msgTemporaryIn.body.data(), p + nHeader, nBodyHave);
+				std::memcpy(m_aTrailerIn.data(), p + nHeader + nBodyHave, nTrailerHave);
+				m_nRecvStart = m_nRecvEnd = 0;
+				recv_buffer_pool::Release(m_vRecv);
+
+				std::array<asio::mutable_buffer, 2> buffers = {
+					asio::buffer(m_msgTemporaryIn.body.data() + nBodyHave, nSize - nBodyHave),
+					asio::buffer(m_aTrailerIn.data() + nTrailerHave, nTrailer - nTrailerHave)
+				};
+
+				asio::async_read(m_socket, buffers,
+					[this, nTrailer](std::error_code ec, std::size_t length)
 					{
 						if (!ec)
 						{
-							AddToIncomingMessageQueue();
+							if (nTrailer)
+							{
+								// Drop the connection rather than pass on a corrupted message
+								m_nChecksumIn = crc32c::Extend(m_nChecksumIn, m_msgTemporaryIn.body.data(), m_msgTemporaryIn.body.size());
+								if (m_nChecksumIn != wire::LoadChecksum(m_aTrailerIn.data()))
+								{
+									ASR_NET_LOG(warn, "[", id, "] Checksum mismatch.");
+									CloseSocket();
+									return;
+								}
+							}
+
+							if (m_bCompressedIn && !Inflate(m_msgTemporaryIn.body.data(), m_msgTemporaryIn.body.size()))
+								return;
+
+							if (AddToIncomingMessageQueue())
+								ReadData();
 						}
 						else
 						{
-							std::cout << "[" << id << "] Read body fail.\n";
-							m_socket.close();
+							ASR_NET_LOG(info, "[", id, "] Read body fail.");
+							CloseSocket();
 						}
 					}
 					);
@@ -175,67 +864,203 @@ namespace asr
 			// ASYNC - Prime context to write a message header
 			void WriteHeader()
 			{
-				asio::async_write(m_socket, asio::buffer(&m_qMessagesOut.front().header, sizeof(message_header<T>)), 
+				if ((m_nNegotiated & wire::time_sync) && m_qMessagesOut.front().header.id == wire::ControlId<T>)
+					timesync::StampSendTime(m_qMessagesOut.front());
+
+				// Bodies big enough go out compressed if that makes them smaller, the message itself
+				// is left as it is for replay
+				const message<T>& msg = m_qMessagesOut.front();
+				m_bCompressedOut = wire::HasCompression(m_nNegotiated) && msg.body.size() >= m_nCompressionThreshold
+					&& !IsControlMessage(msg) && Compressor().Compress(msg.body.data(), msg.body.size());
+				asio::const_buffer body = BodyOut();
+
+				// Legacy peers get the header struct as is, otherwise it is varint encoded
+				asio::const_buffer header(&msg.header, sizeof(message_header<T>));
+				if (wire::HasCompression(m_nNegotiated))
+					header = asio::buffer(m_aHeaderOut.data(),
+						wire::EncodeHeader<T>(wire::id_int_t<T>(msg.header.id), uint32_t(body.size()), m_bCompressedOut, m_aHeaderOut.data()));
+				else if (m_nNegotiated & wire::compact_header)
+					header = asio::buffer(m_aHeaderOut.data(), wire::EncodeHeader(msg.header, m_aHeaderOut.data()));
+
+				// The header goes out with its check. The trailer is written along with the body,
+				// or straight after the header if there isn't one
+				if (m_nNegotiated & wire::checksum)
+				{
+					const size_t nHeader = header.size();
+					if (header.data() != m_aHeaderOut.data())
+						std::memcpy(m_aHeaderOut.data(), header.data(), nHeader);
+					wire::StoreHeaderCheck(crc32c::Value(m_aHeaderOut.data(), nHeader), m_aHeaderOut.data() + nHeader);
+					header = asio::buffer(m_aHeaderOut.data(), nHeader + wire::HeaderCheckSize);
+
+					uint32_t nChecksum = crc32c::Value(header.data(), header.size());
+					nChecksum = crc32c::Extend(nChecksum, body.data(), body.size());
+					wire::StoreChecksum(nChecksum, m_aTrailerOut.data());
+				}
+
+				asio::async_write(m_socket, header, 
 					[this](std::error_code ec, std::size_t length)
 					{
 						if (!ec)
 						{
-							if (m_qMessagesOut.front().header.size > 0)
+							if (BodyOut().size() > 0 || (m_nNegotiated & wire::checksum))
 							{
 								WriteBody();
 							}
 							else
 							{
-								m_qMessagesOut.pop_front();
-
-								if (!m_qMessagesOut.empty())
-								{
-									WriteHeader();
-								}
+								OnMessageWritten();
 							}
 						}
 						else
 						{
-							std::cout << "[" << id << "] Write header fail.\n";
-							m_socket.close();
+							ASR_NET_LOG(info, "[", id, "] Write header fail.");
+							CloseSocket();
 						}
 					}
 					);
 			}
 
-			// ASYNC - Prime context to write a message body
+			// ASYNC - Prime context to write a message body, and its checksum trailer if negotiated
 			void WriteBody()
 			{
-				asio::async_write(m_socket, asio::buffer(m_qMessagesOut.front().body.data(), m_qMessagesOut.front().header.size),
+				std::array<asio::const_buffer, 2> buffers = {
+					BodyOut(),
+					asio::buffer(m_aTrailerOut.data(), (m_nNegotiated & wire::checksum) ? wire::ChecksumSize : 0)
+				};
+
+				asio::async_write(m_socket, buffers,
 					[this](std::error_code ec, std::size_t length)
 					{
 						if (!ec)
 						{
-							m_qMessagesOut.pop_front();
-
-							if (!m_qMessagesOut.empty())
-							{
-								WriteHeader();
-							}
+							OnMessageWritten();
 						}
 						else
 						{
-							std::cout << "[" << id << "] Writebody fail.\n";
-							m_socket.close();
+							ASR_NET_LOG(info, "[", id, "] Writebody fail.");
+							CloseSocket();
 						}
 					}
 				);
 			}
 
-			void AddToIncomingMessageQueue()
+			// The front message is on the wire, keep it for replay if there is a session and
+			// move on to the next
+			void OnMessageWritten()
 			{
-				if (m_nOwnerType == owner::server)
-					m_qMessagesIn.push_back({ this->shared_from_this(), m_msgTemporaryIn });
+				// Emptied if the connection was detached while the write was in flight
+				if (m_qMessagesOut.empty())
+					return;
+
+				ASR_NET_TRACE_EVENT(write_complete, id);
+				session::state<T>* pSession = ActiveSession();
+				if (pSession && !IsControlMessage(m_qMessagesOut.front()))
+					pSession->OnSent(std::move(m_qMessagesOut.front()));
+				m_qMessagesOut.pop_front();
+
+				if (!m_qMessagesOut.empty())
+				{
+					WriteHeader();
+				}
+			}
+
+			// The front message's body as it goes on the wire
+			asio::const_buffer BodyOut() const
+			{
+				if (m_bCompressedOut)
+					return asio::buffer(m_pCompressor->Output());
+				return asio::buffer(m_qMessagesOut.front().body.data(), m_qMessagesOut.front().header.size);
+			}
+
+			lz::encoder& Compressor()
+			{
+				if (!m_pCompressor)
+					m_pCompressor = std::make_unique<lz::encoder>();
+				return *m_pCompressor;
+			}
+
+			// Replaces the incoming body with its decompressed form. A body that won't decompress,
+			// or would be over the size limit, drops the connection
+			bool Inflate(const uint8_t* pIn, size_t nIn)
+			{
+				if (!m_pDecompressor)
+					m_pDecompressor = std::make_unique<lz::decoder>();
+
+				if (!m_pDecompressor->Decompress(pIn, nIn, m_ingress.limits().nMaxMessageSize))
+				{
+					ASR_NET_LOG(warn, "[", id, "] Malformed compressed body.");
+					CloseSocket();
+					return false;
+				}
+
+				m_msgTemporaryIn.body.assign(m_pDecompressor->Data(), m_pDecompressor->Data() + m_pDecompressor->Size());
+				m_msgTemporaryIn.header.size = uint32_t(m_pDecompressor->Size());
+				return true;
+			}
+
+			bool IsControlMessage(const message<T>& msg) const
+			{
+				return wire::HasControlMessages(m_nNegotiated) && msg.header.id == wire::ControlId<T>;
+			}
+
+			// The session, once resume has been negotiated
+			session::state<T>* ActiveSession() const
+			{
+				return (m_nNegotiated & wire::resume) ? m_pSession.get() : nullptr;
+			}
+
+			// Hands a complete message to the owner. Returns false if reading has to stop,
+			// either paused by the ingress budget or disconnected
+			bool AddToIncomingMessageQueue()
+			{
+				size_t nBytes = m_msgTemporaryIn.body.size();
+
+				// The library's own messages are dealt with here, everything else goes to the owner
+				if (IsControlMessage(m_msgTemporaryIn))
+				{
+					OnControlMessage();
+				}
 				else
-					m_qMessagesIn.push_back({ nullptr, m_msgTemporaryIn });
+				{
+					ASR_NET_TRACE_EVENT(read_complete, id);
+					if (m_nOwnerType == owner::server)
+						m_qMessagesIn.push_back({ this->shared_from_this(), std::move(m_msgTemporaryIn) });
+					else
+						m_qMessagesIn.push_back({ nullptr, std::move(m_msgTemporaryIn) });
+					ASR_NET_TRACE_EVENT(enqueue, id);
+
+					if (session::state<T>* pSession = ActiveSession())
+					{
+						pSession->OnReceived();
+						ScheduleAck();
+					}
+
+					OnTraffic();
+				}
+
+				// Carry on reading, unless the remote is over budget
+				auto tPause = m_ingress.charge(nBytes);
+				if (tPause == std::chrono::steady_clock::duration::zero())
+					return true;
 
-				// Register context to read another header
-				ReadHeader();
+				if (m_ingress.limits().nOnLimit == ingress_limits::action::disconnect)
+				{
+					ASR_NET_LOG(warn, "[", id, "] Ingress limit exceeded.");
+					CloseSocket();
+				}
+				else
+				{
+					// Stop reading for a while, the socket buffers fill and slow the remote down
+					m_timerIngress.expires_after(tPause);
+					m_timerIngress.async_wait(
+						[this](std::error_code ec)
+						{
+							if (!ec && m_socket.is_open())
+								ProcessReceived();
+						}
+					);
+				}
+				return false;
 			}
 
 			// "Encrypt" data
@@ -256,17 +1081,35 @@ namespace asr
 							// Validation data has been sent
 							// Client should wait for a response
 							if (m_nOwnerType == owner::client)
-								ReadHeader();
+							{
+								if (m_nNegotiated & wire::resume)
+								{
+									WriteSessionRequest();
+								}
+								else
+								{
+									// No session with this server, but messages carried over from an earlier attempt still go out
+									if (m_pSession)
+									{
+										std::deque<message<T>> deqUnsent;
+										m_pSession->Restart(0, 0, deqUnsent);
+										m_qMessagesOut.prepend(deqUnsent.begin(), deqUnsent.end());
+									}
+
+									OnValidated();
+									ReadData();
+								}
+							}
 						}
 						else
 						{
-							m_socket.close();
+							HandshakeFailed();
 						}
 					}
 				);
 			}
 
-			void ReadValidation(asr::net::server_interface<T>* server = nullptr)
+			void ReadValidation(asr::net::server_interface<T, Transport>* server = nullptr)
 			{
 				asio::async_read(m_socket, asio::buffer(&m_nHandshakeIn, sizeof(uint64_t)),
 					[this, server](std::error_code ec, std::size_t length)
@@ -275,25 +1118,46 @@ namespace asr
 						{
 							if (m_nOwnerType == owner::server)
 							{
-								if (m_nHandshakeIn == m_nHandshakeCheck)
+								// A negotiating client xors the capabilities it accepted into the
+								// scramble, a legacy client returns the scramble untouched
+								uint64_t nAccepted = m_nHandshakeIn ^ m_nHandshakeCheck;
+								if ((nAccepted & ~uint64_t(m_nCapabilities)) == 0)
 								{
 									// Client has provided valid scramble, allow it to connect
-									std::cout << "Client validated\n";
-									server->OnClientValidated(this->shared_from_this());
+									m_nNegotiated = uint8_t(nAccepted);
+									if (m_nNegotiated & wire::resume)
+									{
+										// The session is settled before any messages flow
+										ReadSessionRequest(server);
+									}
+									else
+									{
+										OnValidated();
+
+										ASR_NET_LOG(info, "Client validated");
+										if (server)
+											server->ClientReady(this->shared_from_this(), false);
 
-									// Prime asio to read headers
-									ReadHeader();
+										// Prime asio to read headers
+										ReadData();
+									}
 								}
 								else
 								{
-									std::cout << "Client disconnected (Failed validation)\n";
-									m_socket.close();
+									ASR_NET_LOG(warn, "Client disconnected (Failed validation)");
+									CloseSocket();
 								}
 							}
 							else
 							{
+								// Accept whichever of the server's capabilities we also support
+								if (wire::IsNegotiatingChallenge(m_nHandshakeIn))
+									m_nNegotiated = wire::OfferedCapabilities(m_nHandshakeIn) & m_nCapabilities;
+								else
+									m_nNegotiated = wire::none;
+
 								// Scramble the data received from server
-								m_nHandshakeOut = scramble(m_nHandshakeIn);
+								m_nHandshakeOut = scramble(m_nHandshakeIn) ^ m_nNegotiated;
 
 								// Write the result
 								WriteValidation();
@@ -302,28 +1166,235 @@ namespace asr
 						else
 						{
 							// Uh oh
-							std::cout << "Client disconnected (ReadValidation)\n";
-							m_socket.close();
+							ASR_NET_LOG(info, "Client disconnected (ReadValidation)");
+							HandshakeFailed();
+						}
+					}
+				);
+			}
+
+			// Client - asks to resume the session held before, or for a new one
+			void WriteSessionRequest()
+			{
+				if (!m_pSession)
+					m_pSession = std::make_shared<session::state<T>>();
+
+				m_sessionOut.nToken = m_pSession->Token();
+				m_sessionOut.nSecret = m_pSession->Secret();
+				m_sessionOut.nReceived = m_pSession->Received();
+
+				asio::async_write(m_socket, asio::buffer(&m_sessionOut, sizeof(session::handshake)),
+					[this](std::error_code ec, std::size_t length)
+					{
+						if (!ec)
+						{
+							ReadSessionReply();
+						}
+						else
+						{
+							HandshakeFailed();
+						}
+					}
+				);
+			}
+
+			// Client - the server answers with the session's token, the same one if it was
+			// resumed, and how much of it the server received
+			void ReadSessionReply()
+			{
+				asio::async_read(m_socket, asio::buffer(&m_sessionIn, sizeof(session::handshake)),
+					[this](std::error_code ec, std::size_t length)
+					{
+						if (!ec)
+						{
+							std::deque<message<T>> deqReplay;
+							bool bResumed = m_sessionOut.nToken != 0 && m_sessionIn.nToken == m_sessionOut.nToken
+								&& m_sessionIn.nSecret == m_sessionOut.nSecret;
+
+							if (bResumed && !m_pSession->CanResume(m_sessionIn.nReceived))
+							{
+								// Only a confused server gets here, start afresh next time
+								ASR_NET_LOG(warn, "Session could not be resumed");
+								m_pSession->Restart(0, 0, deqReplay);
+								HandshakeFailed();
+								return;
+							}
+
+							if (bResumed)
+								m_pSession->Resume(m_sessionIn.nReceived, deqReplay);
+							else
+								m_pSession->Restart(m_sessionIn.nToken, m_sessionIn.nSecret, deqReplay);
+
+							AttachSession(m_pSession, bResumed, deqReplay);
+							OnValidated();
+							ReadData();
+						}
+						else
+						{
+							ASR_NET_LOG(info, "Client disconnected (ReadSessionReply)");
+							HandshakeFailed();
 						}
 					}
 				);
 			}
 
+			// Server - the client asks for its old session back, or for a new one
+			void ReadSessionRequest(asr::net::server_interface<T, Transport>* server)
+			{
+				asio::async_read(m_socket, asio::buffer(&m_sessionIn, sizeof(session::handshake)),
+					[this, server](std::error_code ec, std::size_t length)
+					{
+						if (!ec)
+						{
+							bool bResumed = server->OnSessionRequest(this->shared_from_this(), m_sessionIn);
+							m_sessionOut.nToken = m_pSession->Token();
+							m_sessionOut.nSecret = m_pSession->Secret();
+							m_sessionOut.nReceived = m_pSession->Received();
+
+							asio::async_write(m_socket, asio::buffer(&m_sessionOut, sizeof(session::handshake)),
+								[this, server, bResumed](std::error_code ec, std::size_t length)
+								{
+									if (!ec)
+									{
+										OnValidated();
+
+										if (bResumed)
+											ASR_NET_LOG(info, "[", id, "] Session resumed");
+										else
+											ASR_NET_LOG(info, "Client validated");
+										server->ClientReady(this->shared_from_this(), bResumed);
+
+										ReadData();
+									}
+									else
+									{
+										CloseSocket();
+									}
+								}
+							);
+						}
+						else
+						{
+							ASR_NET_LOG(info, "Client disconnected (ReadSessionRequest)");
+							CloseSocket();
+						}
+					}
+				);
+			}
+
+			// Takes on a session, with whatever the remote is missing queued ahead of
+			// anything sent since
+			void AttachSession(std::shared_ptr<session::state<T>> pSession, bool bResumed, std::deque<message<T>>& deqReplay)
+			{
+				m_pSession = std::move(pSession);
+				m_nAckSent = m_pSession->Received();
+				m_nSessionToken.store(m_pSession->Token(), std::memory_order_release);
+				m_bResumed.store(bResumed, std::memory_order_release);
+
+				m_qMessagesOut.prepend(deqReplay.begin(), deqReplay.end());
+			}
+
+			void HandshakeFailed()
+			{
+				CloseSocket();
+
+				if (m_fnHandshakeFailed)
+					m_fnHandshakeFailed();
+			}
+
+			// The wire format is agreed, start sending anything queued in the meantime
+			void OnValidated()
+			{
+				m_bValidated = true;
+
+				// Only the application's messages can be queued yet
+				m_qMessagesOut.remove_if([this](const message<T>& msg) { return UsesReservedId(msg); });
+
+				if (!m_qMessagesOut.empty())
+					WriteHeader();
+
+				if (m_nNegotiated & wire::time_sync)
+					SendProbe();
+
+				if (m_fnValidated)
+					m_fnValidated();
+			}
+
 		protected:
 			// Each connection has a socket to a remote
-			asio::ip::tcp::socket m_socket;
+			socket_type m_socket;
 
 			// Reference to a context that's shared with the whole asio instance
 			asio::io_context& m_asioContext;
 			
-			// Queue of messages to be sent to the remote of the connection
-			tsqueue<message<T>> m_qMessagesOut;
+			// Messages sent from any thread, waiting for the asio thread to pick them up
+			mpsc_queue<message<T>> m_qSend;
+			std::atomic<bool> m_bSendPosted{ false };
+
+			// Queue of messages to be sent to the remote of the connection, only touched by the asio thread
+			lazy_deque<message<T>> m_qMessagesOut;
 
 			// Queue holds messages received from the remote
 			// Reference because the "owner" is expected to provide a queue
-			tsqueue<owned_message<T>>& m_qMessagesIn;
+			tsqueue<owned_message<T, Transport>>& m_qMessagesIn;
 			message<T> m_msgTemporaryIn;
 
+			// Received bytes not yet turned into messages live in [m_nRecvStart, m_nRecvEnd).
+			// Borrowed from recv_buffer_pool while data is arriving, empty while idle
+			std::vector<uint8_t> m_vRecv;
+			size_t m_nRecvStart = 0;
+			size_t m_nRecvEnd = 0;
+
+#ifdef ASR_NET_HAS_IO_URING
+			// The ring this connection receives through if any, the key of its multishot receive
+			// while armed, and whether ProcessReceived is waiting on the next bytes
+			std::shared_ptr<uring_receiver> m_pUring;
+			uint64_t m_nUringKey = 0;
+			bool m_bUringWanted = false;
+			bool m_bUringStopping = false;
+#endif
+
+			// Staging for compact headers, which can't be written in place, and for any header
+			// followed by its check
+			std::array<uint8_t, std::max(wire::MaxCompactHeaderSize, sizeof(message_header<T>)) + wire::HeaderCheckSize> m_aHeaderOut{};
+
+			// Checksum trailers, and the running checksum of a large message being read
+			std::array<uint8_t, wire::ChecksumSize> m_aTrailerIn{};
+			std::array<uint8_t, wire::ChecksumSize> m_aTrailerOut{};
+			uint32_t m_nChecksumIn = 0;
+
+			// Rate limits on incoming data, and the timer used to pause reading
+			ingress_budget m_ingress;
+			asio::steady_timer m_timerIngress;
+
+			// Round trip and clock offset estimates, and the timer that paces probes
+			timesync::clock_estimator m_clock;
+			asio::steady_timer m_timerProbe;
+			uint32_t m_nProbesSent = 0;
+			bool m_bTrafficSinceProbe = false;
+			bool m_bProbeParked = false;
+
+			// Session carried by this connection, and what has been acknowledged of it
+			std::shared_ptr<session::state<T>> m_pSession;
+			session::handshake m_sessionOut;
+			session::handshake m_sessionIn;
+			asio::steady_timer m_timerAck;
+			uint64_t m_nAckSent = 0;
+			bool m_bAckScheduled = false;
+			std::atomic<uint64_t> m_nSessionToken{ 0 };
+			std::atomic<bool> m_bResumed{ false };
+
+			// Server - told when a connection with a session fails
+			server_interface<T, Transport>* m_pServer = nullptr;
+
+			// The connection that resumed this one's session
+			std::weak_ptr<connection> m_pSuccessor;
+			std::atomic<bool> m_bSuperseded{ false };
+
+			// Messages taken from the incoming queue but not yet handled, only
+			// touched by the server's Update
+			lazy_deque<message<T>> m_deqPendingIn;
+
 			// The owner changes some behaviour of the connection
 			owner m_nOwnerType = owner::server;
 
@@ -334,6 +1405,23 @@ namespace asr
 			uint64_t m_nHandshakeOut = 0;
 			uint64_t m_nHandshakeIn = 0;
 			uint64_t m_nHandshakeCheck = 0;
+
+			// Capabilities offered/accepted by this side, and those agreed with the remote
+			uint8_t m_nCapabilities = wire::compact_header;
+			uint8_t m_nNegotiated = wire::none;
+
+			// Compression streams, made on first use, and whether the bodies being written and read are compressed
+			std::unique_ptr<lz::encoder> m_pCompressor;
+			std::unique_ptr<lz::decoder> m_pDecompressor;
+			size_t m_nCompressionThreshold = DefaultCompressionThreshold;
+			bool m_bCompressedOut = false;
+			bool m_bCompressedIn = false;
+
+			// Messages are only written once the handshake has completed
+			bool m_bValidated = false;
+			std::function<void()> m_fnValidated;
+			std::function<void()> m_fnHandshakeFailed;
+
 		};
 	}
 }
\ No newline at end of file
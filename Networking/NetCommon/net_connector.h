@@ -0,0 +1,249 @@
+#pragma once
+#include "net_common.h"
+#include "net_log.h"
+
+namespace asr
+{
+	namespace net
+	{
+		// How a client goes about reaching its servers
+		struct connect_options
+		{
+			// The whole attempt, across every server
+			std::chrono::milliseconds tTimeout{ 10000 };
+
+			// Each server gets this long to resolve, connect and finish the handshake
+			// before the next one is tried
+			std::chrono::milliseconds tServerTimeout{ 3000 };
+
+			// Head start each address gets before the next is raced against it, 250 ms
+			// is what RFC 8305 suggests
+			std::chrono::milliseconds tAttemptDelay{ 250 };
+
+			// Start from a random server rather than the first, spreading clients across them
+			bool bSpreadLoad = false;
+		};
+
+		struct server_address
+		{
+			std::string sHost;
+			uint16_t nPort = 0;
+		};
+
+		enum class connect_status : uint8_t
+		{
+			idle,
+			connecting,
+			connected,
+			failed
+		};
+
+		// Protocols that can look up host names
+		template <typename Protocol, typename = void>
+		struct has_resolver : std::false_type {};
+
+		template <typename Protocol>
+		struct has_resolver<Protocol, std::void_t<typename Protocol::resolver>> : std::true_type {};
+
+		// One server, either a host name to resolve or endpoints known up front
+		template <typename Transport>
+		struct connect_target
+		{
+			std::string sHost;
+			uint16_t nPort = 0;
+			std::vector<typename Transport::protocol::endpoint> vEndpoints;
+		};
+
+		// Resolves a server and races connections to its addresses, Happy Eyeballs style.
+		// The first address gets a head start, then each further one is tried alongside
+		// those still going, sooner if one fails. The first to connect wins and the rest
+		// are closed. Runs on the asio thread, and reports exactly once
+		template <typename Transport>
+		class connect_race : public std::enable_shared_from_this<connect_race<Transport>>
+		{
+		public:
+			using protocol = typename Transport::protocol;
+			using socket_type = typename protocol::socket;
+			using endpoint_type = typename protocol::endpoint;
+			using handler = std::function<void(std::error_code, socket_type)>;
+
+			connect_race(asio::io_context& context, const connect_target<Transport>& target, std::chrono::milliseconds tAttemptDelay,
+				std::chrono::steady_clock::time_point tDeadline, handler fnDone)
+				: m_context(context), m_target(target), m_tAttemptDelay(tAttemptDelay), m_tDeadline(tDeadline),
+				m_timerNext(context), m_timerDeadline(context), m_fnDone(std::move(fnDone))
+			{
+
+			}
+
+		public:
+			void Start()
+			{
+				auto self = this->shared_from_this();
+				m_timerDeadline.expires_at(m_tDeadline);
+				m_timerDeadline.async_wait(
+					[self](std::error_code ec)
+					{
+						if (!ec)
+							self->Finish(std::make_error_code(std::errc::timed_out));
+					}
+				);
+
+				if (!m_target.vEndpoints.empty())
+					Race(m_target.vEndpoints);
+				else
+					Resolve();
+			}
+
+			// Stops every attempt, the handler is told the operation was aborted
+			void Cancel()
+			{
+				Finish(std::make_error_code(std::errc::operation_canceled));
+			}
+
+		private:
+			void Resolve()
+			{
+				if constexpr (has_resolver<protocol>::value)
+				{
+					auto self = this->shared_from_this();
+					auto pResolver = std::make_shared<typename protocol::resolver>(m_context);
+					m_fnCancelResolve = [pResolver]() { pResolver->cancel(); };
+
+					pResolver->async_resolve(m_target.sHost, std::to_string(m_target.nPort),
+						[self, pResolver](std::error_code ec, typename protocol::resolver::results_type results)
+						{
+							if (self->m_bDone)
+								return;
+
+							if (ec)
+							{
+								self->Finish(ec);
+								return;
+							}
+
+							std::vector<endpoint_type> vEndpoints;
+							for (auto& entry : results)
+								vEndpoints.push_back(entry.endpoint());
+							self->Race(vEndpoints);
+						}
+					);
+				}
+				else
+				{
+					Finish(std::make_error_code(std::errc::host_unreachable));
+				}
+			}
+
+			// Alternates address families, so a broken IPv6 path costs one head start rather than all of them
+			void Race(const std::vector<endpoint_type>& vEndpoints)
+			{
+				std::vector<endpoint_type> vFirst, vOther;
+				for (auto& endpoint : vEndpoints)
+					(endpoint.protocol().family() == vEndpoints.front().protocol().family() ? vFirst : vOther).push_back(endpoint);
+
+				for (size_t i = 0; i < std::max(vFirst.size(), vOther.size()); i++)
+				{
+					if (i < vFirst.size())
+						m_vEndpoints.push_back(vFirst[i]);
+					if (i < vOther.size())
+						m_vEndpoints.push_back(vOther[i]);
+				}
+
+				if (m_vEndpoints.empty())
+					Finish(std::make_error_code(std::errc::host_unreachable));
+				else
+					StartNext();
+			}
+
+			void StartNext()
+			{
+				if (m_bDone || m_nNext >= m_vEndpoints.size())
+					return;
+
+				auto self = this->shared_from_this();
+				size_t i = m_nNext++;
+				m_vSockets.push_back(std::make_unique<socket_type>(m_context));
+				socket_type* pSocket = m_vSockets.back().get();
+				m_nPending++;
+
+				pSocket->async_connect(m_vEndpoints[i],
+					[self, pSocket](std::error_code ec)
+					{
+						self->m_nPending--;
+						if (self->m_bDone)
+							return;
+
+						if (!ec)
+						{
+							self->Finish(ec, pSocket);
+							return;
+						}
+
+						// A failure starts the next attempt straight away
+						if (self->m_nNext < self->m_vEndpoints.size())
+							self->StartNext();
+						else if (self->m_nPending == 0)
+							self->Finish(ec);
+					}
+				);
+
+				// Give this one a head start, then race the next against it
+				if (m_nNext < m_vEndpoints.size())
+				{
+					m_timerNext.expires_after(m_tAttemptDelay);
+					m_timerNext.async_wait(
+						[self](std::error_code ec)
+						{
+							if (!ec)
+								self->StartNext();
+						}
+					);
+				}
+			}
+
+			void Finish(std::error_code ec, socket_type* pWinner = nullptr)
+			{
+				if (m_bDone)
+					return;
+				m_bDone = true;
+
+				asio::error_code ecIgnored;
+				m_timerNext.cancel(ecIgnored);
+				m_timerDeadline.cancel(ecIgnored);
+				if (m_fnCancelResolve)
+					m_fnCancelResolve();
+
+				socket_type socket(m_context);
+				for (auto& pSocket : m_vSockets)
+				{
+					if (pSocket.get() == pWinner)
+						socket = std::move(*pSocket);
+					else
+						pSocket->close(ecIgnored);
+				}
+
+				handler fnDone = std::move(m_fnDone);
+				fnDone(ec, std::move(socket));
+			}
+
+		private:
+			asio::io_context& m_context;
+			connect_target<Transport> m_target;
+			std::chrono::milliseconds m_tAttemptDelay;
+			std::chrono::steady_clock::time_point m_tDeadline;
+
+			asio::steady_timer m_timerNext;
+			asio::steady_timer m_timerDeadline;
+			std::function<void()> m_fnCancelResolve;
+
+			// Addresses in the order they are tried, and a socket for each attempt started
+			std::vector<endpoint_type> m_vEndpoints;
+			std::vector<std::unique_ptr<socket_type>> m_vSockets;
+			size_t m_nNext = 0;
+			size_t m_nPending = 0;
+			bool m_bDone = false;
+
+			handler m_fnDone;
+		};
+	}
+}
\ No newline at end of file
@@ -0,0 +1,233 @@
+#pragma once
+#include "net_common.h"
+
+// Pick a hardware implementation where the target has CRC32C instructions
+#if defined(_M_X64) || defined(__x86_64__)
+	#define ASR_NET_CRC32C_SSE42
+	#include <nmmintrin.h>
+	#ifdef _MSC_VER
+		#include <intrin.h>
+		#define ASR_NET_CRC32C_TARGET
+	#else
+		#include <cpuid.h>
+		#define ASR_NET_CRC32C_TARGET __attribute__((target("sse4.2")))
+	#endif
+#elif defined(__ARM_FEATURE_CRC32)
+	#define ASR_NET_CRC32C_ARMV8
+	#include <arm_acle.h>
+#endif
+
+namespace asr
+{
+	namespace net
+	{
+		namespace crc32c
+		{
+			namespace detail
+			{
+				// Reflected Castagnoli polynomial
+				constexpr uint32_t Polynomial = 0x82F63B78;
+
+				// Lookup tables for the slicing-by-8 fallback
+				struct tables
+				{
+					uint32_t t[8][256]{};
+
+					constexpr tables()
+					{
+						for (uint32_t i = 0; i < 256; i++)
+						{
+							uint32_t crc = i;
+							for (int j = 0; j < 8; j++)
+								crc = (crc >> 1) ^ (Polynomial & (0u - (crc & 1)));
+							t[0][i] = crc;
+						}
+
+						for (uint32_t i = 0; i < 256; i++)
+							for (int k = 1; k < 8; k++)
+								t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFF];
+					}
+				};
+
+				inline constexpr tables Tables{};
+
+				inline uint32_t Load32(const uint8_t* p)
+				{
+					return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+				}
+
+				// Works on the inverted crc, eight bytes per step
+				inline uint32_t ExtendSoftware(uint32_t crc, const uint8_t* p, size_t n)
+				{
+					const auto& t = Tables.t;
+
+					while (n >= 8)
+					{
+						uint32_t lo = Load32(p) ^ crc;
+						uint32_t hi = Load32(p + 4);
+						crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+							t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+						p += 8;
+						n -= 8;
+					}
+
+					while (n--)
+						crc = t[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+
+					return crc;
+				}
+
+				// Bytes per lane when the hardware path runs three independent crcs. The
+				// instruction has a latency of three cycles but issues every cycle, so
+				// interleaving three streams keeps the unit busy
+				constexpr size_t LaneSize = 1024;
+
+				// Advances a raw crc over LaneSize zero bytes, used to stitch the lanes back together
+				struct shift_table
+				{
+					uint32_t t[4][256];
+
+					shift_table()
+					{
+						// The advance is linear, so the effect of each bit is enough to build the tables
+						uint8_t zeros[LaneSize] = {};
+						uint32_t bits[32];
+						for (int i = 0; i < 32; i++)
+							bits[i] = ExtendSoftware(1u << i, zeros, LaneSize);
+
+						for (int k = 0; k < 4; k++)
+						{
+							for (uint32_t v = 0; v < 256; v++)
+							{
+								uint32_t r = 0;
+								for (int i = 0; i < 8; i++)
+									if (v & (1u << i))
+										r ^= bits[k * 8 + i];
+								t[k][v] = r;
+							}
+						}
+					}
+
+					uint32_t operator()(uint32_t crc) const
+					{
+						return t[0][crc & 0xFF] ^ t[1][(crc >> 8) & 0xFF] ^ t[2][(crc >> 16) & 0xFF] ^ t[3][crc >> 24];
+					}
+				};
+
+				inline const shift_table& LaneShift()
+				{
+					static const shift_table table;
+					return table;
+				}
+
+				inline uint64_t Load64(const uint8_t* p)
+				{
+					uint64_t v;
+					std::memcpy(&v, p, sizeof(v));
+					return v;
+				}
+
+#if defined(ASR_NET_CRC32C_SSE42)
+				inline bool HasHardware()
+				{
+#ifdef _MSC_VER
+					int info[4];
+					__cpuid(info, 1);
+					return (info[2] & (1 << 20)) != 0;
+#else
+					unsigned int a, b, c, d;
+					return __get_cpuid(1, &a, &b, &c, &d) && (c & bit_SSE4_2);
+#endif
+				}
+
+				ASR_NET_CRC32C_TARGET inline uint32_t ExtendHardware(uint32_t crc, const uint8_t* p, size_t n)
+				{
+					const shift_table& shift = LaneShift();
+
+					uint64_t crc64 = crc;
+					while (n >= 3 * LaneSize)
+					{
+						uint64_t c0 = crc64, c1 = 0, c2 = 0;
+						for (size_t i = 0; i < LaneSize; i += 8)
+						{
+							c0 = _mm_crc32_u64(c0, Load64(p + i));
+							c1 = _mm_crc32_u64(c1, Load64(p + LaneSize + i));
+							c2 = _mm_crc32_u64(c2, Load64(p + 2 * LaneSize + i));
+						}
+						crc64 = shift(shift(uint32_t(c0)) ^ uint32_t(c1)) ^ uint32_t(c2);
+						p += 3 * LaneSize;
+						n -= 3 * LaneSize;
+					}
+
+					while (n >= 8)
+					{
+						crc64 = _mm_crc32_u64(crc64, Load64(p));
+						p += 8;
+						n -= 8;
+					}
+
+					crc = uint32_t(crc64);
+					while (n--)
+						crc = _mm_crc32_u8(crc, *p++);
+
+					return crc;
+				}
+#elif defined(ASR_NET_CRC32C_ARMV8)
+				inline bool HasHardware()
+				{
+					return true;
+				}
+
+				inline uint32_t ExtendHardware(uint32_t crc, const uint8_t* p, size_t n)
+				{
+					const shift_table& shift = LaneShift();
+
+					while (n >= 3 * LaneSize)
+					{
+						uint32_t c0 = crc, c1 = 0, c2 = 0;
+						for (size_t i = 0; i < LaneSize; i += 8)
+						{
+							c0 = __crc32cd(c0, Load64(p + i));
+							c1 = __crc32cd(c1, Load64(p + LaneSize + i));
+							c2 = __crc32cd(c2, Load64(p + 2 * LaneSize + i));
+						}
+						crc = shift(shift(c0) ^ c1) ^ c2;
+						p += 3 * LaneSize;
+						n -= 3 * LaneSize;
+					}
+
+					while (n >= 8)
+					{
+						crc = __crc32cd(crc, Load64(p));
+						p += 8;
+						n -= 8;
+					}
+
+					while (n--)
+						crc = __crc32cb(crc, *p++);
+
+					return crc;
+				}
+#endif
+			}
+
+			// Continues a crc over more data, start with 0
+			inline uint32_t Extend(uint32_t crc, const void* pData, size_t nLength)
+			{
+				const uint8_t* p = static_cast<const uint8_t*>(pData);
+#if defined(ASR_NET_CRC32C_SSE42) || defined(ASR_NET_CRC32C_ARMV8)
+				static const bool bHardware = detail::HasHardware();
+				if (bHardware)
+					return ~detail::ExtendHardware(~crc, p, nLength);
+#endif
+				return ~detail::ExtendSoftware(~crc, p, nLength);
+			}
+
+			// Crc of a single block of data
+			inline uint32_t Value(const void* pData, size_t nLength)
+			{
+				return Extend(0, pData, nLength);
+			}
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,184 @@
+#pragma once
+#include "net_common.h"
+
+namespace asr
+{
+	namespace net
+	{
+		// Uniform grid of positioned entries, used to find who is near a point without
+		// looking at everyone. Entries are keyed by id and only change cell when they
+		// cross a cell boundary, so per tick position updates are cheap
+		template <typename V>
+		class interest_grid
+		{
+		public:
+			interest_grid(float fCellSize = 64.0f)
+			{
+				SetCellSize(fCellSize);
+			}
+
+		public:
+			// Changes the cell size, entries are re-bucketed
+			void SetCellSize(float fCellSize)
+			{
+				m_fCellSize = std::max(fCellSize, 1e-3f);
+				m_fInvCellSize = 1.0f / m_fCellSize;
+
+				m_mapCells.clear();
+				for (auto& [nID, e] : m_mapEntries)
+				{
+					e.nCell = CellOf(e.x, e.y);
+					Insert(nID, e);
+				}
+			}
+
+			// Inserts or moves an entry
+			void Update(uint32_t nID, const V& value, float x, float y)
+			{
+				uint64_t nCell = CellOf(x, y);
+
+				auto it = m_mapEntries.find(nID);
+				if (it == m_mapEntries.end())
+				{
+					entry& e = m_mapEntries[nID];
+					e.value = value;
+					e.x = x;
+					e.y = y;
+					e.nCell = nCell;
+					Insert(nID, e);
+					return;
+				}
+
+				entry& e = it->second;
+				e.x = x;
+				e.y = y;
+
+				// Most updates stay in the same cell and touch nothing else
+				if (e.nCell != nCell)
+				{
+					Erase(e);
+					e.nCell = nCell;
+					Insert(nID, e);
+				}
+			}
+
+			// Removes an entry if present
+			void Remove(uint32_t nID)
+			{
+				auto it = m_mapEntries.find(nID);
+				if (it == m_mapEntries.end())
+					return;
+
+				Erase(it->second);
+				m_mapEntries.erase(it);
+			}
+
+			// Calls f(id, value) for every entry within fRadius of (x, y)
+			template <typename F>
+			void Query(float x, float y, float fRadius, F&& f) const
+			{
+				int32_t nMinX = Coord(x - fRadius), nMaxX = Coord(x + fRadius);
+				int32_t nMinY = Coord(y - fRadius), nMaxY = Coord(y + fRadius);
+				float fRadiusSq = fRadius * fRadius;
+
+				// A radius covering more cells than are occupied is quicker to answer by brute force
+				if ((int64_t(nMaxX) - nMinX + 1) * (int64_t(nMaxY) - nMinY + 1) > int64_t(m_mapCells.size()))
+				{
+					for (auto& [nID, e] : m_mapEntries)
+					{
+						float dx = e.x - x, dy = e.y - y;
+						if (dx * dx + dy * dy <= fRadiusSq)
+							f(nID, e.value);
+					}
+					return;
+				}
+
+				for (int32_t cy = nMinY; cy <= nMaxY; cy++)
+				{
+					for (int32_t cx = nMinX; cx <= nMaxX; cx++)
+					{
+						auto itCell = m_mapCells.find(Key(cx, cy));
+						if (itCell == m_mapCells.end())
+							continue;
+
+						for (uint32_t nID : itCell->second)
+						{
+							const entry& e = m_mapEntries.find(nID)->second;
+							float dx = e.x - x, dy = e.y - y;
+							if (dx * dx + dy * dy <= fRadiusSq)
+								f(nID, e.value);
+						}
+					}
+				}
+			}
+
+			size_t size() const
+			{
+				return m_mapEntries.size();
+			}
+
+		private:
+			struct entry
+			{
+				V value{};
+				float x = 0.0f;
+				float y = 0.0f;
+				uint64_t nCell = 0;
+				// Position within the cell's list, for constant time removal
+				size_t nSlot = 0;
+			};
+
+			// Cell coordinate of v. Far away, infinite and NaN positions are clamped first, as
+			// converting them is undefined, and kept clear of INT32_MAX so Query's loops end
+			int32_t Coord(float v) const
+			{
+				constexpr float fLimit = float(1 << 30);
+				float f = std::floor(v * m_fInvCellSize);
+				if (!(f > -fLimit))
+					f = -fLimit;
+				else if (f > fLimit)
+					f = fLimit;
+				return int32_t(f);
+			}
+
+			static uint64_t Key(int32_t cx, int32_t cy)
+			{
+				return uint64_t(uint32_t(cx)) << 32 | uint32_t(cy);
+			}
+
+			uint64_t CellOf(float x, float y) const
+			{
+				return Key(Coord(x), Coord(y));
+			}
+
+			void Insert(uint32_t nID, entry& e)
+			{
+				std::vector<uint32_t>& vCell = m_mapCells[e.nCell];
+				e.nSlot = vCell.size();
+				vCell.push_back(nID);
+			}
+
+			// Swap-removes the entry from its cell, fixing up the entry that moved into its slot
+			void Erase(entry& e)
+			{
+				auto itCell = m_mapCells.find(e.nCell);
+				std::vector<uint32_t>& vCell = itCell->second;
+
+				uint32_t nMoved = vCell.back();
+				vCell[e.nSlot] = nMoved;
+				m_mapEntries[nMoved].nSlot = e.nSlot;
+				vCell.pop_back();
+
+				if (vCell.empty())
+					m_mapCells.erase(itCell);
+			}
+
+		private:
+			float m_fCellSize = 64.0f;
+			float m_fInvCellSize = 1.0f / 64.0f;
+
+			std::unordered_map<uint32_t, entry> m_mapEntries;
+			std::unordered_map<uint64_t, std::vector<uint32_t>> m_mapCells;
+		};
+	}
+}
\ No newline at end of file
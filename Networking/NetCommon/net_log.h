@@ -0,0 +1,369 @@
+#pragma once
+#include "net_common.h"
+
+// Messages below this level are compiled out entirely.
+// 0 trace, 1 debug, 2 info, 3 warn, 4 error, 5 nothing
+#ifndef ASR_NET_LOG_LEVEL
+#define ASR_NET_LOG_LEVEL 2
+#endif
+
+// Logs the arguments streamed together as one line, e.g. ASR_NET_LOG(warn, "[", id, "] Read fail.")
+#define ASR_NET_LOG(lvl, ...) \
+	do { \
+		if constexpr (int(::asr::net::log::level::lvl) >= ASR_NET_LOG_LEVEL) \
+		{ \
+			static ::asr::net::log::site_limiter limiter_; \
+			::asr::net::log::Write(::asr::net::log::level::lvl, limiter_, __VA_ARGS__); \
+		} \
+	} while (0)
+
+namespace asr
+{
+	namespace net
+	{
+		namespace log
+		{
+			enum class level : uint8_t
+			{
+				trace,
+				debug,
+				info,
+				warn,
+				error,
+				off
+			};
+
+			// Each call site may log this many lines a second, the rest are counted and
+			// reported with the next line that gets through
+			constexpr uint32_t SiteLinesPerSecond = 20;
+
+			// Lines longer than this are cut short
+			constexpr size_t MaxLineLength = 240;
+
+			struct record
+			{
+				std::chrono::steady_clock::time_point tWhen;
+				level nLevel = level::info;
+				uint16_t nLength = 0;
+				char sText[MaxLineLength];
+			};
+
+			// Lines from a single thread on their way to the writer. Only the owning thread
+			// pushes and only the writer pops, so neither side locks
+			class ring
+			{
+			public:
+				static constexpr size_t Capacity = 512;
+
+				ring()
+					: m_vRecords(Capacity)
+				{
+
+				}
+
+			public:
+				// Returns the slot to fill, or nullptr if the writer has fallen behind
+				record* reserve()
+				{
+					uint64_t nHead = m_nHead.load(std::memory_order_relaxed);
+					if (nHead - m_nTail.load(std::memory_order_acquire) >= Capacity)
+						return nullptr;
+					return &m_vRecords[nHead & (Capacity - 1)];
+				}
+
+				void publish()
+				{
+					m_nHead.store(m_nHead.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+				}
+
+				// Writer only, calls f(record) for everything published
+				template <typename F>
+				void drain(F&& f)
+				{
+					uint64_t nTail = m_nTail.load(std::memory_order_relaxed);
+					uint64_t nHead = m_nHead.load(std::memory_order_acquire);
+					for (; nTail < nHead; nTail++)
+						f(m_vRecords[nTail & (Capacity - 1)]);
+					m_nTail.store(nTail, std::memory_order_release);
+				}
+
+				// Rings outlive their threads and are handed on to new ones
+				bool claim()
+				{
+					bool bOwned = false;
+					return m_bOwned.compare_exchange_strong(bOwned, true, std::memory_order_acq_rel);
+				}
+
+				void release()
+				{
+					m_bOwned.store(false, std::memory_order_release);
+				}
+
+			private:
+				std::vector<record> m_vRecords;
+				std::atomic<bool> m_bOwned{ true };
+				alignas(64) std::atomic<uint64_t> m_nHead{ 0 };
+				alignas(64) std::atomic<uint64_t> m_nTail{ 0 };
+			};
+
+			// Owns every thread's ring and the background thread that writes them out
+			class logger
+			{
+			public:
+				static logger& get()
+				{
+					static logger instance;
+					return instance;
+				}
+
+				~logger()
+				{
+					{
+						std::scoped_lock lock(m_mux);
+						m_bQuit = true;
+					}
+					m_cvWake.notify_one();
+					if (m_thrWriter.joinable())
+						m_thrWriter.join();
+
+					// Lines logged while the writer made its last pass would otherwise be lost
+					std::scoped_lock lock(m_mux);
+					WriteOut();
+				}
+
+			public:
+				ring& add()
+				{
+					std::scoped_lock lock(m_mux);
+					for (auto& pRing : m_vRings)
+						if (pRing->claim())
+							return *pRing;
+
+					m_vRings.push_back(std::make_unique<ring>());
+					if (!m_thrWriter.joinable())
+						m_thrWriter = std::thread([this]() { Run(); });
+					return *m_vRings.back();
+				}
+
+				void dropped()
+				{
+					m_nDropped.fetch_add(1, std::memory_order_relaxed);
+				}
+
+				// Where lines go, std::cout unless changed
+				void SetStream(std::ostream& os)
+				{
+					std::scoped_lock lock(m_mux);
+					m_pStream = &os;
+				}
+
+				// Lines below this level are skipped at run time, on top of ASR_NET_LOG_LEVEL
+				void SetLevel(level nLevel)
+				{
+					m_nLevel.store(nLevel, std::memory_order_relaxed);
+				}
+
+				bool Enabled(level nLevel) const
+				{
+					return nLevel >= m_nLevel.load(std::memory_order_relaxed);
+				}
+
+				// Blocks until everything logged so far has been written
+				void Flush()
+				{
+					std::unique_lock lock(m_mux);
+					uint64_t nTarget = ++m_nFlushRequested;
+					m_cvWake.notify_one();
+					m_cvFlushed.wait(lock, [&]() { return m_nFlushed >= nTarget || !m_thrWriter.joinable(); });
+				}
+
+			private:
+				logger() = default;
+
+				void Run()
+				{
+					std::unique_lock lock(m_mux);
+					while (true)
+					{
+						uint64_t nFlushRequested = m_nFlushRequested;
+						WriteOut();
+
+						m_nFlushed = nFlushRequested;
+						m_cvFlushed.notify_all();
+
+						if (m_bQuit)
+							break;
+
+						// Polling keeps logging threads from ever having to wake the writer
+						m_cvWake.wait_for(lock, std::chrono::milliseconds(10));
+					}
+				}
+
+				// Writes out everything in the rings, m_mux must be held. Console output is slow, so it
+				// happens here rather than on the thread that logged. Lines from different threads are
+				// put back in the order they were logged
+				void WriteOut()
+				{
+					m_vPending.clear();
+					for (auto& pRing : m_vRings)
+						pRing->drain([&](const record& r) { m_vPending.push_back(r); });
+
+					std::stable_sort(m_vPending.begin(), m_vPending.end(),
+						[](const record& a, const record& b) { return a.tWhen < b.tWhen; });
+
+					for (const record& r : m_vPending)
+					{
+						m_pStream->write(r.sText, r.nLength);
+						m_pStream->put('\n');
+					}
+
+					uint64_t nDropped = m_nDropped.exchange(0, std::memory_order_relaxed);
+					if (nDropped > 0)
+						*m_pStream << "[LOG] " << nDropped << " lines dropped, the writer fell behind\n";
+					m_pStream->flush();
+				}
+
+			private:
+				std::mutex m_mux;
+				std::condition_variable m_cvWake;
+				std::condition_variable m_cvFlushed;
+				std::vector<std::unique_ptr<ring>> m_vRings;
+				std::vector<record> m_vPending;
+				std::thread m_thrWriter;
+				std::ostream* m_pStream = &std::cout;
+				std::atomic<level> m_nLevel{ level::trace };
+				std::atomic<uint64_t> m_nDropped{ 0 };
+				uint64_t m_nFlushRequested = 0;
+				uint64_t m_nFlushed = 0;
+				bool m_bQuit = false;
+			};
+
+			// Per call site limit, so a flood of the same failure can't swamp the log
+			class site_limiter
+			{
+			public:
+				// Returns false if the line should be skipped, otherwise how many were
+				// skipped since the last one is left in nSuppressed
+				bool allow(uint32_t& nSuppressed)
+				{
+					int64_t nSecond = std::chrono::duration_cast<std::chrono::seconds>(
+						std::chrono::steady_clock::now().time_since_epoch()).count();
+
+					int64_t nWindow = m_nWindow.load(std::memory_order_relaxed);
+					if (nWindow != nSecond && m_nWindow.compare_exchange_strong(nWindow, nSecond, std::memory_order_relaxed))
+						m_nCount.store(0, std::memory_order_relaxed);
+
+					if (m_nCount.fetch_add(1, std::memory_order_relaxed) >= SiteLinesPerSecond)
+					{
+						m_nSuppressed.fetch_add(1, std::memory_order_relaxed);
+						return false;
+					}
+
+					nSuppressed = m_nSuppressed.exchange(0, std::memory_order_relaxed);
+					return true;
+				}
+
+			private:
+				std::atomic<int64_t> m_nWindow{ 0 };
+				std::atomic<uint32_t> m_nCount{ 0 };
+				std::atomic<uint32_t> m_nSuppressed{ 0 };
+			};
+
+			// Formatting into a record, common types skip the stream machinery
+			struct line
+			{
+				record& r;
+
+				void append(const char* s, size_t n)
+				{
+					n = std::min(n, MaxLineLength - r.nLength);
+					std::memcpy(r.sText + r.nLength, s, n);
+					r.nLength += uint16_t(n);
+				}
+
+				line& operator << (const char* s) { append(s, std::strlen(s)); return *this; }
+				template <size_t N>
+				line& operator << (const char (&s)[N]) { append(s, std::strlen(s)); return *this; }
+				line& operator << (const std::string& s) { append(s.data(), s.size()); return *this; }
+				line& operator << (char c) { append(&c, 1); return *this; }
+
+				template <typename V>
+				line& operator << (const V& v)
+				{
+					char sBuffer[64];
+					if constexpr (std::is_integral_v<V> && std::is_signed_v<V>)
+						append(sBuffer, size_t(std::snprintf(sBuffer, sizeof(sBuffer), "%lld", (long long)v)));
+					else if constexpr (std::is_integral_v<V>)
+						append(sBuffer, size_t(std::snprintf(sBuffer, sizeof(sBuffer), "%llu", (unsigned long long)v)));
+					else if constexpr (std::is_floating_point_v<V>)
+						append(sBuffer, size_t(std::snprintf(sBuffer, sizeof(sBuffer), "%g", double(v))));
+					else
+					{
+						// Anything else with an ostream operator, endpoints for instance
+						thread_local std::ostringstream ss;
+						ss.str("");
+						ss << v;
+						*this << ss.str();
+					}
+					return *this;
+				}
+			};
+
+			// The calling thread's ring, taken the first time it logs and given back when it exits
+			inline ring& ThreadRing()
+			{
+				struct holder
+				{
+					ring* pRing;
+					~holder() { pRing->release(); }
+				};
+
+				thread_local holder h{ &logger::get().add() };
+				return *h.pRing;
+			}
+
+			template <typename... Args>
+			void Write(level nLevel, site_limiter& limiter, const Args&... args)
+			{
+				if (!logger::get().Enabled(nLevel))
+					return;
+
+				uint32_t nSuppressed = 0;
+				if (!limiter.allow(nSuppressed))
+					return;
+
+				ring& rng = ThreadRing();
+				record* pRecord = rng.reserve();
+				if (!pRecord)
+				{
+					logger::get().dropped();
+					return;
+				}
+
+				pRecord->tWhen = std::chrono::steady_clock::now();
+				pRecord->nLevel = nLevel;
+				pRecord->nLength = 0;
+				line l{ *pRecord };
+				(l << ... << args);
+				if (nSuppressed > 0)
+					l << " (" << nSuppressed << " similar lines suppressed)";
+				rng.publish();
+			}
+
+			inline void SetStream(std::ostream& os)
+			{
+				logger::get().SetStream(os);
+			}
+
+			inline void SetLevel(level nLevel)
+			{
+				logger::get().SetLevel(nLevel);
+			}
+
+			inline void Flush()
+			{
+				logger::get().Flush();
+			}
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,275 @@
+#pragma once
+#include "net_common.h"
+#include "net_wire.h"
+
+namespace asr
+{
+	namespace net
+	{
+		// Small LZ77 codec in the style of LZ4, for message bodies. Each direction of a
+		// connection keeps one end of a stream, so matches can reach back into earlier
+		// bodies and small repetitive messages compress too, not only large ones. NetBench
+		// compression measures the ratios and speeds.
+		//
+		// A compressed body is [varint original size] then sequences of
+		// [token][literal length...][literals][offset, 2 bytes][match length...], the high
+		// nibble of the token a literal length and the low one a match length less MinMatch,
+		// either extended by bytes of 255 while it reads 15. The last sequence has literals only
+		namespace lz
+		{
+			// How far back a match may reach, both ends keep at least this much of the stream
+			constexpr size_t WindowSize = 32 * 1024;
+
+			constexpr size_t MinMatch = 4;
+
+			// Entries in the encoder's table of where 4 byte sequences were last seen
+			constexpr size_t HashBits = 12;
+
+			inline uint32_t Read32(const uint8_t* p)
+			{
+				uint32_t v;
+				std::memcpy(&v, p, sizeof(v));
+				return v;
+			}
+
+			inline uint32_t Hash(uint32_t v)
+			{
+				return (v * 2654435761u) >> (32 - HashBits);
+			}
+
+			// Keeps the last WindowSize bytes once the stream has run well past them
+			inline size_t Trim(std::vector<uint8_t>& vStream)
+			{
+				if (vStream.size() <= 2 * WindowSize)
+					return 0;
+
+				size_t nDrop = vStream.size() - WindowSize;
+				vStream.erase(vStream.begin(), vStream.begin() + nDrop);
+
+				// A very large body leaves a very large buffer behind
+				if (vStream.capacity() > 4 * WindowSize)
+					vStream.shrink_to_fit();
+				return nDrop;
+			}
+
+			inline uint8_t* WriteLength(uint8_t* pOut, size_t nLength)
+			{
+				for (; nLength >= 255; nLength -= 255)
+					*pOut++ = 255;
+				*pOut++ = uint8_t(nLength);
+				return pOut;
+			}
+
+			// Returns false if the length runs off the end of the input
+			inline bool ReadLength(const uint8_t*& pIn, const uint8_t* pEnd, size_t& nLength)
+			{
+				uint8_t n;
+				do
+				{
+					if (pIn == pEnd)
+						return false;
+					n = *pIn++;
+					nLength += n;
+				} while (n == 255);
+				return true;
+			}
+
+			class encoder
+			{
+			public:
+				// Compresses a body, true if the result is smaller and waiting in Output().
+				// Only bodies that compress become part of the stream
+				bool Compress(const uint8_t* pSrc, size_t nSrc)
+				{
+					if (m_vTable.empty())
+						m_vTable.resize(size_t(1) << HashBits);
+
+					const size_t nStart = m_vStream.size();
+					m_vStream.insert(m_vStream.end(), pSrc, pSrc + nSrc);
+					const uint8_t* p = m_vStream.data();
+					const size_t nEnd = m_vStream.size();
+
+					// Anything at least as big as the body is of no use
+					m_vOut.resize(nSrc + 16);
+					uint8_t* pOut = m_vOut.data();
+					uint8_t* const pLimit = m_vOut.data() + nSrc;
+					pOut += wire::EncodeVarint(nSrc, pOut);
+
+					size_t i = nStart, nAnchor = nStart, nMisses = 0;
+					while (i + MinMatch <= nEnd)
+					{
+						uint32_t v = Read32(p + i);
+						uint32_t nPos = Position(i);
+						uint32_t& nSeen = m_vTable[Hash(v)];
+						uint32_t nDistance = nPos - nSeen;
+						nSeen = nPos;
+
+						if (nDistance == 0 || nDistance > WindowSize || nDistance > i || Read32(p + i - nDistance) != v)
+						{
+							// Step further the longer nothing matches, so incompressible data is passed over quickly
+							i += 1 + (nMisses++ >> 6);
+							continue;
+						}
+
+						size_t nMatch = MinMatch;
+						while (i + nMatch < nEnd && p[i + nMatch] == p[i + nMatch - nDistance])
+							nMatch++;
+
+						size_t nLiterals = i - nAnchor;
+						if (pOut + nLiterals + nLiterals / 255 + nMatch / 255 + 5 > pLimit)
+							return Abandon(nStart);
+
+						pOut = WriteSequence(pOut, p + nAnchor, nLiterals, nMatch - MinMatch);
+						*pOut++ = uint8_t(nDistance);
+						*pOut++ = uint8_t(nDistance >> 8);
+						if (nMatch - MinMatch >= 15)
+							pOut = WriteLength(pOut, nMatch - MinMatch - 15);
+
+						i += nMatch;
+						nAnchor = i;
+						nMisses = 0;
+					}
+
+					size_t nLiterals = nEnd - nAnchor;
+					if (pOut + nLiterals + nLiterals / 255 + 2 >= pLimit)
+						return Abandon(nStart);
+					pOut = WriteSequence(pOut, p + nAnchor, nLiterals, 0);
+
+					m_vOut.resize(pOut - m_vOut.data());
+					m_nBase += uint32_t(Trim(m_vStream));
+					return true;
+				}
+
+				const std::vector<uint8_t>& Output() const
+				{
+					return m_vOut;
+				}
+
+			private:
+				// Position in the whole stream, wrapping is harmless as matches are checked byte for byte
+				uint32_t Position(size_t i) const
+				{
+					return m_nBase + uint32_t(i);
+				}
+
+				uint8_t* WriteSequence(uint8_t* pOut, const uint8_t* pLiterals, size_t nLiterals, size_t nMatchExtra)
+				{
+					*pOut++ = uint8_t((std::min<size_t>(nLiterals, 15) << 4) | std::min<size_t>(nMatchExtra, 15));
+					if (nLiterals >= 15)
+						pOut = WriteLength(pOut, nLiterals - 15);
+					if (nLiterals > 0)
+						std::memcpy(pOut, pLiterals, nLiterals);
+					return pOut + nLiterals;
+				}
+
+				// The body goes out as it is and is left out of the stream
+				bool Abandon(size_t nStart)
+				{
+					m_vStream.resize(nStart);
+					return false;
+				}
+
+			private:
+				std::vector<uint8_t> m_vStream;
+				std::vector<uint32_t> m_vTable;
+				uint32_t m_nBase = 0;
+				std::vector<uint8_t> m_vOut;
+			};
+
+			class decoder
+			{
+			public:
+				// Decompresses a body into Data(), false if it is malformed or would be larger than nMaxSize
+				bool Decompress(const uint8_t* pIn, size_t nIn, size_t nMaxSize)
+				{
+					Trim(m_vStream);
+
+					uint64_t nSize = 0;
+					size_t nSizeBytes = wire::DecodeVarint(pIn, nIn, wire::MaxSizeVarintBytes, nSize);
+					if (nSizeBytes == 0 || nSize > nMaxSize)
+						return false;
+
+					const uint8_t* pEnd = pIn + nIn;
+					pIn += nSizeBytes;
+
+					m_nStart = m_vStream.size();
+					m_vStream.resize(m_nStart + size_t(nSize));
+					uint8_t* p = m_vStream.data();
+					size_t o = m_nStart;
+					const size_t nEnd = m_vStream.size();
+
+					while (true)
+					{
+						if (pIn == pEnd)
+							return Reject();
+
+						const uint8_t nToken = *pIn++;
+						size_t nLiterals = nToken >> 4;
+						if (nLiterals == 15 && !ReadLength(pIn, pEnd, nLiterals))
+							return Reject();
+						if (nLiterals > nEnd - o || nLiterals > size_t(pEnd - pIn))
+							return Reject();
+
+						if (nLiterals > 0)
+							std::memcpy(p + o, pIn, nLiterals);
+						o += nLiterals;
+						pIn += nLiterals;
+
+						if (o == nEnd)
+							break;
+
+						if (pEnd - pIn < 2)
+							return Reject();
+						size_t nDistance = size_t(pIn[0]) | size_t(pIn[1]) << 8;
+						pIn += 2;
+
+						size_t nMatch = nToken & 0x0F;
+						if (nMatch == 15 && !ReadLength(pIn, pEnd, nMatch))
+							return Reject();
+						nMatch += MinMatch;
+
+						if (nDistance == 0 || nDistance > o || nMatch > nEnd - o)
+							return Reject();
+
+						// Matches may overlap what they produce, which repeats the pattern
+						if (nDistance >= nMatch)
+						{
+							std::memcpy(p + o, p + o - nDistance, nMatch);
+						}
+						else
+						{
+							for (size_t j = 0; j < nMatch; j++)
+								p[o + j] = p[o + j - nDistance];
+						}
+						o += nMatch;
+					}
+
+					if (pIn != pEnd)
+						return Reject();
+					return true;
+				}
+
+				const uint8_t* Data() const
+				{
+					return m_vStream.data() + m_nStart;
+				}
+
+				size_t Size() const
+				{
+					return m_vStream.size() - m_nStart;
+				}
+
+			private:
+				bool Reject()
+				{
+					m_vStream.resize(m_nStart);
+					return false;
+				}
+
+			private:
+				std::vector<uint8_t> m_vStream;
+				size_t m_nStart = 0;
+			};
+		}
+	}
+}
\ No newline at end of file
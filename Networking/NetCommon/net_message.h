@@ -1,5 +1,12 @@
 #pragma once
 #include "net_common.h"
+#include "net_transport.h"
+#include "net_buffer.h"
+
+// Bodies up to this many bytes are stored inside the message, larger ones on the heap
+#ifndef ASR_NET_MESSAGE_INLINE_SIZE
+#define ASR_NET_MESSAGE_INLINE_SIZE 64
+#endif
 
 namespace asr
 {
@@ -18,7 +25,7 @@ namespace asr
 		struct message
 		{
 			message_header<T> header{};
-			std::vector<uint8_t> body;
+			small_buffer<ASR_NET_MESSAGE_INLINE_SIZE> body;
 
 			// returns size of message body in bytes
 			size_t size() const
@@ -87,17 +94,17 @@ namespace asr
 		};		
 
 		// Forward declare connection
-		template <typename T>
+		template <typename T, typename Transport = tcp_transport>
 		class connection;
 
-		template <typename T>
+		template <typename T, typename Transport = tcp_transport>
 		struct owned_message
 		{
-			std::shared_ptr<connection<T>> remote = nullptr;
+			std::shared_ptr<connection<T, Transport>> remote = nullptr;
 			message<T> msg;
 
 			// Override for use with std::cout
-			friend std::ostream& operator << (std::ostream& os, const owned_message<T>& msg)
+			friend std::ostream& operator << (std::ostream& os, const owned_message<T, Transport>& msg)
 			{
 				os << msg.msg;
 				return os;
@@ -0,0 +1,79 @@
+#pragma once
+#include "net_common.h"
+
+namespace asr
+{
+	namespace net
+	{
+		// Unbounded queue any number of threads can push to without locking, drained by a
+		// single consumer. Pushing is one allocation and one atomic exchange. The front node
+		// is always a spent placeholder, the next item lives in the node after it
+		template <typename T>
+		class mpsc_queue
+		{
+		public:
+			mpsc_queue()
+			{
+				node* pStub = new node();
+				m_pHead.store(pStub, std::memory_order_relaxed);
+				m_pTail = pStub;
+			}
+
+			mpsc_queue(const mpsc_queue<T>&) = delete;
+			mpsc_queue& operator = (const mpsc_queue<T>&) = delete;
+
+			~mpsc_queue()
+			{
+				while (m_pTail)
+				{
+					node* pNext = m_pTail->next.load(std::memory_order_relaxed);
+					delete m_pTail;
+					m_pTail = pNext;
+				}
+			}
+
+		public:
+			// Any thread
+			void push(T item)
+			{
+				node* pNode = new node(std::move(item));
+				node* pPrev = m_pHead.exchange(pNode, std::memory_order_acq_rel);
+				pPrev->next.store(pNode, std::memory_order_release);
+			}
+
+			// Consumer only. Returns false if empty, or if the next push hasn't finished linking
+			// itself in, which the producer follows up on by waking the consumer again
+			bool pop(T& item)
+			{
+				node* pNext = m_pTail->next.load(std::memory_order_acquire);
+				if (!pNext)
+					return false;
+
+				item = std::move(pNext->value);
+				delete m_pTail;
+				m_pTail = pNext;
+				return true;
+			}
+
+			// Bytes of the placeholder node every queue holds, even when empty
+			static constexpr size_t StubSize()
+			{
+				return sizeof(node);
+			}
+
+		private:
+			struct node
+			{
+				node() = default;
+				explicit node(T&& v) : value(std::move(v)) {}
+
+				std::atomic<node*> next{ nullptr };
+				T value{};
+			};
+
+			// Producers swap themselves in at the head, the consumer walks from the tail
+			alignas(64) std::atomic<node*> m_pHead{ nullptr };
+			alignas(64) node* m_pTail = nullptr;
+		};
+	}
+}
\ No newline at end of file
@@ -0,0 +1,370 @@
+#pragma once
+#include "net_common.h"
+#include "net_log.h"
+
+namespace asr
+{
+	namespace net
+	{
+		// How one direction of a simulated link misbehaves. The stream is cut into packets at
+		// fixed offsets and every packet draws its impairments from a generator seeded with
+		// nSeed, so the same traffic meets the same conditions on every run
+		struct impairment_profile
+		{
+			// One way delay added to every packet
+			std::chrono::microseconds tLatency{ 0 };
+
+			// Extra delay drawn uniformly from [0, tJitter] per packet. The stream stays in
+			// order, so a slow packet holds back the ones behind it as it would with TCP
+			std::chrono::microseconds tJitter{ 0 };
+
+			// Chance a packet is lost. TCP resends it, so it arrives tRetransmit late instead
+			double dLossRate = 0.0;
+			std::chrono::microseconds tRetransmit{ 200000 };
+
+			// Link rate, 0 means unlimited
+			double dBytesPerSecond = 0.0;
+
+			// Size packets are cut to
+			size_t nPacketSize = 1400;
+
+			uint64_t nSeed = 1;
+
+			// Same building, same switch
+			static impairment_profile lan()
+			{
+				impairment_profile p;
+				p.tLatency = std::chrono::microseconds(250);
+				p.tJitter = std::chrono::microseconds(50);
+				return p;
+			}
+
+			// Home connection to a server in the same region
+			static impairment_profile broadband()
+			{
+				impairment_profile p;
+				p.tLatency = std::chrono::milliseconds(15);
+				p.tJitter = std::chrono::milliseconds(3);
+				p.dLossRate = 0.001;
+				p.dBytesPerSecond = 50e6 / 8;
+				return p;
+			}
+
+			// Phone on a busy cell
+			static impairment_profile mobile()
+			{
+				impairment_profile p;
+				p.tLatency = std::chrono::milliseconds(60);
+				p.tJitter = std::chrono::milliseconds(25);
+				p.dLossRate = 0.01;
+				p.dBytesPerSecond = 5e6 / 8;
+				return p;
+			}
+		};
+
+		// TCP proxy that sits between clients and a server and impairs traffic in each
+		// direction. Point clients at the proxy's port instead of the server's
+		class netsim_proxy
+		{
+		public:
+			netsim_proxy(uint16_t nListenPort, const asio::ip::tcp::endpoint& upstream)
+				: m_acceptor(m_context, asio::ip::tcp::endpoint(asio::ip::tcp::v4(), nListenPort)), m_upstream(upstream)
+			{
+
+			}
+
+			virtual ~netsim_proxy()
+			{
+				Stop();
+			}
+
+		public:
+			// Profiles for traffic towards the server and back to the client, set before Start()
+			void SetProfiles(const impairment_profile& toServer, const impairment_profile& toClient)
+			{
+				m_profileToServer = toServer;
+				m_profileToClient = toClient;
+			}
+
+			// Same conditions both ways, though each direction draws its own numbers
+			void SetProfile(const impairment_profile& profile)
+			{
+				impairment_profile toClient = profile;
+				toClient.nSeed = profile.nSeed ^ 0x9E3779B97F4A7C15;
+				SetProfiles(profile, toClient);
+			}
+
+			bool Start()
+			{
+				try
+				{
+					WaitForConnection();
+					m_thrContext = std::thread([this]() { m_context.run(); });
+				}
+				catch (std::exception& e)
+				{
+					ASR_NET_LOG(error, "[NETSIM] Exception: ", e.what());
+					return false;
+				}
+
+				ASR_NET_LOG(info, "[NETSIM] Forwarding port ", m_acceptor.local_endpoint().port(), " to ", m_upstream);
+				return true;
+			}
+
+			void Stop()
+			{
+				m_context.stop();
+				if (m_thrContext.joinable())
+					m_thrContext.join();
+			}
+
+		private:
+			// One direction of a proxied connection
+			struct link
+			{
+				link(asio::io_context& context, asio::ip::tcp::socket& from, asio::ip::tcp::socket& to, const impairment_profile& profile, uint64_t nStream)
+					: from(from), to(to), timer(context), profile(profile), rng(profile.nSeed + nStream * 0x2545F4914F6CDD1D)
+				{
+
+				}
+
+				struct packet
+				{
+					std::chrono::steady_clock::time_point tDeliver;
+					std::vector<uint8_t> vData;
+				};
+
+				asio::ip::tcp::socket& from;
+				asio::ip::tcp::socket& to;
+				asio::steady_timer timer;
+				impairment_profile profile;
+				std::mt19937_64 rng;
+
+				std::array<uint8_t, 16 * 1024> aRead{};
+				std::deque<packet> deqInFlight;
+				size_t nInFlightBytes = 0;
+				bool bReading = false;
+				bool bWriting = false;
+
+				// The sender has finished, what is held back still goes out before the other
+				// side sees the end of the stream
+				bool bEnded = false;
+				bool bDone = false;
+
+				// Offset into the stream, and the delay drawn for the packet it falls in
+				uint64_t nOffset = 0;
+				std::chrono::steady_clock::duration tPacketDelay{};
+
+				// When the link finishes sending what it already has, and when the last packet arrives
+				std::chrono::steady_clock::time_point tLinkFree;
+				std::chrono::steady_clock::time_point tLastDeliver;
+			};
+
+			// Both directions of one client, kept alive by whichever handlers are pending
+			struct session : std::enable_shared_from_this<session>
+			{
+				session(asio::io_context& context, asio::ip::tcp::socket client, const impairment_profile& toServer, const impairment_profile& toClient, uint64_t nStream)
+					: client(std::move(client)), server(context),
+					up(context, this->client, server, toServer, nStream), down(context, server, this->client, toClient, nStream)
+				{
+
+				}
+
+				// One direction has delivered everything, pass the end of the stream on. The
+				// session closes once both directions have
+				void finish(link& l)
+				{
+					l.bDone = true;
+					asio::error_code ec;
+					l.to.shutdown(asio::ip::tcp::socket::shutdown_send, ec);
+					if (up.bDone && down.bDone)
+						close();
+				}
+
+				void close()
+				{
+					asio::error_code ec;
+					client.close(ec);
+					server.close(ec);
+					up.timer.cancel();
+					down.timer.cancel();
+				}
+
+				asio::ip::tcp::socket client;
+				asio::ip::tcp::socket server;
+				link up;
+				link down;
+			};
+
+			// Reading stops while this much is held back, so a slow link pushes back on the sender
+			static constexpr size_t MaxInFlightBytes = 4 * 1024 * 1024;
+
+			void WaitForConnection()
+			{
+				m_acceptor.async_accept(
+					[this](std::error_code ec, asio::ip::tcp::socket socket)
+					{
+						if (!ec)
+						{
+							asio::error_code ecOption;
+							socket.set_option(asio::ip::tcp::no_delay(true), ecOption);
+
+							auto s = std::make_shared<session>(m_context, std::move(socket), m_profileToServer, m_profileToClient, m_nStreams++);
+							s->server.async_connect(m_upstream,
+								[this, s](std::error_code ec)
+								{
+									if (ec)
+									{
+										ASR_NET_LOG(warn, "[NETSIM] Upstream connect failed: ", ec.message());
+										s->close();
+										return;
+									}
+
+									asio::error_code ecOption;
+									s->server.set_option(asio::ip::tcp::no_delay(true), ecOption);
+									Read(s, s->up);
+									Read(s, s->down);
+								}
+							);
+						}
+						else
+						{
+							ASR_NET_LOG(warn, "[NETSIM] Accept failed: ", ec.message());
+						}
+
+						WaitForConnection();
+					}
+				);
+			}
+
+			void Read(std::shared_ptr<session> s, link& l)
+			{
+				l.bReading = true;
+				l.from.async_read_some(asio::buffer(l.aRead),
+					[this, s, &l](std::error_code ec, std::size_t length)
+					{
+						// Time the bytes turned up, before anything else this handler does
+						auto tArrived = std::chrono::steady_clock::now();
+
+						l.bReading = false;
+						if (ec)
+						{
+							// End of stream or a reset, either way deliver what is still held back first
+							l.bEnded = true;
+							if (!l.bWriting)
+								Deliver(s, l);
+							return;
+						}
+
+						Schedule(l, length, tArrived);
+						if (!l.bWriting)
+							Deliver(s, l);
+
+						if (l.nInFlightBytes < MaxInFlightBytes)
+							Read(s, l);
+					}
+				);
+			}
+
+			// Works out when each packet of what was just read reaches the other side. Times
+			// count from tArrived, so time spent queued behind other handlers is not added on
+			void Schedule(link& l, size_t nLength, std::chrono::steady_clock::time_point tArrived)
+			{
+				const impairment_profile& p = l.profile;
+				const size_t nPacketSize = std::max<size_t>(p.nPacketSize, 1);
+
+				size_t i = 0;
+				while (i < nLength)
+				{
+					// First bytes of a new packet, draw its fate
+					if (l.nOffset % nPacketSize == 0)
+					{
+						std::uniform_real_distribution<double> dist(0.0, 1.0);
+						double dJitter = dist(l.rng);
+						bool bLost = dist(l.rng) < p.dLossRate;
+
+						l.tPacketDelay = p.tLatency + std::chrono::duration_cast<std::chrono::steady_clock::duration>(p.tJitter * dJitter);
+						if (bLost)
+							l.tPacketDelay += p.tRetransmit;
+					}
+
+					size_t nChunk = std::min(nLength - i, nPacketSize - size_t(l.nOffset % nPacketSize));
+
+					// Bytes queue for the link, then take the packet's delay to cross it
+					auto tSent = std::max(l.tLinkFree, tArrived);
+					if (p.dBytesPerSecond > 0.0)
+						tSent += std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(double(nChunk) / p.dBytesPerSecond));
+					l.tLinkFree = tSent;
+
+					// TCP delivers in order, nothing overtakes
+					auto tDeliver = std::max(tSent + l.tPacketDelay, l.tLastDeliver);
+					l.tLastDeliver = tDeliver;
+
+					// Chunks due at the same moment go out together
+					if (!l.deqInFlight.empty() && l.deqInFlight.back().tDeliver == tDeliver)
+						l.deqInFlight.back().vData.insert(l.deqInFlight.back().vData.end(), l.aRead.data() + i, l.aRead.data() + i + nChunk);
+					else
+						l.deqInFlight.push_back({ tDeliver, std::vector<uint8_t>(l.aRead.data() + i, l.aRead.data() + i + nChunk) });
+
+					l.nInFlightBytes += nChunk;
+					l.nOffset += nChunk;
+					i += nChunk;
+				}
+			}
+
+			// Waits for the front packet to be due, then writes it
+			void Deliver(std::shared_ptr<session> s, link& l)
+			{
+				if (l.deqInFlight.empty())
+				{
+					l.bWriting = false;
+					if (l.bEnded && !l.bDone)
+						s->finish(l);
+					return;
+				}
+
+				l.bWriting = true;
+				l.timer.expires_at(l.deqInFlight.front().tDeliver);
+				l.timer.async_wait(
+					[this, s, &l](std::error_code ec)
+					{
+						if (ec)
+							return;
+
+						asio::async_write(l.to, asio::buffer(l.deqInFlight.front().vData),
+							[this, s, &l](std::error_code ec, std::size_t length)
+							{
+								if (ec)
+								{
+									s->close();
+									return;
+								}
+
+								l.nInFlightBytes -= length;
+								l.deqInFlight.pop_front();
+
+								// Resume reading once the backlog has drained
+								if (!l.bReading && !l.bEnded && l.nInFlightBytes < MaxInFlightBytes && l.from.is_open())
+									Read(s, l);
+
+								Deliver(s, l);
+							}
+						);
+					}
+				);
+			}
+
+		private:
+			asio::io_context m_context;
+			std::thread m_thrContext;
+			asio::ip::tcp::acceptor m_acceptor;
+			asio::ip::tcp::endpoint m_upstream;
+
+			impairment_profile m_profileToServer;
+			impairment_profile m_profileToClient;
+
+			// Counts connections, so each gets its own stream of random numbers
+			uint64_t m_nStreams = 0;
+		};
+	}
+}
\ No newline at end of file
@@ -0,0 +1,603 @@
+#pragma once
+#include "net_common.h"
+#include "net_message.h"
+#include "net_wire.h"
+#include "net_crc32c.h"
+#include "net_log.h"
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+namespace asr
+{
+	namespace net
+	{
+		namespace outbox
+		{
+			// A file mapped into memory at a fixed size, grown up front so appends are plain memory writes
+			class mapped_file
+			{
+			public:
+				mapped_file() = default;
+				mapped_file(const mapped_file&) = delete;
+				~mapped_file() { close(); }
+
+				// Opens or creates the file, making it at least nSize bytes
+				bool open(const std::string& sPath, size_t nSize)
+				{
+					close();
+#ifdef _WIN32
+					m_hFile = CreateFileA(sPath.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+					if (m_hFile == INVALID_HANDLE_VALUE)
+					{
+						m_hFile = nullptr;
+						return false;
+					}
+
+					LARGE_INTEGER nExisting{};
+					GetFileSizeEx(m_hFile, &nExisting);
+					nSize = std::max(nSize, size_t(nExisting.QuadPart));
+
+					m_hMapping = CreateFileMappingA(m_hFile, nullptr, PAGE_READWRITE, DWORD(uint64_t(nSize) >> 32), DWORD(nSize), nullptr);
+					if (!m_hMapping)
+					{
+						close();
+						return false;
+					}
+
+					m_pData = MapViewOfFile(m_hMapping, FILE_MAP_ALL_ACCESS, 0, 0, nSize);
+#else
+					m_nFile = ::open(sPath.c_str(), O_RDWR | O_CREAT, 0644);
+					if (m_nFile < 0)
+						return false;
+
+					struct stat st {};
+					fstat(m_nFile, &st);
+					if (size_t(st.st_size) < nSize && ftruncate(m_nFile, off_t(nSize)) != 0)
+					{
+						close();
+						return false;
+					}
+					nSize = std::max(nSize, size_t(st.st_size));
+
+					m_pData = mmap(nullptr, nSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_nFile, 0);
+					if (m_pData == MAP_FAILED)
+						m_pData = nullptr;
+#endif
+					if (!m_pData)
+					{
+						close();
+						return false;
+					}
+
+					m_nSize = nSize;
+					return true;
+				}
+
+				void close()
+				{
+#ifdef _WIN32
+					if (m_pData)
+						UnmapViewOfFile(m_pData);
+					if (m_hMapping)
+						CloseHandle(m_hMapping);
+					if (m_hFile)
+						CloseHandle(m_hFile);
+					m_hMapping = nullptr;
+					m_hFile = nullptr;
+#else
+					if (m_pData)
+						munmap(m_pData, m_nSize);
+					if (m_nFile >= 0)
+						::close(m_nFile);
+					m_nFile = -1;
+#endif
+					m_pData = nullptr;
+					m_nSize = 0;
+				}
+
+				// Writes changed pages through to the disk
+				void sync()
+				{
+					if (!m_pData)
+						return;
+#ifdef _WIN32
+					FlushViewOfFile(m_pData, m_nSize);
+					FlushFileBuffers(m_hFile);
+#else
+					msync(m_pData, m_nSize, MS_SYNC);
+#endif
+				}
+
+				uint8_t* data() const
+				{
+					return static_cast<uint8_t*>(m_pData);
+				}
+
+				size_t size() const
+				{
+					return m_nSize;
+				}
+
+			private:
+				void* m_pData = nullptr;
+				size_t m_nSize = 0;
+#ifdef _WIN32
+				HANDLE m_hFile = nullptr;
+				HANDLE m_hMapping = nullptr;
+#else
+				int m_nFile = -1;
+#endif
+			};
+
+			// Records are [size][crc32c][sequence][expiry][id][body size][body], size counting
+			// everything after the checksum. A zero size marks the end of a segment
+			constexpr size_t RecordHeaderSize = 4 + 4 + 8 + 8 + 8 + 4;
+			constexpr size_t ChecksummedOffset = 8;
+
+			inline void Store64(uint8_t* p, uint64_t v) { std::memcpy(p, &v, 8); }
+			inline void Store32(uint8_t* p, uint32_t v) { std::memcpy(p, &v, 4); }
+			inline uint64_t Load64(const uint8_t* p) { uint64_t v; std::memcpy(&v, p, 8); return v; }
+			inline uint32_t Load32(const uint8_t* p) { uint32_t v; std::memcpy(&v, p, 4); return v; }
+
+			inline int64_t WallClock()
+			{
+				return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+			}
+		}
+
+		// Limits and durability settings for a durable_outbox
+		struct outbox_policy
+		{
+			enum class sync
+			{
+				// Leave it to the operating system
+				none,
+				// The background thread syncs whatever changed every tSyncInterval
+				batched,
+				// Every Store is on disk before it returns
+				always
+			};
+
+			// Size of each segment file, larger messages get a segment to themselves
+			size_t nSegmentSize = 4 * 1024 * 1024;
+
+			// Once a client has more than this waiting the oldest messages are dropped
+			uint64_t nMaxBytesPerClient = 64 * 1024 * 1024;
+
+			// How long a message is worth delivering, 0 for forever
+			std::chrono::seconds tTimeToLive{ 24 * 60 * 60 };
+
+			sync nSync = sync::batched;
+			std::chrono::milliseconds tSyncInterval{ 50 };
+
+			// How often the background thread removes segments with nothing left to deliver
+			std::chrono::milliseconds tCompactInterval{ 5000 };
+		};
+
+		// Per client store-and-forward queue that survives disconnects and restarts. Messages
+		// are appended to memory mapped segment files under one directory per client, each with
+		// a sequence number the client acknowledges. Anything unacknowledged is replayed when the
+		// client comes back. Clients are named by the application, connection IDs don't survive
+		// a reconnect
+		template <typename T>
+		class durable_outbox
+		{
+		public:
+			durable_outbox(const std::string& sDirectory, const outbox_policy& policy = outbox_policy())
+				: m_pathRoot(sDirectory), m_policy(policy)
+			{
+				std::error_code ec;
+				std::filesystem::create_directories(m_pathRoot, ec);
+
+				m_thrBackground = std::thread([this]() { Background(); });
+			}
+
+			virtual ~durable_outbox()
+			{
+				{
+					std::scoped_lock lock(m_mux);
+					m_bQuit = true;
+				}
+				m_cvQuit.notify_one();
+				m_thrBackground.join();
+
+				Flush();
+			}
+
+		public:
+			// Stores msg for the client and returns its sequence number. The number is pushed onto
+			// the end of msg, so the client can pop it off and acknowledge it, and msg can then be
+			// sent straight away if the client is connected
+			uint64_t Store(const std::string& sClient, message<T>& msg)
+			{
+				std::shared_ptr<outbox::mapped_file> pSync;
+				uint64_t nSequence = 0;
+				{
+					std::scoped_lock lock(m_mux);
+					client& c = Client(sClient);
+
+					nSequence = c.nNextSequence++;
+					msg << nSequence;
+
+					size_t nRecord = outbox::RecordHeaderSize + msg.body.size();
+					segment* pSegment = c.vSegments.empty() ? nullptr : &c.vSegments.back();
+					if (!pSegment || pSegment->nTail + nRecord + 4 > pSegment->pFile->size())
+						pSegment = AddSegment(c, nSequence, nRecord + 4);
+					if (!pSegment)
+					{
+						msg >> nSequence;
+						c.nNextSequence--;
+						return 0;
+					}
+
+					int64_t nExpiry = m_policy.tTimeToLive.count() > 0
+						? outbox::WallClock() + std::chrono::duration_cast<std::chrono::nanoseconds>(m_policy.tTimeToLive).count()
+						: std::numeric_limits<int64_t>::max();
+
+					// Body first, the size that makes the record visible goes in last
+					uint8_t* p = pSegment->pFile->data() + pSegment->nTail;
+					outbox::Store64(p + 8, nSequence);
+					outbox::Store64(p + 16, uint64_t(nExpiry));
+					outbox::Store64(p + 24, uint64_t(wire::id_int_t<T>(msg.header.id)));
+					outbox::Store32(p + 32, uint32_t(msg.body.size()));
+					if (!msg.body.empty())
+						std::memcpy(p + outbox::RecordHeaderSize, msg.body.data(), msg.body.size());
+
+					// Anything left past a torn record by a crash must not be read as the next one
+					outbox::Store32(p + nRecord, 0);
+					outbox::Store32(p + 4, crc32c::Value(p + outbox::ChecksummedOffset, nRecord - outbox::ChecksummedOffset));
+					outbox::Store32(p, uint32_t(nRecord - outbox::ChecksummedOffset));
+
+					pSegment->nTail += nRecord;
+					pSegment->nLastSequence = nSequence;
+					pSegment->nLastExpiry = std::max(pSegment->nLastExpiry, nExpiry);
+					pSegment->bDirty = true;
+					c.nBytes += nRecord;
+
+					if (m_policy.nSync == outbox_policy::sync::always)
+					{
+						pSync = pSegment->pFile;
+						pSegment->bDirty = false;
+					}
+
+					// Erases segments from the front, pSegment is not to be used after this
+					EnforceLimit(sClient, c);
+				}
+
+				if (pSync)
+					pSync->sync();
+				return nSequence;
+			}
+
+			// Calls f(message<T>&) for each message the client hasn't acknowledged, oldest first.
+			// Each has its sequence number pushed on the end as Store left it
+			template <typename F>
+			size_t Replay(const std::string& sClient, F&& f)
+			{
+				std::scoped_lock lock(m_mux);
+				client& c = Client(sClient);
+				int64_t tNow = outbox::WallClock();
+				size_t nCount = 0;
+
+				for (segment& s : c.vSegments)
+				{
+					if (s.nLastSequence <= c.nAcked)
+						continue;
+
+					ForEachRecord(s, [&](const uint8_t* p, uint64_t nSequence)
+						{
+							if (nSequence <= c.nAcked || int64_t(outbox::Load64(p + 16)) < tNow)
+								return;
+
+							message<T> msg;
+							msg.header.id = T(wire::id_int_t<T>(outbox::Load64(p + 24)));
+							uint32_t nBody = outbox::Load32(p + 32);
+							msg.body.assign(p + outbox::RecordHeaderSize, p + outbox::RecordHeaderSize + nBody);
+							msg.header.size = nBody;
+							f(msg);
+							nCount++;
+						}
+					);
+				}
+
+				return nCount;
+			}
+
+			// Everything up to and including nSequence has reached the client
+			void Acknowledge(const std::string& sClient, uint64_t nSequence)
+			{
+				std::scoped_lock lock(m_mux);
+				client& c = Client(sClient);
+				if (nSequence <= c.nAcked || nSequence >= c.nNextSequence)
+					return;
+
+				c.nAcked = nSequence;
+				outbox::Store64(c.fileAck.data(), nSequence);
+				c.bAckDirty = true;
+			}
+
+			// Messages stored for the client and not yet acknowledged, expired ones included
+			uint64_t Pending(const std::string& sClient)
+			{
+				std::scoped_lock lock(m_mux);
+				client& c = Client(sClient);
+				return c.nNextSequence - 1 - c.nAcked;
+			}
+
+			// Puts everything stored so far on disk
+			void Flush()
+			{
+				for (auto& pFile : TakeDirty())
+					pFile->sync();
+			}
+
+			// Deletes segments with nothing left to deliver. Runs in the background as well
+			void Compact()
+			{
+				std::vector<std::filesystem::path> vDelete;
+				{
+					std::scoped_lock lock(m_mux);
+					int64_t tNow = outbox::WallClock();
+
+					for (auto& [sName, c] : m_mapClients)
+					{
+						// Segments go oldest first, so dead ones are always at the front. The
+						// newest stays, it is where the next message goes
+						while (c.vSegments.size() > 1)
+						{
+							segment& s = c.vSegments.front();
+							if (s.nLastSequence > c.nAcked && s.nLastExpiry >= tNow)
+								break;
+
+							c.nBytes -= std::min<uint64_t>(c.nBytes, s.nTail);
+							vDelete.push_back(s.path);
+							c.vSegments.erase(c.vSegments.begin());
+						}
+					}
+				}
+
+				// Files still mapped by a sync in progress are only unmapped once it finishes
+				std::error_code ec;
+				for (auto& path : vDelete)
+					std::filesystem::remove(path, ec);
+			}
+
+		private:
+			struct segment
+			{
+				std::filesystem::path path;
+				std::shared_ptr<outbox::mapped_file> pFile;
+				uint64_t nFirstSequence = 0;
+				uint64_t nLastSequence = 0;
+				int64_t nLastExpiry = 0;
+				size_t nTail = 0;
+				bool bDirty = false;
+			};
+
+			struct client
+			{
+				std::filesystem::path path;
+				std::vector<segment> vSegments;
+				outbox::mapped_file fileAck;
+				uint64_t nAcked = 0;
+				uint64_t nNextSequence = 1;
+				uint64_t nBytes = 0;
+				bool bAckDirty = false;
+			};
+
+			// Calls f(record, sequence) for every intact record in a segment
+			template <typename F>
+			static void ForEachRecord(const segment& s, F&& f)
+			{
+				const uint8_t* pData = s.pFile->data();
+				size_t nOffset = 0;
+				while (nOffset < s.nTail)
+				{
+					const uint8_t* p = pData + nOffset;
+					f(p, outbox::Load64(p + 8));
+					nOffset += outbox::ChecksummedOffset + outbox::Load32(p);
+				}
+			}
+
+			// Finds a client, loading whatever a previous run left on disk the first time
+			client& Client(const std::string& sClient)
+			{
+				auto it = m_mapClients.find(sClient);
+				if (it != m_mapClients.end())
+					return it->second;
+
+				client& c = m_mapClients[sClient];
+				c.path = m_pathRoot / DirectoryName(sClient);
+
+				std::error_code ec;
+				std::filesystem::create_directories(c.path, ec);
+				c.fileAck.open((c.path / "ack").string(), sizeof(uint64_t));
+				if (c.fileAck.data())
+					c.nAcked = outbox::Load64(c.fileAck.data());
+
+				// Segments are named after their first sequence number, so sorting puts them in order
+				std::vector<std::filesystem::path> vPaths;
+				for (auto& entry : std::filesystem::directory_iterator(c.path, ec))
+					if (entry.path().extension() == ".seg")
+						vPaths.push_back(entry.path());
+				std::sort(vPaths.begin(), vPaths.end());
+
+				for (auto& path : vPaths)
+				{
+					segment s;
+					s.path = path;
+					s.pFile = std::make_shared<outbox::mapped_file>();
+					if (!s.pFile->open(path.string(), 0))
+						continue;
+
+					Recover(s);
+					if (s.nTail == 0)
+					{
+						s.pFile.reset();
+						std::filesystem::remove(path, ec);
+						continue;
+					}
+
+					c.nNextSequence = std::max(c.nNextSequence, s.nLastSequence + 1);
+					c.nBytes += s.nTail;
+					c.vSegments.push_back(std::move(s));
+				}
+
+				c.nAcked = std::min(c.nAcked, c.nNextSequence - 1);
+				return c;
+			}
+
+			// Finds the end of the intact records, a crash mid write leaves a torn one at the end
+			static void Recover(segment& s)
+			{
+				const uint8_t* pData = s.pFile->data();
+				const size_t nSize = s.pFile->size();
+				size_t nOffset = 0;
+
+				while (nOffset + outbox::RecordHeaderSize <= nSize)
+				{
+					const uint8_t* p = pData + nOffset;
+					uint32_t nRecord = outbox::Load32(p);
+					if (nRecord == 0 || nOffset + outbox::ChecksummedOffset + nRecord > nSize)
+						break;
+					if (crc32c::Value(p + outbox::ChecksummedOffset, nRecord) != outbox::Load32(p + 4))
+						break;
+
+					uint64_t nSequence = outbox::Load64(p + 8);
+					if (s.nFirstSequence == 0)
+						s.nFirstSequence = nSequence;
+					s.nLastSequence = nSequence;
+					s.nLastExpiry = std::max(s.nLastExpiry, int64_t(outbox::Load64(p + 16)));
+					nOffset += outbox::ChecksummedOffset + nRecord;
+				}
+
+				s.nTail = nOffset;
+			}
+
+			segment* AddSegment(client& c, uint64_t nFirstSequence, size_t nNeeded)
+			{
+				char sName[32];
+				std::snprintf(sName, sizeof(sName), "%016llx.seg", (unsigned long long)nFirstSequence);
+
+				segment s;
+				s.path = c.path / sName;
+				s.nFirstSequence = nFirstSequence;
+				s.pFile = std::make_shared<outbox::mapped_file>();
+				if (!s.pFile->open(s.path.string(), std::max(m_policy.nSegmentSize, nNeeded)))
+				{
+					ASR_NET_LOG(error, "[OUTBOX] Failed to create segment ", s.path.string());
+					return nullptr;
+				}
+
+				c.vSegments.push_back(std::move(s));
+				return &c.vSegments.back();
+			}
+
+			// Drops the oldest messages of a client over its byte limit
+			void EnforceLimit(const std::string& sClient, client& c)
+			{
+				if (c.nBytes <= m_policy.nMaxBytesPerClient || c.vSegments.size() < 2)
+					return;
+
+				// Whole segments go, the newest always stays
+				while (c.nBytes > m_policy.nMaxBytesPerClient && c.vSegments.size() > 1)
+				{
+					segment& s = c.vSegments.front();
+					if (s.nLastSequence > c.nAcked)
+					{
+						ASR_NET_LOG(warn, "[OUTBOX] ", sClient, " is over its limit, dropping messages up to ", s.nLastSequence);
+						c.nAcked = s.nLastSequence;
+						outbox::Store64(c.fileAck.data(), c.nAcked);
+						c.bAckDirty = true;
+					}
+
+					c.nBytes -= std::min<uint64_t>(c.nBytes, s.nTail);
+					std::filesystem::path path = s.path;
+					c.vSegments.erase(c.vSegments.begin());
+
+					std::error_code ec;
+					std::filesystem::remove(path, ec);
+				}
+			}
+
+			// Client names become hex, so any string is a safe directory name
+			static std::string DirectoryName(const std::string& sClient)
+			{
+				static const char* sHex = "0123456789abcdef";
+				std::string sName;
+				for (unsigned char ch : sClient)
+				{
+					sName.push_back(sHex[ch >> 4]);
+					sName.push_back(sHex[ch & 15]);
+				}
+				return sName.empty() ? "_" : sName;
+			}
+
+			std::vector<std::shared_ptr<outbox::mapped_file>> TakeDirty()
+			{
+				std::vector<std::shared_ptr<outbox::mapped_file>> vDirty;
+				std::scoped_lock lock(m_mux);
+				for (auto& [sName, c] : m_mapClients)
+				{
+					for (segment& s : c.vSegments)
+					{
+						if (s.bDirty)
+							vDirty.push_back(s.pFile);
+						s.bDirty = false;
+					}
+
+					// Acks are a single page, cheap enough to sync under the lock
+					if (c.bAckDirty)
+						c.fileAck.sync();
+					c.bAckDirty = false;
+				}
+				return vDirty;
+			}
+
+			void Background()
+			{
+				auto tNextCompact = std::chrono::steady_clock::now() + m_policy.tCompactInterval;
+
+				std::unique_lock lock(m_mux);
+				while (!m_bQuit)
+				{
+					m_cvQuit.wait_for(lock, m_policy.tSyncInterval);
+					if (m_bQuit)
+						break;
+
+					lock.unlock();
+
+					// Syncing happens outside the lock so Store never waits on the disk
+					if (m_policy.nSync == outbox_policy::sync::batched)
+						Flush();
+
+					if (std::chrono::steady_clock::now() >= tNextCompact)
+					{
+						Compact();
+						tNextCompact = std::chrono::steady_clock::now() + m_policy.tCompactInterval;
+					}
+
+					lock.lock();
+				}
+			}
+
+		private:
+			std::filesystem::path m_pathRoot;
+			outbox_policy m_policy;
+
+			std::mutex m_mux;
+			std::unordered_map<std::string, client> m_mapClients;
+
+			std::thread m_thrBackground;
+			std::condition_variable m_cvQuit;
+			bool m_bQuit = false;
+		};
+	}
+}
\ No newline at end of file
@@ -0,0 +1,114 @@
+#pragma once
+#include "net_common.h"
+
+namespace asr
+{
+	namespace net
+	{
+		// Limits on what a single remote may send us
+		struct ingress_limits
+		{
+			// What to do when a remote goes over its rate
+			enum class action
+			{
+				// Stop reading until the budget recovers, TCP then slows the sender down
+				pause,
+				// Drop the connection
+				disconnect
+			};
+
+			// Largest message body accepted, checked before any memory is allocated
+			uint32_t nMaxMessageSize = 64 * 1024 * 1024;
+
+			// Sustained rates, 0 means unlimited
+			double dMessagesPerSecond = 0.0;
+			double dBytesPerSecond = 0.0;
+
+			// How many seconds worth of rate may arrive in one burst
+			double dBurstSeconds = 1.0;
+
+			action nOnLimit = action::pause;
+		};
+
+		// Classic token bucket, allowed to go into debt so a single large message
+		// still gets through and is paid for afterwards
+		class token_bucket
+		{
+		public:
+			void configure(double dRate, double dBurst)
+			{
+				m_dRate = dRate;
+				m_dBurst = std::max(dBurst, 1.0);
+				m_dTokens = m_dBurst;
+				m_tLast = std::chrono::steady_clock::now();
+			}
+
+			bool enabled() const
+			{
+				return m_dRate > 0.0;
+			}
+
+			// Takes nTokens, returns how long until the bucket is out of debt
+			std::chrono::steady_clock::duration consume(double nTokens, std::chrono::steady_clock::time_point tNow)
+			{
+				// Refill for the time that has passed
+				double dElapsed = std::chrono::duration<double>(tNow - m_tLast).count();
+				m_dTokens = std::min(m_dBurst, m_dTokens + dElapsed * m_dRate);
+				m_tLast = tNow;
+
+				m_dTokens -= nTokens;
+				if (m_dTokens >= 0.0)
+					return std::chrono::steady_clock::duration::zero();
+
+				return std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+					std::chrono::duration<double>(-m_dTokens / m_dRate));
+			}
+
+		private:
+			double m_dRate = 0.0;
+			double m_dBurst = 0.0;
+			double m_dTokens = 0.0;
+			std::chrono::steady_clock::time_point m_tLast;
+		};
+
+		// Per connection budget built from ingress_limits
+		class ingress_budget
+		{
+		public:
+			void configure(const ingress_limits& limits)
+			{
+				m_limits = limits;
+				m_bucketMessages.configure(limits.dMessagesPerSecond, limits.dMessagesPerSecond * limits.dBurstSeconds);
+				m_bucketBytes.configure(limits.dBytesPerSecond, limits.dBytesPerSecond * limits.dBurstSeconds);
+			}
+
+			const ingress_limits& limits() const
+			{
+				return m_limits;
+			}
+
+			// Charges a received message, returns how long reading should pause (zero for not at all)
+			std::chrono::steady_clock::duration charge(size_t nBytes)
+			{
+				if (!m_bucketMessages.enabled() && !m_bucketBytes.enabled())
+					return std::chrono::steady_clock::duration::zero();
+
+				auto tNow = std::chrono::steady_clock::now();
+				auto tPause = std::chrono::steady_clock::duration::zero();
+
+				if (m_bucketMessages.enabled())
+					tPause = std::max(tPause, m_bucketMessages.consume(1.0, tNow));
+
+				if (m_bucketBytes.enabled())
+					tPause = std::max(tPause, m_bucketBytes.consume(double(nBytes), tNow));
+
+				return tPause;
+			}
+
+		private:
+			ingress_limits m_limits;
+			token_bucket m_bucketMessages;
+			token_bucket m_bucketBytes;
+		};
+	}
+}
\ No newline at end of file
@@ -0,0 +1,126 @@
+#pragma once
+#include "net_common.h"
+
+#ifdef _WIN32
+	#include <windows.h>
+#elif defined(__linux__)
+	#include <sys/eventfd.h>
+	#include <unistd.h>
+#else
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+namespace asr
+{
+	namespace net
+	{
+		// An OS object that is signalled while something is waiting to be processed,
+		// so it can be added to an external epoll/select/WaitForMultipleObjects loop.
+		// Linux uses an eventfd, Windows a manual reset event and other platforms a pipe
+		class readiness_event
+		{
+		public:
+#ifdef _WIN32
+			using native_handle_type = HANDLE;
+#else
+			using native_handle_type = int;
+#endif
+
+			readiness_event()
+			{
+#ifdef _WIN32
+				m_hEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+#elif defined(__linux__)
+				m_hEvent = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#else
+				int fds[2] = { -1, -1 };
+				if (pipe(fds) == 0)
+				{
+					fcntl(fds[0], F_SETFL, O_NONBLOCK);
+					fcntl(fds[1], F_SETFL, O_NONBLOCK);
+				}
+				m_hEvent = fds[0];
+				m_hWrite = fds[1];
+#endif
+			}
+
+			readiness_event(const readiness_event&) = delete;
+			readiness_event& operator=(const readiness_event&) = delete;
+
+			~readiness_event()
+			{
+#ifdef _WIN32
+				if (m_hEvent)
+					CloseHandle(m_hEvent);
+#else
+				if (m_hEvent >= 0)
+					close(m_hEvent);
+#ifndef __linux__
+				if (m_hWrite >= 0)
+					close(m_hWrite);
+#endif
+#endif
+			}
+
+		public:
+			// Signal the event, repeated calls without a reset cost nothing
+			void set()
+			{
+				if (m_bSet)
+					return;
+				m_bSet = true;
+
+#ifdef _WIN32
+				SetEvent(m_hEvent);
+#elif defined(__linux__)
+				uint64_t nValue = 1;
+				ssize_t n = write(m_hEvent, &nValue, sizeof(nValue));
+				(void)n;
+#else
+				uint8_t nValue = 1;
+				ssize_t n = write(m_hWrite, &nValue, sizeof(nValue));
+				(void)n;
+#endif
+			}
+
+			// Clear the event
+			void reset()
+			{
+				if (!m_bSet)
+					return;
+				m_bSet = false;
+
+#ifdef _WIN32
+				ResetEvent(m_hEvent);
+#elif defined(__linux__)
+				uint64_t nValue = 0;
+				ssize_t n = read(m_hEvent, &nValue, sizeof(nValue));
+				(void)n;
+#else
+				uint8_t nValue = 0;
+				ssize_t n = read(m_hEvent, &nValue, sizeof(nValue));
+				(void)n;
+#endif
+			}
+
+			// Handle to wait on, readable/signalled while set
+			native_handle_type native_handle() const
+			{
+				return m_hEvent;
+			}
+
+		private:
+#ifdef _WIN32
+			HANDLE m_hEvent = nullptr;
+#else
+			int m_hEvent = -1;
+#ifndef __linux__
+			int m_hWrite = -1;
+#endif
+#endif
+			// Tracks the state so set() and reset() only make a system call on a change
+			bool m_bSet = false;
+		};
+	}
+}
\ No newline at end of file
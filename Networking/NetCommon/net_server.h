@@ -4,17 +4,35 @@
 #include "net_tsqueue.h"
 #include "net_message.h"
 #include "net_connection.h"
+#include "net_snapshot.h"
+#include "net_interest.h"
+#include "net_outbox.h"
+#include "net_log.h"
 
 namespace asr
 {
 	namespace net
 	{
-		template<typename T>
+		template<typename T, typename Transport = tcp_transport>
 		class server_interface
 		{
+			// Connections settle their session with the server during the handshake
+			friend class connection<T, Transport>;
+
 		public:
+			using socket_type = typename Transport::protocol::socket;
+			using endpoint_type = typename Transport::protocol::endpoint;
+
+			// Listen on a port, for transports with a notion of one
 			server_interface(uint16_t port)
-				: m_asioAcceptor(m_asioContext, asio::ip::tcp::endpoint(asio::ip::tcp::v4(), port))
+				: m_asioAcceptor(m_asioContext, Transport::ListenEndpoint(port))
+			{
+
+			}
+
+			// Listen on any endpoint of the transport, such as a socket path
+			server_interface(const endpoint_type& endpoint)
+				: m_asioAcceptor(m_asioContext, Transport::PrepareListen(endpoint))
 			{
 
 			}
@@ -24,6 +42,16 @@ namespace asr
 				Stop();
 			}
 
+		protected:
+			// No acceptor, connections are handed over with AdoptConnection. Used by shards
+			server_interface()
+				: m_asioAcceptor(m_asioContext)
+			{
+
+			}
+
+		public:
+
 			bool Start()
 			{
 				try
@@ -36,11 +64,11 @@ namespace asr
 				catch (std::exception& e)
 				{
 					// Something prevented the server from listening
-					std::cerr << "[SERVER] Exception: " << e.what() << "\n";
+					ASR_NET_LOG(error, "[SERVER] Exception: ", e.what());
 					return false;
 				}
 
-				std::cout << "[SERVER] Started!\n";
+				ASR_NET_LOG(info, "[SERVER] Started!");
 				return true;
 			}
 
@@ -53,42 +81,56 @@ namespace asr
 				if (m_threadContext.joinable())
 					m_threadContext.join();
 
-				std::cout << "[SERVER] Stopped!\n";
+				ASR_NET_LOG(info, "[SERVER] Stopped!");
+			}
+
+			// Capabilities offered to clients during the handshake, set before Start()
+			void SetCapabilities(uint8_t nCapabilities)
+			{
+				m_nCapabilities = nCapabilities;
+			}
+
+			// Limits applied to every new connection, set before Start()
+			void SetIngressLimits(const ingress_limits& limits)
+			{
+				m_ingressLimits = limits;
+			}
+
+			// Smallest body compressed for clients that negotiate compression, set before Start()
+			void SetCompressionThreshold(size_t nBytes)
+			{
+				m_nCompressionThreshold = nBytes;
+			}
+
+			// How long a lost client with resume negotiated may take to come back before
+			// OnClientDisconnect is called for it
+			void SetSessionGrace(std::chrono::steady_clock::duration tGrace)
+			{
+				m_tSessionGrace = tGrace;
+			}
+
+			// Receive through one io_uring with multishot receives and registered buffers rather
+			// than epoll, set before Start(). Needs ASR_NET_IO_URING defined and Linux 6.0, the
+			// server keeps using epoll otherwise
+			void SetIoUring(bool bEnable)
+			{
+				m_bIoUring = bEnable;
 			}
 
 			// ASYNC - Instruct asio to wait for connection
 			void WaitForClientConnection()
 			{
 				m_asioAcceptor.async_accept(
-					[this](std::error_code ec, asio::ip::tcp::socket socket)
+					[this](std::error_code ec, socket_type socket)
 					{
 						if (!ec)
 						{
-							std::cout << "[SERVER] New Connection: " << socket.remote_endpoint() << "\n";
-
-							std::shared_ptr<connection<T>> newconn =
-								std::make_shared<connection<T>>(connection<T>::owner::server,
-									m_asioContext, std::move(socket), m_qMessagesIn);
-
-							// Give the user a chance to deny connection
-							if (OnClientConnect(newconn))
-							{
-								//Pushes allowed connection to the container of connections
-								m_deqConnections.push_back(std::move(newconn));
-
-								m_deqConnections.back()->ConnectToClient(this, nIDCounter++);
-
-								std::cout << "[" << m_deqConnections.back()->GetID() << "] Connection Approved\n";
-							}
-							else
-							{
-								std::cout << "[-----] Connection Denied!\n";
-							}
+							AdoptConnection(std::move(socket));
 						}
 						else
 						{
 							// Error has occured while accepting connection
-							std::cout << "[SERVER] New Connection Error: " << ec.message() << "\n";
+							ASR_NET_LOG(warn, "[SERVER] New Connection Error: ", ec.message());
 						}
 						
 						// Wait for another connection
@@ -97,31 +139,96 @@ namespace asr
 				);
 			}
 
+		protected:
+			// Wraps a newly accepted socket in a connection and starts its handshake, unless
+			// OnClientConnect turns it away. Must run on this server's asio thread
+			std::shared_ptr<connection<T, Transport>> AdoptConnection(socket_type socket)
+			{
+				ASR_NET_LOG(info, "[SERVER] New Connection: ", socket.remote_endpoint());
+				Transport::ConfigureSocket(socket);
+
+				std::shared_ptr<connection<T, Transport>> newconn =
+					std::make_shared<connection<T, Transport>>(connection<T, Transport>::owner::server,
+						m_asioContext, std::move(socket), m_qMessagesIn);
+
+				// Give the user a chance to deny connection
+				if (!OnClientConnect(newconn))
+				{
+					ASR_NET_LOG(info, "[-----] Connection Denied!");
+					return nullptr;
+				}
+
+				// The container of connections belongs to the thread calling Update, which
+				// takes new ones in before it next looks
+				{
+					std::scoped_lock lock(m_muxAdopted);
+					m_vAdopted.push_back(newconn);
+				}
+				m_bAdopted.store(true, std::memory_order_release);
+
+				newconn->SetCapabilities(m_nCapabilities);
+				newconn->SetIngressLimits(m_ingressLimits);
+				newconn->SetCompressionThreshold(m_nCompressionThreshold);
+#ifdef ASR_NET_HAS_IO_URING
+				if (UseIoUring())
+					newconn->SetUring(m_pUring);
+#else
+				UseIoUring();
+#endif
+				newconn->ConnectToClient(this, NextClientID());
+
+				ASR_NET_LOG(info, "[", newconn->GetID(), "] Connection Approved");
+				return newconn;
+			}
+
+			// Sets up the ring the first time a connection needs it. Falls back to epoll for good
+			// if it can't be had
+			bool UseIoUring()
+			{
+				if (!m_bIoUring)
+					return false;
+
+#ifdef ASR_NET_HAS_IO_URING
+				if (!m_pUring)
+					m_pUring = uring_receiver::Create(m_asioContext);
+				if (m_pUring)
+					return true;
+				ASR_NET_LOG(warn, "[SERVER] io_uring unavailable, using epoll.");
+#else
+				ASR_NET_LOG(warn, "[SERVER] io_uring not built in, define ASR_NET_IO_URING. Using epoll.");
+#endif
+				m_bIoUring = false;
+				return false;
+			}
+
+		public:
 			// Send a message to a client
-			void MessageClient(std::shared_ptr<connection<T>> client, const message<T>& msg)
+			void MessageClient(std::shared_ptr<connection<T, Transport>> client, const message<T>& msg)
 			{
-				if (client && client->IsConnected())
+				if (client && IsReachable(client))
 				{
 					client->Send(msg);
 				}
 				else
 				{
 					// Assume client has disconnected
-					OnClientDisconnect(client);
+					TakeAdopted();
+					ClientGone(client);
 					client.reset();
 					m_deqConnections.erase(
 						std::remove(m_deqConnections.begin(), m_deqConnections.end(), client), m_deqConnections.end());
 				}
 			}
 
-			void MessageAllClients(const message<T>& msg, std::shared_ptr<connection<T>> pIgnoreClient = nullptr)
+			void MessageAllClients(const message<T>& msg, std::shared_ptr<connection<T, Transport>> pIgnoreClient = nullptr)
 			{
 				bool bInvalidClientExists = false;
 
+				TakeAdopted();
 				for (auto& client : m_deqConnections)
 				{
 					// Check if client is connected
-					if (client && client->IsConnected())
+					if (client && IsReachable(client))
 					{
 						if (client != pIgnoreClient)
 						{
@@ -131,7 +238,7 @@ namespace asr
 					else
 					{
 						// Client couldn't be contacted so assume it has disconnected
-						OnClientDisconnect(client);
+						ClientGone(client);
 						client.reset();
 						bInvalidClientExists = true;
 					}
@@ -145,67 +252,524 @@ namespace asr
 				}
 			}
 
-			// Processes up to nMaxMessages messages in the queue, defaults to max size_t
-			void Update(size_t nMaxMessages = -1, bool bWait = false)
+			// Outbox for MessageClientDurable, the server doesn't take ownership
+			void SetOutbox(durable_outbox<T>* pOutbox)
+			{
+				m_pOutbox = pOutbox;
+			}
+
+			// Names a client for durable messages, typically once it has logged in. Anything
+			// stored while it was away is sent straight away
+			void BindClientKey(std::shared_ptr<connection<T, Transport>> client, const std::string& sKey)
 			{
-				if (bWait)
+				if (!client)
+					return;
+
+				m_mapDurableClients[sKey] = client;
+				if (m_pOutbox)
+					m_pOutbox->Replay(sKey, [&](message<T>& msg) { client->Send(std::move(msg)); });
+			}
+
+			// Stores a message in the outbox and sends it if the client is connected. The
+			// message carries its sequence number on the end, which the client pops off and
+			// sends back so the application can call Acknowledge on the outbox.
+			// Returns the sequence number, or 0 if there is no outbox or it couldn't be stored
+			uint64_t MessageClientDurable(const std::string& sKey, message<T> msg)
+			{
+				if (!m_pOutbox)
+					return 0;
+
+				uint64_t nSequence = m_pOutbox->Store(sKey, msg);
+				if (nSequence == 0)
+					return 0;
+
+				auto it = m_mapDurableClients.find(sKey);
+				if (it != m_mapDurableClients.end())
+				{
+					auto client = it->second.lock();
+					if (client && client->IsConnected())
+						client->Send(std::move(msg));
+					else
+						m_mapDurableClients.erase(it);
+				}
+
+				return nSequence;
+			}
+
+			// Sets the cell size used for area of interest queries, ideally around the typical radius
+			void SetInterestCellSize(float fCellSize)
+			{
+				m_gridInterest.SetCellSize(fCellSize);
+			}
+
+			// Records where a client is in the world, cheap enough to call every tick
+			void SetClientPosition(std::shared_ptr<connection<T, Transport>> client, float x, float y)
+			{
+				if (client)
+					m_gridInterest.Update(client->GetID(), client, x, y);
+			}
+
+			// Send a message to every positioned client within fRadius of (x, y)
+			void MessageNearby(float x, float y, float fRadius, const message<T>& msg, std::shared_ptr<connection<T, Transport>> pIgnoreClient = nullptr)
+			{
+				bool bInvalidClientExists = false;
+
+				m_gridInterest.Query(x, y, fRadius,
+					[&](uint32_t nID, const std::shared_ptr<connection<T, Transport>>& client)
+					{
+						if (IsReachable(client))
+						{
+							if (client != pIgnoreClient)
+								client->Send(msg);
+						}
+						else
+						{
+							bInvalidClientExists = true;
+						}
+					}
+				);
+
+				// Removes all invalid clients, the grid can't be changed while it is being queried
+				if (bInvalidClientExists)
+				{
+					TakeAdopted();
+					for (auto& client : m_deqConnections)
+					{
+						if (client && !IsReachable(client))
+						{
+							ClientGone(client);
+							client.reset();
+						}
+					}
+
+					m_deqConnections.erase(
+						std::remove(m_deqConnections.begin(), m_deqConnections.end(), nullptr), m_deqConnections.end());
+				}
+			}
+
+			// Sends the latest snapshot to every client as a delta against the last one it
+			// acknowledged. Clients sharing a baseline share one encoded message
+			void BroadcastSnapshot(snapshot_sender<T>& sync)
+			{
+				if (!sync.HasState())
+					return;
+
+				bool bInvalidClientExists = false;
+
+				TakeAdopted();
+				for (auto& client : m_deqConnections)
+				{
+					// Check if client is connected
+					if (client && IsReachable(client))
+					{
+						client->Send(sync.MessageFor(client->GetID()));
+					}
+					else
+					{
+						// Client couldn't be contacted so assume it has disconnected. A resumed
+						// client keeps the baseline of the connection it replaced
+						if (ClientGone(client))
+							sync.Forget(client->GetID());
+						client.reset();
+						bInvalidClientExists = true;
+					}
+				}
+
+				// Removes all invalid clients
+				if (bInvalidClientExists)
+				{
+					m_deqConnections.erase(
+						std::remove(m_deqConnections.begin(), m_deqConnections.end(), nullptr), m_deqConnections.end());
+				}
+			}
+
+			// Processes up to nMaxMessages messages in the queue, defaults to max size_t.
+			// Returns the number of messages handled. Messages left over from an earlier
+			// capped Update count as waiting, so they never block
+			size_t Update(size_t nMaxMessages = -1, bool bWait = false)
+			{
+				if (bWait && m_deqReady.empty())
 					m_qMessagesIn.wait();
 
-				size_t nMessageCount = 0;
-				while (nMessageCount < nMaxMessages && !m_qMessagesIn.empty())
+				return ProcessMessages(nMaxMessages);
+			}
+
+			// As Update, but waits at most timeout for a message to arrive
+			template <typename Rep, typename Period>
+			size_t UpdateFor(const std::chrono::duration<Rep, Period>& timeout, size_t nMaxMessages = -1)
+			{
+				if (m_deqReady.empty())
+					m_qMessagesIn.wait_for(timeout);
+				return ProcessMessages(nMaxMessages);
+			}
+
+			// As Update, but waits until at most deadline for a message to arrive
+			template <typename Clock, typename Duration>
+			size_t UpdateUntil(const std::chrono::time_point<Clock, Duration>& deadline, size_t nMaxMessages = -1)
+			{
+				if (m_deqReady.empty())
+					m_qMessagesIn.wait_until(deadline);
+				return ProcessMessages(nMaxMessages);
+			}
+
+			// OS handle signalled while messages are waiting, so Update can be driven from
+			// an external epoll/select/WaitForMultipleObjects loop
+			readiness_event::native_handle_type IncomingReadiness()
+			{
+				return m_qMessagesIn.readiness();
+			}
+
+		private:
+			// Update thread. Takes in the connections accepted since the last call
+			void TakeAdopted()
+			{
+				if (!m_bAdopted.exchange(false, std::memory_order_acquire))
+					return;
+
+				std::scoped_lock lock(m_muxAdopted);
+				for (auto& client : m_vAdopted)
+					m_deqConnections.push_back(std::move(client));
+				m_vAdopted.clear();
+			}
+
+			// Connected, or lost but with a session it may still resume. Messages sent in
+			// the meantime wait on the connection and are carried over if it comes back
+			bool IsReachable(const std::shared_ptr<connection<T, Transport>>& client)
+			{
+				if (client->IsConnected())
+					return true;
+
+				uint64_t nToken = client->SessionToken();
+				if (nToken == 0)
+					return false;
+
+				std::scoped_lock lock(m_muxSessions);
+				auto it = m_mapSessions.find(nToken);
+				if (it == m_mapSessions.end() || it->second.client != client)
+					return false;
+
+				// The grace period starts when the loss is first noticed
+				if (!it->second.bLost)
+				{
+					it->second.bLost = true;
+					it->second.tLost = std::chrono::steady_clock::now();
+				}
+				return true;
+			}
+
+			// Deals with a connection that won't be back. Returns false if it was replaced by a
+			// resumed connection with the same ID, which the application was told about instead
+			bool ClientGone(const std::shared_ptr<connection<T, Transport>>& client)
+			{
+				if (client && client->IsSuperseded())
+				{
+					m_gridInterest.Remove(client->GetID());
+					UntrackClient(client);
+					return false;
+				}
+
+				OnClientDisconnect(client);
+				if (client)
+				{
+					m_gridInterest.Remove(client->GetID());
+					UntrackClient(client);
+				}
+				return true;
+			}
+
+			// Called by the connection once its handshake is done and its ID is final
+			void ClientReady(const std::shared_ptr<connection<T, Transport>>& client, bool bResumed)
+			{
+				TrackClient(client);
+				if (bResumed)
+					OnClientResumed(client);
+				else
+					OnClientValidated(client);
+			}
+
+			// Sessions of clients that didn't come back in time are dropped, the clients
+			// themselves are noticed as gone the next time they are messaged
+			void ExpireSessions()
+			{
+				auto tNow = std::chrono::steady_clock::now();
+				if (tNow < m_tNextSessionSweep)
+					return;
+				m_tNextSessionSweep = tNow + std::chrono::seconds(1);
+
+				std::scoped_lock lock(m_muxSessions);
+				for (auto it = m_mapSessions.begin(); it != m_mapSessions.end();)
+				{
+					if (it->second.bLost && tNow - it->second.tLost >= m_tSessionGrace)
+						it = m_mapSessions.erase(it);
+					else
+						++it;
+				}
+			}
+
+			// Once a second, gives back the queue storage of connections left alone since the
+			// sweep before. Queues the asio thread owns are trimmed there, in one go
+			void TrimIdleConnections()
+			{
+				auto tNow = std::chrono::steady_clock::now();
+				if (tNow < m_tNextTrimSweep)
+					return;
+				m_tNextTrimSweep = tNow + std::chrono::seconds(1);
+
+				TakeAdopted();
+				std::vector<std::shared_ptr<connection<T, Transport>>> vClients;
+				vClients.reserve(m_deqConnections.size());
+				for (auto& client : m_deqConnections)
+				{
+					if (!client)
+						continue;
+
+					client->m_deqPendingIn.trim();
+					vClients.push_back(client);
+				}
+
+				asio::post(m_asioContext,
+					[vClients = std::move(vClients)]()
+					{
+						for (auto& client : vClients)
+							client->TrimIdle();
+					}
+				);
+			}
+
+			// Asio thread, during the handshake of a client that negotiated resume. Gives the
+			// connection the session it asked for if it is still held and has everything the
+			// client is missing, otherwise a new one. Returns true if resumed
+			bool OnSessionRequest(std::shared_ptr<connection<T, Transport>> client, const session::handshake& request)
+			{
+				std::scoped_lock lock(m_muxSessions);
+				std::deque<message<T>> deqReplay;
+
+				auto it = request.nToken != 0 ? m_mapSessions.find(request.nToken) : m_mapSessions.end();
+				if (it != m_mapSessions.end() && it->second.pState->Secret() == request.nSecret
+					&& it->second.pState->CanResume(request.nReceived))
 				{
-					// Take the front message
-					auto msg = m_qMessagesIn.pop_front();
+					resumable& r = it->second;
+
+					// The old connection may not have noticed it is dead yet. Anything it still
+					// had queued goes back to the session, and anything sent to it from now on
+					// is passed along
+					if (r.client && r.client != client)
+						r.client->DetachSession(client);
+
+					r.client = client;
+					r.bLost = false;
+					r.pState->Resume(request.nReceived, deqReplay);
+
+					client->id = r.pState->ClientID();
+					client->AttachSession(r.pState, true, deqReplay);
+					return true;
+				}
+
+				uint64_t nToken = 0;
+				while (nToken == 0 || m_mapSessions.count(nToken))
+					nToken = RandomToken();
+
+				auto pState = std::make_shared<session::state<T>>();
+				pState->Restart(nToken, RandomToken(), deqReplay);
+				pState->SetClientID(client->GetID());
+
+				resumable& r = m_mapSessions[nToken];
+				r.pState = pState;
+				r.client = client;
+				client->AttachSession(pState, false, deqReplay);
+				return false;
+			}
+
+			// Asio thread, once a connection carrying a session has failed. Starts the grace
+			// period now rather than whenever the client is next messaged
+			void SessionLost(const std::shared_ptr<connection<T, Transport>>& client)
+			{
+				std::scoped_lock lock(m_muxSessions);
+				auto it = m_mapSessions.find(client->SessionToken());
+				if (it != m_mapSessions.end() && it->second.client == client && !it->second.bLost)
+				{
+					it->second.bLost = true;
+					it->second.tLost = std::chrono::steady_clock::now();
+				}
+			}
 
-					// Handle the message
-					OnMessage(msg.remote, msg.msg);
+			// Anyone holding a token and secret can take the session over, so both come from
+			// the OS rather than a generator whose output can be predicted. Called under m_muxSessions
+			uint64_t RandomToken()
+			{
+				return (uint64_t(m_rdTokens()) << 32) | m_rdTokens();
+			}
+
+			// Takes everything waiting in one go, then hands messages to OnMessage one
+			// connection at a time so a busy client can't starve the others
+			size_t ProcessMessages(size_t nMaxMessages)
+			{
+				ExpireSessions();
+				TrimIdleConnections();
+				m_qMessagesIn.pop_batch(m_deqBatch);
 
+				// Stage messages on their connection, queueing connections that have work
+				for (auto& msg : m_deqBatch)
+				{
+					if (msg.remote->m_deqPendingIn.empty())
+						m_deqReady.push_back(msg.remote);
+					msg.remote->m_deqPendingIn.push_back(std::move(msg.msg));
+				}
+				m_deqBatch.clear();
+
+				size_t nMessageCount = 0;
+				while (nMessageCount < nMaxMessages && !m_deqReady.empty())
+				{
+					// Take one message from the connection at the front of the line
+					std::shared_ptr<connection<T, Transport>> client = std::move(m_deqReady.front());
+					m_deqReady.pop_front();
+
+					message<T> msg = std::move(client->m_deqPendingIn.front());
+					client->m_deqPendingIn.pop_front();
+					ASR_NET_TRACE_EVENT(dequeue, client->GetID());
+
+					// Back of the line if it has more
+					if (!client->m_deqPendingIn.empty())
+						m_deqReady.push_back(client);
+
+					ASR_NET_TRACE_EVENT(handler_begin, client->GetID());
+					if (!InterceptMessage(client, msg))
+						OnMessage(client, msg);
+					ASR_NET_TRACE_EVENT(handler_end, client->GetID());
 					nMessageCount++;
 				}
+
+				// Staged messages left by nMaxMessages keep IncomingReadiness signalled
+				m_qMessagesIn.hold(!m_deqReady.empty());
+
+				return nMessageCount;
 			}
 
 		protected:
 			// Called when a client connects, return false to reject connection
-			virtual bool OnClientConnect(std::shared_ptr<connection<T>> client)
+			virtual bool OnClientConnect(std::shared_ptr<connection<T, Transport>> client)
 			{
 				return false;
 			}
 
 			// Called when a client has disconnected
-			virtual void OnClientDisconnect(std::shared_ptr<connection<T>> client)
+			virtual void OnClientDisconnect(std::shared_ptr<connection<T, Transport>> client)
 			{
 
 			}
 
 			// Called when a message arrives
-			virtual void OnMessage(std::shared_ptr<connection<T>> client, message<T>& msg)
+			virtual void OnMessage(std::shared_ptr<connection<T, Transport>> client, message<T>& msg)
 			{
 
 			}
 
+			// Lets a derived server take messages meant for it rather than the application,
+			// return true to keep msg from OnMessage
+			virtual bool InterceptMessage(std::shared_ptr<connection<T, Transport>> client, message<T>& msg)
+			{
+				return false;
+			}
+
+			// Let a derived server keep its own lookup of clients by ID. TrackClient is called on the
+			// asio thread once a client is validated or resumed, UntrackClient once it is gone. A
+			// resumed client is tracked under its old ID before the connection it replaced is untracked
+			virtual void TrackClient(const std::shared_ptr<connection<T, Transport>>& client)
+			{
+
+			}
+
+			virtual void UntrackClient(const std::shared_ptr<connection<T, Transport>>& client)
+			{
+
+			}
+
+			// ID for the next client to connect
+			virtual uint32_t NextClientID()
+			{
+				return nIDCounter++;
+			}
+
 		public:
 			// called when a client is validated
-			virtual void OnClientValidated(std::shared_ptr<connection<T>> client)
+			virtual void OnClientValidated(std::shared_ptr<connection<T, Transport>> client)
 			{
 
 			}
 
-		protected:
-			// Thread Safe Queue for incoming messages
-			tsqueue<owned_message<T>> m_qMessagesIn;
+			// Called instead of OnClientValidated when a client picks its session back up.
+			// It has its old ID, and anything it missed is sent before new messages
+			virtual void OnClientResumed(std::shared_ptr<connection<T, Transport>> client)
+			{
 
-			// Container of activate validated connections
-			std::deque<std::shared_ptr<connection<T>>> m_deqConnections;
+			}
 
-			// ASIO Context and thread
+		protected:
+			// ASIO Context and thread. Declared first so it outlives the connections, whose
+			// sockets and timers belong to it
 			asio::io_context m_asioContext;
 			std::thread m_threadContext;
 
+			// Thread Safe Queue for incoming messages
+			tsqueue<owned_message<T, Transport>> m_qMessagesIn;
+
+			// Batch of messages currently being handled by Update
+			std::deque<owned_message<T, Transport>> m_deqBatch;
+
+			// Connections with staged messages, in round-robin order
+			std::deque<std::shared_ptr<connection<T, Transport>>> m_deqReady;
+
+			// Container of activate validated connections, only touched by the thread calling Update
+			std::deque<std::shared_ptr<connection<T, Transport>>> m_deqConnections;
+
+			// Connections accepted on the asio thread, waiting for TakeAdopted
+			std::vector<std::shared_ptr<connection<T, Transport>>> m_vAdopted;
+			std::mutex m_muxAdopted;
+			std::atomic<bool> m_bAdopted{ false };
+
 			// These things need an asio context
-			asio::ip::tcp::acceptor m_asioAcceptor;
+			typename Transport::protocol::acceptor m_asioAcceptor;
+
+			// Whether connections should receive through io_uring, and the ring they share
+			bool m_bIoUring = false;
+#ifdef ASR_NET_HAS_IO_URING
+			std::shared_ptr<uring_receiver> m_pUring;
+#endif
 
 			// Clients will be identified via an ID
 			uint32_t nIDCounter = 10000;
+
+			// Wire capabilities offered to every new connection
+			uint8_t m_nCapabilities = wire::compact_header;
+
+			// Ingress limits applied to every new connection
+			ingress_limits m_ingressLimits;
+			size_t m_nCompressionThreshold = connection<T, Transport>::DefaultCompressionThreshold;
+
+			// Store-and-forward for clients that may be away, and who they are when connected
+			durable_outbox<T>* m_pOutbox = nullptr;
+			std::unordered_map<std::string, std::weak_ptr<connection<T, Transport>>> m_mapDurableClients;
+
+			// Positions of clients for area of interest fan out
+			interest_grid<std::shared_ptr<connection<T, Transport>>> m_gridInterest;
+
+		private:
+			// A session and the connection currently carrying it, or that last did
+			struct resumable
+			{
+				std::shared_ptr<session::state<T>> pState;
+				std::shared_ptr<connection<T, Transport>> client;
+				std::chrono::steady_clock::time_point tLost;
+				bool bLost = false;
+			};
+
+			// Sessions by token. Shared between the asio thread and the one calling Update
+			std::unordered_map<uint64_t, resumable> m_mapSessions;
+			std::mutex m_muxSessions;
+			std::random_device m_rdTokens;
+			std::chrono::steady_clock::duration m_tSessionGrace = std::chrono::seconds(30);
+			std::chrono::steady_clock::time_point m_tNextSessionSweep;
+			std::chrono::steady_clock::time_point m_tNextTrimSweep;
 		};
 	}
 }
\ No newline at end of file
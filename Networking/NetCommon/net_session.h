@@ -0,0 +1,223 @@
+#pragma once
+#include "net_common.h"
+#include "net_buffer.h"
+#include "net_message.h"
+#include "net_wire.h"
+
+namespace asr
+{
+	namespace net
+	{
+		namespace session
+		{
+			// Sent messages kept for replay until the remote acknowledges them. A session
+			// that falls further behind than this can no longer be resumed
+			constexpr size_t MaxUnackedMessages = 8192;
+			constexpr size_t MaxUnackedBytes = 4 * 1024 * 1024;
+
+			// Acknowledge after this many messages, or this long after the first unacknowledged one
+			constexpr uint64_t AckEvery = 32;
+			constexpr std::chrono::milliseconds AckInterval{ 100 };
+
+			// Shares the control id with timesync, so carries on its numbering
+			enum class kind : uint8_t
+			{
+				ack = 3
+			};
+
+			// Body is [received][kind]
+			constexpr size_t BodySize = sizeof(uint64_t) + sizeof(uint8_t);
+
+			template <typename T>
+			message<T> MakeAck(uint64_t nReceived)
+			{
+				message<T> msg;
+				msg.header.id = wire::ControlId<T>;
+				msg << nReceived << uint8_t(kind::ack);
+				return msg;
+			}
+
+			// Sent by the client straight after validation, and answered by the server.
+			// A token of 0 asks for a new session. The token names the session and the secret
+			// proves the client owns it, both are drawn from the OS's random source
+			struct handshake
+			{
+				uint64_t nToken = 0;
+				uint64_t nSecret = 0;
+				uint64_t nReceived = 0;
+			};
+
+			// Everything needed to pick a connection up where it left off. Counts are of
+			// application messages only, control messages are never replayed. Only touched
+			// from the asio thread of whichever connection currently holds it
+			template <typename T>
+			class state
+			{
+			public:
+				state()
+				{
+					LiveCount().fetch_add(1, std::memory_order_relaxed);
+				}
+
+				~state()
+				{
+					LiveCount().fetch_sub(1, std::memory_order_relaxed);
+				}
+
+				state(const state&) = delete;
+				state& operator = (const state&) = delete;
+
+				// Sessions alive in the process, for connection::GetFootprintPerConnection
+				static std::atomic<size_t>& LiveCount()
+				{
+					static std::atomic<size_t> nLive{ 0 };
+					return nLive;
+				}
+
+				uint64_t Token() const
+				{
+					return m_nToken;
+				}
+
+				uint64_t Secret() const
+				{
+					return m_nSecret;
+				}
+
+				uint64_t Received() const
+				{
+					return m_nReceived;
+				}
+
+				// Server side, the ID the client keeps across connections
+				uint32_t ClientID() const
+				{
+					return m_nClientID;
+				}
+
+				void SetClientID(uint32_t nID)
+				{
+					m_nClientID = nID;
+				}
+
+				// A message was handed to the application
+				void OnReceived()
+				{
+					m_nReceived++;
+				}
+
+				// A message was written in full, keep it until the remote has it
+				void OnSent(message<T>&& msg)
+				{
+					m_nSent++;
+					if (m_bBroken)
+						return;
+
+					m_nUnackedBytes += msg.size();
+					m_deqUnacked.push_back(std::move(msg));
+
+					// Too far behind to replay, give up on resuming rather than grow without bound
+					if (m_deqUnacked.size() > MaxUnackedMessages || m_nUnackedBytes > MaxUnackedBytes)
+					{
+						m_bBroken = true;
+						m_deqUnacked.clear();
+						m_nUnackedBytes = 0;
+					}
+				}
+
+				// The remote has the first nReceived messages
+				void Acknowledge(uint64_t nReceived)
+				{
+					nReceived = std::min(nReceived, m_nSent);
+					while (m_nAcked < nReceived && !m_deqUnacked.empty())
+					{
+						m_nUnackedBytes -= m_deqUnacked.front().size();
+						m_deqUnacked.pop_front();
+						m_nAcked++;
+					}
+					m_nAcked = std::max(m_nAcked, nReceived);
+				}
+
+				// Messages that never made it out of a dead connection, in order
+				void Carry(message<T>&& msg)
+				{
+					m_deqUnsent.push_back(std::move(msg));
+				}
+
+				// True if everything after the remote's first nReceived messages is still here
+				bool CanResume(uint64_t nReceived) const
+				{
+					return !m_bBroken && nReceived >= m_nAcked && nReceived <= m_nSent + m_deqUnsent.size();
+				}
+
+				// Moves everything the remote is missing into deqOut, in the order it was sent
+				void Resume(uint64_t nReceived, std::deque<message<T>>& deqOut)
+				{
+					Acknowledge(nReceived);
+
+					// Written in full though the write never reported back, the remote has these too
+					while (m_nAcked < nReceived && !m_deqUnsent.empty())
+					{
+						m_deqUnsent.pop_front();
+						m_nAcked++;
+					}
+
+					for (auto& msg : m_deqUnacked)
+						deqOut.push_back(std::move(msg));
+					for (auto& msg : m_deqUnsent)
+						deqOut.push_back(std::move(msg));
+
+					// Replayed messages are counted again as they go out
+					m_deqUnacked.clear();
+					m_deqUnsent.clear();
+					m_nUnackedBytes = 0;
+					m_nSent = m_nAcked;
+				}
+
+				// Starts over under a new token. Whether anything unacknowledged arrived can't be
+				// known, so it is dropped, messages that never went out are moved into deqOut
+				void Restart(uint64_t nToken, uint64_t nSecret, std::deque<message<T>>& deqOut)
+				{
+					for (auto& msg : m_deqUnsent)
+						deqOut.push_back(std::move(msg));
+
+					m_deqUnacked.clear();
+					m_deqUnsent.clear();
+					m_nUnackedBytes = 0;
+					m_nToken = nToken;
+					m_nSecret = nSecret;
+					m_nSent = 0;
+					m_nAcked = 0;
+					m_nReceived = 0;
+					m_bBroken = false;
+				}
+
+				// Gives back the storage of replay queues left empty since the last call
+				void Trim()
+				{
+					m_deqUnacked.trim();
+					m_deqUnsent.trim();
+				}
+
+			private:
+				uint64_t m_nToken = 0;
+				uint64_t m_nSecret = 0;
+				uint32_t m_nClientID = 0;
+
+				// Messages written, acknowledged by the remote, and received from it
+				uint64_t m_nSent = 0;
+				uint64_t m_nAcked = 0;
+				uint64_t m_nReceived = 0;
+
+				// Messages m_nAcked + 1 to m_nSent, unless the session is broken
+				lazy_deque<message<T>> m_deqUnacked;
+				size_t m_nUnackedBytes = 0;
+
+				// Messages queued on a connection that died before writing them
+				lazy_deque<message<T>> m_deqUnsent;
+
+				bool m_bBroken = false;
+			};
+		}
+	}
+}
\ No newline at end of file
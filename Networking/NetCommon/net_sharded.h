@@ -0,0 +1,382 @@
+#pragma once
+#include "net_common.h"
+#include "net_message.h"
+#include "net_mpsc.h"
+#include "net_server.h"
+#include "net_log.h"
+
+#if defined(_WIN32)
+	#include <windows.h>
+#elif defined(__linux__)
+	#include <pthread.h>
+	#include <sched.h>
+#endif
+
+namespace asr
+{
+	namespace net
+	{
+		// Pins a thread to one core, returns false where that isn't supported
+		inline bool PinThreadToCore(std::thread& thread, size_t nCore)
+		{
+#if defined(_WIN32)
+			return SetThreadAffinityMask(thread.native_handle(), DWORD_PTR(1) << (nCore % (sizeof(DWORD_PTR) * 8))) != 0;
+#elif defined(__linux__)
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			CPU_SET(nCore % CPU_SETSIZE, &set);
+			return pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) == 0;
+#else
+			return false;
+#endif
+		}
+
+		template <typename Shard>
+		class sharded_server;
+
+		// One core's share of a sharded_server. Owns its asio context, connections, incoming
+		// queue and handler loop, all run by a single thread, so nothing is shared with other
+		// shards. Derive from this and override OnMessage etc. as with server_interface.
+		// Other shards are only reached through their mailboxes
+		template <typename T, typename Transport = tcp_transport>
+		class server_shard : public server_interface<T, Transport>
+		{
+			template <typename Shard>
+			friend class sharded_server;
+
+		public:
+			using id_type = T;
+			using transport_type = Transport;
+
+			// Client IDs carry their shard in the top byte and a per shard count in the rest
+			static constexpr size_t MaxShards = 256;
+			static constexpr uint32_t ShardShift = 24;
+			static constexpr uint32_t FirstLocalID = 10000;
+			static constexpr uint32_t LocalIDLimit = uint32_t(1) << ShardShift;
+
+			server_shard()
+			{
+
+			}
+
+		public:
+			size_t ShardIndex() const
+			{
+				return m_nIndex;
+			}
+
+			size_t ShardCount() const
+			{
+				return m_pShards ? m_pShards->size() : 1;
+			}
+
+			// Shard a client lives on, read from the top byte of its ID
+			static size_t ShardOf(uint32_t nClientID)
+			{
+				return nClientID >> ShardShift;
+			}
+
+			// Sends to a client wherever it lives. Call from this shard's thread
+			void MessageClientByID(uint32_t nClientID, message<T> msg)
+			{
+				size_t nShard = ShardOf(nClientID);
+				if (nShard == m_nIndex)
+					SendLocal(nClientID, msg);
+				else if (m_pShards && nShard < m_pShards->size())
+					(*m_pShards)[nShard]->Post({ mail::kind::client, m_nIndex, nClientID, std::move(msg) });
+			}
+
+			// Sends to every client on every shard. Call from this shard's thread
+			void MessageAllShards(const message<T>& msg)
+			{
+				this->MessageAllClients(msg);
+				ForEachOtherShard([&](server_shard& shard) { shard.Post({ mail::kind::broadcast, m_nIndex, 0, msg }); });
+			}
+
+			// Hands a message to another shard's OnShardMessage. Call from this shard's thread
+			void MessageShard(size_t nShard, message<T> msg)
+			{
+				if (m_pShards && nShard < m_pShards->size())
+					(*m_pShards)[nShard]->Post({ mail::kind::shard, m_nIndex, 0, std::move(msg) });
+			}
+
+		protected:
+			// Called on this shard's thread for messages sent with MessageShard
+			virtual void OnShardMessage(size_t nFromShard, message<T>& msg)
+			{
+
+			}
+
+			// The count wraps within this shard's 24 bits, skipping IDs still in use, rather
+			// than running on into the next shard's
+			uint32_t NextClientID() override
+			{
+				uint32_t nID = 0;
+				do
+				{
+					nID = (uint32_t(m_nIndex) << ShardShift) | m_nNextLocalID;
+					m_nNextLocalID = m_nNextLocalID + 1 < LocalIDLimit ? m_nNextLocalID + 1 : FirstLocalID;
+				} while (m_mapClients.count(nID));
+				return nID;
+			}
+
+			// The asio thread is this shard's thread, so the lookup needs no lock
+			void TrackClient(const std::shared_ptr<connection<T, Transport>>& client) override
+			{
+				m_mapClients[client->GetID()] = client;
+			}
+
+			// Only if the entry is still this connection's, a resumed one may have taken the ID over
+			void UntrackClient(const std::shared_ptr<connection<T, Transport>>& client) override
+			{
+				auto it = m_mapClients.find(client->GetID());
+				if (it == m_mapClients.end())
+					return;
+
+				auto tracked = it->second.lock();
+				if (!tracked || tracked == client)
+					m_mapClients.erase(it);
+			}
+
+		private:
+			struct mail
+			{
+				enum class kind : uint8_t
+				{
+					client,
+					broadcast,
+					shard
+				};
+
+				kind nKind = kind::client;
+				size_t nFrom = 0;
+				uint32_t nClientID = 0;
+				message<T> msg;
+			};
+
+			template <typename F>
+			void ForEachOtherShard(F&& f)
+			{
+				if (!m_pShards)
+					return;
+
+				for (auto& pShard : *m_pShards)
+					if (pShard.get() != this)
+						f(*pShard);
+			}
+
+			// Any thread. The shard is only woken when its mailbox goes from empty to not
+			void Post(mail m)
+			{
+				m_qMailbox.push(std::move(m));
+				if (!m_bMailPosted.exchange(true, std::memory_order_acq_rel))
+					asio::post(this->m_asioContext, []() {});
+			}
+
+			void DrainMailbox()
+			{
+				m_bMailPosted.exchange(false, std::memory_order_acq_rel);
+
+				mail m;
+				while (m_qMailbox.pop(m))
+				{
+					switch (m.nKind)
+					{
+					case mail::kind::client:
+						SendLocal(m.nClientID, m.msg);
+						break;
+					case mail::kind::broadcast:
+						this->MessageAllClients(m.msg);
+						break;
+					case mail::kind::shard:
+						OnShardMessage(m.nFrom, m.msg);
+						break;
+					}
+				}
+			}
+
+			void SendLocal(uint32_t nClientID, const message<T>& msg)
+			{
+				auto it = m_mapClients.find(nClientID);
+				if (it == m_mapClients.end())
+					return;
+
+				auto client = it->second.lock();
+				if (!client)
+				{
+					m_mapClients.erase(it);
+					return;
+				}
+
+				this->MessageClient(client, msg);
+			}
+
+			// Runs on the shard's own thread, called by sharded_server
+			void Adopt(typename server_interface<T, Transport>::socket_type socket)
+			{
+				this->AdoptConnection(std::move(socket));
+			}
+
+			void Run(const std::atomic<bool>& bStop)
+			{
+				auto work = asio::make_work_guard(this->m_asioContext);
+
+				while (!bStop.load(std::memory_order_acquire))
+				{
+					// Sleeps until there is network work or mail, then handles everything ready
+					this->m_asioContext.run_one_for(std::chrono::milliseconds(100));
+					this->m_asioContext.poll();
+
+					DrainMailbox();
+					this->Update(-1, false);
+				}
+			}
+
+		private:
+			size_t m_nIndex = 0;
+			std::vector<std::unique_ptr<server_shard>>* m_pShards = nullptr;
+			uint32_t m_nNextLocalID = FirstLocalID;
+
+			// Validated clients of this shard by ID, for sends arriving from other shards
+			std::unordered_map<uint32_t, std::weak_ptr<connection<T, Transport>>> m_mapClients;
+
+			mpsc_queue<mail> m_qMailbox;
+			std::atomic<bool> m_bMailPosted{ false };
+		};
+
+		// Thread per core server. A single acceptor deals new connections to the shards in
+		// turn, after which each connection is only ever touched by its shard's thread
+		template <typename Shard>
+		class sharded_server
+		{
+		public:
+			using T = typename Shard::id_type;
+			using Transport = typename Shard::transport_type;
+
+			// nShards of 0 means one per hardware thread
+			sharded_server(uint16_t port, size_t nShards = 0, bool bPinThreads = true)
+				: m_asioAcceptor(m_asioContext, Transport::ListenEndpoint(port)), m_bPinThreads(bPinThreads)
+			{
+				if (nShards == 0)
+					nShards = std::max(1u, std::thread::hardware_concurrency());
+
+				// The top byte of every client ID names its shard, so there can't be more than it can hold
+				if (nShards > Shard::MaxShards)
+				{
+					ASR_NET_LOG(warn, "[SERVER] ", nShards, " shards asked for, client IDs only allow ", Shard::MaxShards);
+					nShards = Shard::MaxShards;
+				}
+
+				for (size_t i = 0; i < nShards; i++)
+				{
+					m_vShards.push_back(std::make_unique<Shard>());
+					m_vShards.back()->m_nIndex = i;
+					m_vShards.back()->m_pShards = &m_vShards;
+				}
+			}
+
+			virtual ~sharded_server()
+			{
+				Stop();
+			}
+
+		public:
+			// Configure shards before Start()
+			Shard& GetShard(size_t i)
+			{
+				return static_cast<Shard&>(*m_vShards[i]);
+			}
+
+			size_t ShardCount() const
+			{
+				return m_vShards.size();
+			}
+
+			bool Start()
+			{
+				try
+				{
+					WaitForClientConnection();
+					m_threadContext = std::thread([this]() { m_asioContext.run(); });
+				}
+				catch (std::exception& e)
+				{
+					ASR_NET_LOG(error, "[SERVER] Exception: ", e.what());
+					return false;
+				}
+
+				m_bStop = false;
+				for (size_t i = 0; i < m_vShards.size(); i++)
+				{
+					server_shard<T, Transport>* pShard = m_vShards[i].get();
+					m_vThreads.emplace_back([this, pShard]() { pShard->Run(m_bStop); });
+
+					if (m_bPinThreads)
+						PinThreadToCore(m_vThreads.back(), i);
+				}
+
+				ASR_NET_LOG(info, "[SERVER] Started with ", m_vShards.size(), " shards!");
+				return true;
+			}
+
+			void Stop()
+			{
+				m_asioContext.stop();
+				if (m_threadContext.joinable())
+					m_threadContext.join();
+
+				// Wake every shard so it sees the flag
+				m_bStop = true;
+				for (auto& pShard : m_vShards)
+					asio::post(pShard->m_asioContext, []() {});
+
+				for (auto& thread : m_vThreads)
+					thread.join();
+				m_vThreads.clear();
+
+				for (auto& pShard : m_vShards)
+					pShard->Stop();
+			}
+
+		private:
+			void WaitForClientConnection()
+			{
+				// Accept straight onto the next shard's context, so the socket never changes hands
+				server_shard<T, Transport>* pShard = m_vShards[m_nNextShard].get();
+				m_nNextShard = (m_nNextShard + 1) % m_vShards.size();
+
+				m_asioAcceptor.async_accept(pShard->m_asioContext,
+					[this, pShard](std::error_code ec, typename Shard::socket_type socket)
+					{
+						if (!ec)
+						{
+							asio::post(pShard->m_asioContext,
+								[pShard, socket = std::move(socket)]() mutable
+								{
+									pShard->Adopt(std::move(socket));
+								}
+							);
+						}
+						else
+						{
+							ASR_NET_LOG(warn, "[SERVER] New Connection Error: ", ec.message());
+						}
+
+						WaitForClientConnection();
+					}
+				);
+			}
+
+		private:
+			asio::io_context m_asioContext;
+			std::thread m_threadContext;
+			typename Transport::protocol::acceptor m_asioAcceptor;
+
+			std::vector<std::unique_ptr<server_shard<T, Transport>>> m_vShards;
+			std::vector<std::thread> m_vThreads;
+			std::atomic<bool> m_bStop{ false };
+			size_t m_nNextShard = 0;
+			bool m_bPinThreads = true;
+		};
+	}
+}
\ No newline at end of file
@@ -0,0 +1,673 @@
+#pragma once
+#include "net_common.h"
+#include "net_message.h"
+#include "net_log.h"
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(_M_IX86) || defined(__i386__)
+	#include <immintrin.h>
+#endif
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <signal.h>
+	#include <cerrno>
+	#ifdef __linux__
+		#include <linux/futex.h>
+		#include <sys/syscall.h>
+		#include <climits>
+	#endif
+#endif
+
+namespace asr
+{
+	namespace net
+	{
+		namespace shm
+		{
+			static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free,
+				"Shared memory rings need address free atomics");
+
+			// Identifies a segment laid out by this version of the code
+			constexpr uint64_t SegmentMagic = 0x3230474E49524E41;
+
+			// Longest Send waits for the peer to make room by default
+			constexpr std::chrono::milliseconds DefaultSendTimeout{ 5000 };
+
+			// Control block for one direction. Producer and consumer state live on separate
+			// cache lines so the two processes don't fight over them
+			struct ring_control
+			{
+				// Total bytes ever written, only the producer stores it
+				alignas(64) std::atomic<uint64_t> nHead;
+				// Bumped when the consumer is asleep waiting for data
+				std::atomic<uint32_t> nDataSignal;
+				std::atomic<uint32_t> nConsumerWaiting;
+
+				// Total bytes ever read, only the consumer stores it
+				alignas(64) std::atomic<uint64_t> nTail;
+				// Bumped when the producer is asleep waiting for space
+				std::atomic<uint32_t> nSpaceSignal;
+				std::atomic<uint32_t> nProducerWaiting;
+			};
+
+			// Polls before going to sleep, a message usually turns up within a microsecond
+			// when the peer is busy and that is far cheaper than a futex round trip.
+			// Pointless on a single core, where spinning only delays the peer
+			inline int SpinCount()
+			{
+				static const int nSpin = std::thread::hardware_concurrency() > 1 ? 4000 : 0;
+				return nSpin;
+			}
+
+			inline void CpuRelax()
+			{
+#if defined(_M_X64) || defined(__x86_64__) || defined(_M_IX86) || defined(__i386__)
+				_mm_pause();
+#endif
+			}
+
+			// Start of every segment
+			struct segment_control
+			{
+				uint64_t nMagic;
+				uint64_t nRingCapacity;
+				// Process that called Listen, so a segment left by a crash can be told apart
+				uint32_t nListenerPid;
+				alignas(64) std::atomic<uint32_t> nListening;
+				std::atomic<uint32_t> nConnected;
+			};
+
+			// Blocks on a 32 bit word in shared memory until it changes from nExpected or
+			// the timeout passes. Linux uses a futex, Windows a named event per word and
+			// anything else falls back to a short sleep
+			class waiter
+			{
+			public:
+				void open(const std::string& sName)
+				{
+#ifdef _WIN32
+					m_hEvent = CreateEventA(nullptr, FALSE, FALSE, ("Local\\" + sName).c_str());
+#else
+					(void)sName;
+#endif
+				}
+
+				void close()
+				{
+#ifdef _WIN32
+					if (m_hEvent)
+						CloseHandle(m_hEvent);
+					m_hEvent = nullptr;
+#endif
+				}
+
+				// nTimeoutUs < 0 waits forever
+				void wait(std::atomic<uint32_t>& word, uint32_t nExpected, int64_t nTimeoutUs)
+				{
+					if (word.load() != nExpected)
+						return;
+#ifdef __linux__
+					timespec ts{};
+					timespec* pts = nullptr;
+					if (nTimeoutUs >= 0)
+					{
+						ts.tv_sec = time_t(nTimeoutUs / 1000000);
+						ts.tv_nsec = long(nTimeoutUs % 1000000) * 1000;
+						pts = &ts;
+					}
+					syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, nExpected, pts, nullptr, 0);
+#elif defined(_WIN32)
+					WaitForSingleObject(m_hEvent, nTimeoutUs < 0 ? INFINITE : DWORD((nTimeoutUs + 999) / 1000));
+#else
+					std::this_thread::sleep_for(std::chrono::microseconds(nTimeoutUs < 0 ? 50 : std::min<int64_t>(nTimeoutUs, 50)));
+#endif
+				}
+
+				void wake(std::atomic<uint32_t>& word)
+				{
+#ifdef __linux__
+					syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#elif defined(_WIN32)
+					(void)word;
+					SetEvent(m_hEvent);
+#else
+					(void)word;
+#endif
+				}
+
+			private:
+#ifdef _WIN32
+				HANDLE m_hEvent = nullptr;
+#endif
+			};
+
+			// One direction of a connection, a byte ring with a single producer and a
+			// single consumer. Sleepers are only woken when they have said they are asleep,
+			// so a busy pair of peers never makes a system call
+			class ring
+			{
+			public:
+				void attach(ring_control* pControl, uint8_t* pData, uint64_t nCapacity, const std::string& sName)
+				{
+					m_pControl = pControl;
+					m_pData = pData;
+					m_nCapacity = nCapacity;
+					m_nMask = nCapacity - 1;
+					m_waitData.open(sName + ".data");
+					m_waitSpace.open(sName + ".space");
+				}
+
+				void detach()
+				{
+					m_waitData.close();
+					m_waitSpace.close();
+					m_pControl = nullptr;
+				}
+
+				uint64_t capacity() const
+				{
+					return m_nCapacity;
+				}
+
+			public:
+				// Producer - waits for nBytes of space, false on timeout
+				bool reserve(size_t nBytes, int64_t nTimeoutUs)
+				{
+					while (m_nCapacity - (m_pControl->nHead.load(std::memory_order_relaxed) - m_pControl->nTail.load(std::memory_order_acquire)) < nBytes)
+					{
+						uint32_t nSignal = m_pControl->nSpaceSignal.load();
+						m_pControl->nProducerWaiting.store(1);
+
+						// Check again now the consumer can see we are waiting
+						if (m_nCapacity - (m_pControl->nHead.load(std::memory_order_relaxed) - m_pControl->nTail.load()) < nBytes)
+							m_waitSpace.wait(m_pControl->nSpaceSignal, nSignal, nTimeoutUs);
+
+						m_pControl->nProducerWaiting.store(0);
+						if (nTimeoutUs >= 0 && m_nCapacity - (m_pControl->nHead.load(std::memory_order_relaxed) - m_pControl->nTail.load()) < nBytes)
+							return false;
+					}
+					return true;
+				}
+
+				// Producer - copies bytes at nOffset past the head, wrapping as needed
+				void write(uint64_t nOffset, const void* pSrc, size_t nBytes)
+				{
+					uint64_t nPos = (m_pControl->nHead.load(std::memory_order_relaxed) + nOffset) & m_nMask;
+					size_t nFirst = size_t(std::min<uint64_t>(nBytes, m_nCapacity - nPos));
+					std::memcpy(m_pData + nPos, pSrc, nFirst);
+					std::memcpy(m_pData, static_cast<const uint8_t*>(pSrc) + nFirst, nBytes - nFirst);
+				}
+
+				// Producer - makes nBytes visible to the consumer, waking it if it is asleep
+				void publish(size_t nBytes)
+				{
+					m_pControl->nHead.store(m_pControl->nHead.load(std::memory_order_relaxed) + nBytes);
+					if (m_pControl->nConsumerWaiting.load())
+					{
+						m_pControl->nDataSignal.fetch_add(1);
+						m_waitData.wake(m_pControl->nDataSignal);
+					}
+				}
+
+				// Consumer - bytes ready to read
+				uint64_t available() const
+				{
+					return m_pControl->nHead.load(std::memory_order_acquire) - m_pControl->nTail.load(std::memory_order_relaxed);
+				}
+
+				// Consumer - waits for data, nTimeoutUs < 0 waits forever. False on timeout
+				bool wait(int64_t nTimeoutUs)
+				{
+					for (int i = 0; i < SpinCount() && available() == 0 && nTimeoutUs != 0; i++)
+						CpuRelax();
+
+					while (available() == 0)
+					{
+						uint32_t nSignal = m_pControl->nDataSignal.load();
+						m_pControl->nConsumerWaiting.store(1);
+
+						// Check again now the producer can see we are waiting
+						if (m_pControl->nHead.load() == m_pControl->nTail.load(std::memory_order_relaxed))
+							m_waitData.wait(m_pControl->nDataSignal, nSignal, nTimeoutUs);
+
+						m_pControl->nConsumerWaiting.store(0);
+						if (nTimeoutUs >= 0)
+							break;
+					}
+					return available() > 0;
+				}
+
+				// Consumer - copies bytes at nOffset past the tail, wrapping as needed
+				void read(uint64_t nOffset, void* pDst, size_t nBytes) const
+				{
+					uint64_t nPos = (m_pControl->nTail.load(std::memory_order_relaxed) + nOffset) & m_nMask;
+					size_t nFirst = size_t(std::min<uint64_t>(nBytes, m_nCapacity - nPos));
+					std::memcpy(pDst, m_pData + nPos, nFirst);
+					std::memcpy(static_cast<uint8_t*>(pDst) + nFirst, m_pData, nBytes - nFirst);
+				}
+
+				// Consumer - frees nBytes for the producer, waking it if it is asleep
+				void consume(size_t nBytes)
+				{
+					m_pControl->nTail.store(m_pControl->nTail.load(std::memory_order_relaxed) + nBytes);
+					if (m_pControl->nProducerWaiting.load())
+					{
+						m_pControl->nSpaceSignal.fetch_add(1);
+						m_waitSpace.wake(m_pControl->nSpaceSignal);
+					}
+				}
+
+			private:
+				ring_control* m_pControl = nullptr;
+				uint8_t* m_pData = nullptr;
+				uint64_t m_nCapacity = 0;
+				uint64_t m_nMask = 0;
+				waiter m_waitData;
+				waiter m_waitSpace;
+			};
+
+			// A named block of memory shared between processes
+			class segment
+			{
+			public:
+				segment() = default;
+				segment(const segment&) = delete;
+				~segment() { close(); }
+
+				bool create(const std::string& sName, size_t nSize)
+				{
+					return map(sName, nSize, true);
+				}
+
+				bool open(const std::string& sName)
+				{
+					return map(sName, 0, false);
+				}
+
+				void close()
+				{
+#ifdef _WIN32
+					if (m_pData)
+						UnmapViewOfFile(m_pData);
+					if (m_hMapping)
+						CloseHandle(m_hMapping);
+					m_hMapping = nullptr;
+#else
+					if (m_pData)
+						munmap(m_pData, m_nSize);
+					if (m_bOwner)
+						shm_unlink(m_sName.c_str());
+#endif
+					m_pData = nullptr;
+					m_nSize = 0;
+					m_bOwner = false;
+				}
+
+				uint8_t* data() const
+				{
+					return static_cast<uint8_t*>(m_pData);
+				}
+
+				// Removes a segment by name. Windows drops mappings with their last handle
+				static void remove(const std::string& sName)
+				{
+#ifdef _WIN32
+					(void)sName;
+#else
+					shm_unlink(("/" + sName).c_str());
+#endif
+				}
+
+				size_t size() const
+				{
+					return m_nSize;
+				}
+
+			private:
+				bool map(const std::string& sName, size_t nSize, bool bCreate)
+				{
+					close();
+#ifdef _WIN32
+					std::string sPath = "Local\\" + sName;
+					if (bCreate)
+						m_hMapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+							DWORD(uint64_t(nSize) >> 32), DWORD(nSize), sPath.c_str());
+					else
+						m_hMapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, sPath.c_str());
+					if (!m_hMapping)
+						return false;
+
+					m_pData = MapViewOfFile(m_hMapping, FILE_MAP_ALL_ACCESS, 0, 0, nSize);
+					if (!m_pData)
+					{
+						close();
+						return false;
+					}
+
+					if (!bCreate)
+					{
+						MEMORY_BASIC_INFORMATION info{};
+						VirtualQuery(m_pData, &info, sizeof(info));
+						nSize = info.RegionSize;
+					}
+#else
+					m_sName = "/" + sName;
+					int fd = bCreate ? shm_open(m_sName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600) : shm_open(m_sName.c_str(), O_RDWR, 0);
+					if (fd < 0)
+						return false;
+
+					if (bCreate && ftruncate(fd, off_t(nSize)) != 0)
+					{
+						::close(fd);
+						shm_unlink(m_sName.c_str());
+						return false;
+					}
+
+					if (!bCreate)
+					{
+						struct stat st{};
+						fstat(fd, &st);
+						nSize = size_t(st.st_size);
+					}
+
+					m_pData = mmap(nullptr, nSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+					::close(fd);
+					if (m_pData == MAP_FAILED)
+					{
+						m_pData = nullptr;
+						if (bCreate)
+							shm_unlink(m_sName.c_str());
+						return false;
+					}
+#endif
+					m_nSize = nSize;
+					m_bOwner = bCreate;
+					return true;
+				}
+
+			private:
+				void* m_pData = nullptr;
+				size_t m_nSize = 0;
+				bool m_bOwner = false;
+#ifdef _WIN32
+				HANDLE m_hMapping = nullptr;
+#else
+				std::string m_sName;
+#endif
+			};
+		}
+
+		// Exchanges message<T> frames with a peer process on the same host through a pair of
+		// shared memory rings, skipping the kernel entirely while both sides are busy.
+		// One peer calls Listen and owns the segment, the other calls Connect. Send may
+		// only be called from one thread at a time, and likewise Update
+		template <typename T>
+		class shm_peer
+		{
+		public:
+			shm_peer() = default;
+			shm_peer(const shm_peer&) = delete;
+
+			virtual ~shm_peer()
+			{
+				Close();
+			}
+
+		public:
+			// Creates the named segment with rings of nRingCapacity bytes (rounded up to a power of two)
+			bool Listen(const std::string& sName, size_t nRingCapacity = 1 << 20)
+			{
+				Close();
+
+				uint64_t nCapacity = 64;
+				while (nCapacity < nRingCapacity)
+					nCapacity <<= 1;
+
+				if (!m_segment.create(sName, Layout(nCapacity)) && !(RemoveStale(sName) && m_segment.create(sName, Layout(nCapacity))))
+				{
+					ASR_NET_LOG(error, "[SHM] Failed to create segment ", sName);
+					return false;
+				}
+
+				shm::segment_control* pControl = new (m_segment.data()) shm::segment_control{};
+				new (m_segment.data() + RingControlOffset(0, nCapacity)) shm::ring_control{};
+				new (m_segment.data() + RingControlOffset(1, nCapacity)) shm::ring_control{};
+				pControl->nRingCapacity = nCapacity;
+#ifdef _WIN32
+				pControl->nListenerPid = uint32_t(GetCurrentProcessId());
+#else
+				pControl->nListenerPid = uint32_t(getpid());
+#endif
+
+				// Everything else must be visible before a connecting peer sees the magic
+				std::atomic_thread_fence(std::memory_order_release);
+				pControl->nMagic = shm::SegmentMagic;
+				pControl->nListening.store(1);
+
+				// The listener writes ring 0 and reads ring 1
+				Attach(sName, 0, 1);
+				return true;
+			}
+
+			// Opens a segment created by a listening peer
+			bool Connect(const std::string& sName)
+			{
+				Close();
+
+				if (!m_segment.open(sName) || m_segment.size() < sizeof(shm::segment_control))
+				{
+					ASR_NET_LOG(error, "[SHM] Failed to open segment ", sName);
+					m_segment.close();
+					return false;
+				}
+
+				shm::segment_control* pControl = reinterpret_cast<shm::segment_control*>(m_segment.data());
+				bool bValid = pControl->nMagic == shm::SegmentMagic;
+				std::atomic_thread_fence(std::memory_order_acquire);
+				uint64_t nCapacity = pControl->nRingCapacity;
+				if (!bValid || nCapacity < 64 || (nCapacity & (nCapacity - 1)) != 0 || m_segment.size() < Layout(nCapacity))
+				{
+					ASR_NET_LOG(error, "[SHM] Segment ", sName, " is not a message segment");
+					m_segment.close();
+					return false;
+				}
+
+				pControl->nConnected.store(1);
+				Attach(sName, 1, 0);
+				return true;
+			}
+
+			void Close()
+			{
+				if (!m_segment.data())
+					return;
+
+				shm::segment_control* pControl = reinterpret_cast<shm::segment_control*>(m_segment.data());
+				if (m_bListener)
+					pControl->nListening.store(0);
+				else
+					pControl->nConnected.store(0);
+
+				m_ringOut.detach();
+				m_ringIn.detach();
+				m_segment.close();
+			}
+
+			// True while both peers are attached
+			bool IsConnected() const
+			{
+				if (!m_segment.data())
+					return false;
+
+				const shm::segment_control* pControl = reinterpret_cast<const shm::segment_control*>(m_segment.data());
+				return pControl->nListening.load() && pControl->nConnected.load();
+			}
+
+		public:
+			// Longest Send blocks on a full ring before giving up on the peer
+			void SetSendTimeout(std::chrono::milliseconds tTimeout)
+			{
+				m_tSendTimeout = tTimeout;
+			}
+
+			// Queues a message for the peer, blocking while the ring is full. Returns false
+			// if the message can never fit or the segment isn't open. A peer that leaves the
+			// ring full for the send timeout is taken to be dead, and is closed
+			bool Send(const message<T>& msg)
+			{
+				if (!m_segment.data())
+					return false;
+
+				size_t nFrame = sizeof(message_header<T>) + msg.body.size();
+				if (nFrame > m_ringOut.capacity())
+				{
+					ASR_NET_LOG(warn, "[SHM] Message of ", msg.body.size(), " bytes is larger than the ring");
+					return false;
+				}
+
+				// Wait in slices, a wake for too little space ends a slice early
+				auto tDeadline = std::chrono::steady_clock::now() + m_tSendTimeout;
+				while (!m_ringOut.reserve(nFrame, 10000))
+				{
+					if (std::chrono::steady_clock::now() >= tDeadline)
+					{
+						ASR_NET_LOG(warn, "[SHM] Peer stopped reading, closing");
+						Close();
+						return false;
+					}
+				}
+
+				message_header<T> header = msg.header;
+				header.size = uint32_t(msg.body.size());
+				m_ringOut.write(0, &header, sizeof(header));
+				m_ringOut.write(sizeof(header), msg.body.data(), msg.body.size());
+				m_ringOut.publish(nFrame);
+				return true;
+			}
+
+			// Hands up to nMaxMessages waiting messages to OnMessage, optionally sleeping until one arrives.
+			// Returns the number of messages handled
+			size_t Update(size_t nMaxMessages = -1, bool bWait = false)
+			{
+				return Process(nMaxMessages, bWait ? -1 : 0);
+			}
+
+			// As Update, but waits at most timeout for a message to arrive
+			template <typename Rep, typename Period>
+			size_t UpdateFor(const std::chrono::duration<Rep, Period>& timeout, size_t nMaxMessages = -1)
+			{
+				return Process(nMaxMessages, std::chrono::duration_cast<std::chrono::microseconds>(timeout).count());
+			}
+
+		protected:
+			// Called when a message arrives
+			virtual void OnMessage(message<T>& msg)
+			{
+
+			}
+
+		private:
+			// A listener that died without closing leaves its segment behind on POSIX
+			// systems, blocking every later Listen. Removes it if its listener is gone
+			static bool RemoveStale(const std::string& sName)
+			{
+#ifdef _WIN32
+				(void)sName;
+				return false;
+#else
+				shm::segment old;
+				if (!old.open(sName))
+					return false;
+
+				bool bStale = false;
+				if (old.size() >= sizeof(shm::segment_control))
+				{
+					const shm::segment_control* pControl = reinterpret_cast<const shm::segment_control*>(old.data());
+					if (pControl->nMagic == shm::SegmentMagic)
+						bStale = !pControl->nListening.load() || (kill(pid_t(pControl->nListenerPid), 0) != 0 && errno == ESRCH);
+				}
+				old.close();
+
+				if (!bStale)
+					return false;
+
+				ASR_NET_LOG(warn, "[SHM] Removing stale segment ", sName);
+				shm::segment::remove(sName);
+				return true;
+#endif
+			}
+
+			static size_t RingControlOffset(int nRing, uint64_t nCapacity)
+			{
+				size_t nBase = (sizeof(shm::segment_control) + 63) & ~size_t(63);
+				size_t nRingSize = ((sizeof(shm::ring_control) + 63) & ~size_t(63)) + size_t(nCapacity);
+				return nBase + nRing * nRingSize;
+			}
+
+			static size_t Layout(uint64_t nCapacity)
+			{
+				return RingControlOffset(2, nCapacity);
+			}
+
+			void Attach(const std::string& sName, int nOut, int nIn)
+			{
+				uint64_t nCapacity = reinterpret_cast<shm::segment_control*>(m_segment.data())->nRingCapacity;
+				size_t nControlSize = (sizeof(shm::ring_control) + 63) & ~size_t(63);
+
+				uint8_t* pOut = m_segment.data() + RingControlOffset(nOut, nCapacity);
+				uint8_t* pIn = m_segment.data() + RingControlOffset(nIn, nCapacity);
+				m_ringOut.attach(reinterpret_cast<shm::ring_control*>(pOut), pOut + nControlSize, nCapacity, sName + "." + std::to_string(nOut));
+				m_ringIn.attach(reinterpret_cast<shm::ring_control*>(pIn), pIn + nControlSize, nCapacity, sName + "." + std::to_string(nIn));
+				m_bListener = nOut == 0;
+			}
+
+			size_t Process(size_t nMaxMessages, int64_t nTimeoutUs)
+			{
+				if (!m_segment.data())
+					return 0;
+
+				if (nTimeoutUs != 0 && !m_ringIn.wait(nTimeoutUs))
+					return 0;
+
+				size_t nMessageCount = 0;
+				uint64_t nAvailable = 0;
+				while (nMessageCount < nMaxMessages && (nAvailable = m_ringIn.available()) >= sizeof(message_header<T>))
+				{
+					// Frames are published whole, so a header means the body is there too. The
+					// peer shares the memory, so anything else means it can't be trusted
+					m_ringIn.read(0, &m_msgTemporaryIn.header, sizeof(message_header<T>));
+					if (nAvailable > m_ringIn.capacity() || m_msgTemporaryIn.header.size > nAvailable - sizeof(message_header<T>))
+					{
+						ASR_NET_LOG(error, "[SHM] Peer wrote a malformed frame, closing");
+						Close();
+						break;
+					}
+
+					m_msgTemporaryIn.body.resize(m_msgTemporaryIn.header.size);
+					m_ringIn.read(sizeof(message_header<T>), m_msgTemporaryIn.body.data(), m_msgTemporaryIn.header.size);
+					m_ringIn.consume(sizeof(message_header<T>) + m_msgTemporaryIn.header.size);
+
+					OnMessage(m_msgTemporaryIn);
+					nMessageCount++;
+				}
+
+				return nMessageCount;
+			}
+
+		private:
+			shm::segment m_segment;
+			shm::ring m_ringOut;
+			shm::ring m_ringIn;
+			bool m_bListener = false;
+			std::chrono::milliseconds m_tSendTimeout = shm::DefaultSendTimeout;
+
+			// Reused for every message so steady traffic doesn't allocate
+			message<T> m_msgTemporaryIn;
+		};
+	}
+}
\ No newline at end of file
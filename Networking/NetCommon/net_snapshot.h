@@ -0,0 +1,304 @@
+#pragma once
+#include "net_common.h"
+#include "net_message.h"
+#include "net_wire.h"
+
+namespace asr
+{
+	namespace net
+	{
+		namespace delta
+		{
+			// Largest state Decode rebuilds unless told otherwise, matches the default ingress message limit
+			constexpr size_t DefaultMaxStateSize = 64 * 1024 * 1024;
+
+			// Byte of base at i, states that have grown are compared against zeros
+			inline uint8_t BaseAt(const std::vector<uint8_t>& vBase, size_t i)
+			{
+				return i < vBase.size() ? vBase[i] : 0;
+			}
+
+			// Encodes vCurrent against vBase as runs of [varint unchanged][varint changed][xor bytes].
+			// Unchanged bytes xor to zero so slowly changing state shrinks to a few bytes, and
+			// an empty base turns this into a plain run-length encoded keyframe
+			template <typename Buffer>
+			void Encode(const std::vector<uint8_t>& vBase, const std::vector<uint8_t>& vCurrent, Buffer& vOut)
+			{
+				vOut.clear();
+
+				const size_t nSize = vCurrent.size();
+				const size_t nCommon = std::min(vBase.size(), nSize);
+				uint8_t aVarint[10];
+
+				size_t i = 0;
+				while (i < nSize)
+				{
+					// Skip unchanged bytes, a word at a time while both buffers overlap
+					size_t nStart = i;
+					while (i + 8 <= nCommon && std::memcmp(&vBase[i], &vCurrent[i], 8) == 0)
+						i += 8;
+					while (i < nSize && vCurrent[i] == BaseAt(vBase, i))
+						i++;
+					size_t nUnchanged = i - nStart;
+
+					// Then the changed bytes, short unchanged gaps are cheaper to keep as literals
+					nStart = i;
+					while (i < nSize)
+					{
+						if (vCurrent[i] != BaseAt(vBase, i))
+						{
+							i++;
+							continue;
+						}
+
+						size_t nGap = 0;
+						while (i + nGap < nSize && nGap < 3 && vCurrent[i + nGap] == BaseAt(vBase, i + nGap))
+							nGap++;
+						if (nGap < 3 && i + nGap < nSize)
+							i += nGap;
+						else
+							break;
+					}
+					size_t nChanged = i - nStart;
+
+					vOut.insert(vOut.end(), aVarint, aVarint + wire::EncodeVarint(nUnchanged, aVarint));
+					vOut.insert(vOut.end(), aVarint, aVarint + wire::EncodeVarint(nChanged, aVarint));
+					for (size_t j = nStart; j < i; j++)
+						vOut.push_back(vCurrent[j] ^ BaseAt(vBase, j));
+				}
+			}
+
+			// Rebuilds a state of nSize bytes from vBase and a delta, returns false if the delta is malformed.
+			// nSize comes off the wire, so it is checked against nMaxSize before anything is allocated
+			inline bool Decode(const std::vector<uint8_t>& vBase, const uint8_t* pDelta, size_t nDelta, size_t nSize, std::vector<uint8_t>& vOut,
+				size_t nMaxSize = DefaultMaxStateSize)
+			{
+				if (nSize > nMaxSize)
+					return false;
+
+				vOut.resize(nSize);
+
+				size_t i = 0, p = 0;
+				while (i < nSize)
+				{
+					uint64_t nUnchanged = 0, nChanged = 0;
+					size_t n = wire::DecodeVarint(pDelta + p, nDelta - p, 10, nUnchanged);
+					if (n == 0)
+						return false;
+					p += n;
+
+					n = wire::DecodeVarint(pDelta + p, nDelta - p, 10, nChanged);
+					if (n == 0 || nUnchanged > nSize - i || nChanged > nSize - i - nUnchanged || nChanged > nDelta - p - n)
+						return false;
+					p += n;
+
+					// Unchanged bytes come straight from the base
+					size_t nCopy = std::min<size_t>(nUnchanged, vBase.size() > i ? vBase.size() - i : 0);
+					if (nCopy > 0)
+						std::memcpy(vOut.data() + i, vBase.data() + i, nCopy);
+					std::memset(vOut.data() + i + nCopy, 0, size_t(nUnchanged) - nCopy);
+					i += size_t(nUnchanged);
+
+					for (size_t j = 0; j < nChanged; j++, i++)
+						vOut[i] = pDelta[p + j] ^ BaseAt(vBase, i);
+					p += size_t(nChanged);
+				}
+
+				return p == nDelta;
+			}
+		}
+
+		// Server side of snapshot synchronisation. Keeps a short history of states and
+		// each client's last acknowledged one, and builds delta messages against it.
+		// Clients without a usable baseline get a keyframe
+		template <typename T>
+		class snapshot_sender
+		{
+		public:
+			snapshot_sender(T idSnapshot, T idAck, size_t nHistory = 32)
+				: m_idSnapshot(idSnapshot), m_idAck(idAck), m_nHistory(std::max<size_t>(nHistory, 1))
+			{
+
+			}
+
+		public:
+			// Records this tick's state, returns its sequence number
+			uint32_t Push(std::vector<uint8_t> vState)
+			{
+				m_deqHistory.push_back({ ++m_nSequence, std::move(vState) });
+				if (m_deqHistory.size() > m_nHistory)
+					m_deqHistory.pop_front();
+
+				// Deltas are shared by every client with the same baseline, but only for this tick
+				m_mapEncoded.clear();
+				return m_nSequence;
+			}
+
+			// Message carrying the latest state for a client, encoded against its last acknowledged state.
+			// Clients on the same baseline share one encoding
+			const message<T>& MessageFor(uint32_t nClientID)
+			{
+				const std::vector<uint8_t>* pBase = &m_vEmpty;
+				uint32_t nBaseSequence = 0;
+
+				auto itAck = m_mapAcked.find(nClientID);
+				if (itAck != m_mapAcked.end())
+				{
+					for (auto& snapshot : m_deqHistory)
+					{
+						if (snapshot.nSequence == itAck->second)
+						{
+							pBase = &snapshot.vState;
+							nBaseSequence = snapshot.nSequence;
+							break;
+						}
+					}
+				}
+
+				auto itEncoded = m_mapEncoded.find(nBaseSequence);
+				if (itEncoded != m_mapEncoded.end())
+					return itEncoded->second;
+
+				const std::vector<uint8_t>& vCurrent = m_deqHistory.back().vState;
+
+				message<T>& msg = m_mapEncoded[nBaseSequence];
+				msg.header.id = m_idSnapshot;
+				delta::Encode(*pBase, vCurrent, msg.body);
+				msg.header.size = uint32_t(msg.body.size());
+				msg << uint32_t(vCurrent.size()) << nBaseSequence << m_nSequence;
+				return msg;
+			}
+
+			// Handles an acknowledgement from a client, returns false if msg isn't one
+			bool OnAck(uint32_t nClientID, message<T>& msg)
+			{
+				if (msg.header.id != m_idAck || msg.body.size() != sizeof(uint32_t))
+					return false;
+
+				uint32_t nSequence = 0;
+				msg >> nSequence;
+
+				// Acks can only move forward
+				uint32_t& nAcked = m_mapAcked[nClientID];
+				if (nSequence > nAcked && nSequence <= m_nSequence)
+					nAcked = nSequence;
+				return true;
+			}
+
+			// Call when a client disconnects
+			void Forget(uint32_t nClientID)
+			{
+				m_mapAcked.erase(nClientID);
+			}
+
+			// True once something has been pushed
+			bool HasState() const
+			{
+				return !m_deqHistory.empty();
+			}
+
+		private:
+			struct snapshot
+			{
+				uint32_t nSequence = 0;
+				std::vector<uint8_t> vState;
+			};
+
+			T m_idSnapshot;
+			T m_idAck;
+			size_t m_nHistory;
+
+			uint32_t m_nSequence = 0;
+			std::deque<snapshot> m_deqHistory;
+			std::unordered_map<uint32_t, uint32_t> m_mapAcked;
+			std::unordered_map<uint32_t, message<T>> m_mapEncoded;
+			const std::vector<uint8_t> m_vEmpty;
+		};
+
+		// Client side of snapshot synchronisation, rebuilds states from deltas and
+		// produces the acknowledgements the server encodes against
+		template <typename T>
+		class snapshot_receiver
+		{
+		public:
+			snapshot_receiver(T idSnapshot, T idAck, size_t nHistory = 32)
+				: m_idSnapshot(idSnapshot), m_idAck(idAck), m_nHistory(std::max<size_t>(nHistory, 1))
+			{
+
+			}
+
+		public:
+			// Applies a snapshot message, returns false if msg isn't a usable snapshot
+			bool Apply(message<T>& msg)
+			{
+				if (msg.header.id != m_idSnapshot || msg.body.size() < 3 * sizeof(uint32_t))
+					return false;
+
+				uint32_t nSequence = 0, nBaseSequence = 0, nSize = 0;
+				msg >> nSequence >> nBaseSequence >> nSize;
+
+				// Stale or duplicate states are of no use
+				if (!m_deqHistory.empty() && nSequence <= m_deqHistory.back().nSequence)
+					return false;
+
+				const std::vector<uint8_t>* pBase = &m_vEmpty;
+				if (nBaseSequence != 0)
+				{
+					pBase = nullptr;
+					for (auto& snapshot : m_deqHistory)
+						if (snapshot.nSequence == nBaseSequence)
+							pBase = &snapshot.vState;
+
+					// The baseline has been forgotten, wait for the server to notice and send a keyframe
+					if (!pBase)
+						return false;
+				}
+
+				std::vector<uint8_t> vState;
+				if (!delta::Decode(*pBase, msg.body.data(), msg.body.size(), nSize, vState, m_nMaxStateSize))
+					return false;
+
+				m_deqHistory.push_back({ nSequence, std::move(vState) });
+				if (m_deqHistory.size() > m_nHistory)
+					m_deqHistory.pop_front();
+				return true;
+			}
+
+			// Largest state accepted, larger ones are rejected without allocating
+			void SetMaxStateSize(size_t nMaxStateSize)
+			{
+				m_nMaxStateSize = nMaxStateSize;
+			}
+
+			// Latest state received
+			const std::vector<uint8_t>& State() const
+			{
+				return m_deqHistory.empty() ? m_vEmpty : m_deqHistory.back().vState;
+			}
+
+			// Acknowledgement for the latest state, to be sent back to the server
+			message<T> MakeAck() const
+			{
+				message<T> msg;
+				msg.header.id = m_idAck;
+				msg << (m_deqHistory.empty() ? uint32_t(0) : m_deqHistory.back().nSequence);
+				return msg;
+			}
+
+		private:
+			struct snapshot
+			{
+				uint32_t nSequence = 0;
+				std::vector<uint8_t> vState;
+			};
+
+			T m_idSnapshot;
+			T m_idAck;
+			size_t m_nHistory;
+			size_t m_nMaxStateSize = delta::DefaultMaxStateSize;
+
+			std::deque<snapshot> m_deqHistory;
+			const std::vector<uint8_t> m_vEmpty;
+		};
+	}
+}
\ No newline at end of file
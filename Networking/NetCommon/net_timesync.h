@@ -0,0 +1,137 @@
+#pragma once
+#include "net_common.h"
+#include "net_message.h"
+#include "net_wire.h"
+
+namespace asr
+{
+	namespace net
+	{
+		namespace timesync
+		{
+			// Probes go out this often once the first few have settled the estimates
+			constexpr std::chrono::milliseconds ProbeInterval{ 1000 };
+			constexpr std::chrono::milliseconds WarmupInterval{ 100 };
+			constexpr uint32_t WarmupProbes = 4;
+
+			enum class kind : uint8_t
+			{
+				probe = 1,
+				reply = 2
+			};
+
+			// Body is [t0][t1][t2][kind], nanoseconds on each side's steady_clock
+			constexpr size_t BodySize = 3 * sizeof(int64_t) + sizeof(uint8_t);
+
+			inline int64_t Now()
+			{
+				return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+			}
+
+			template <typename T>
+			message<T> MakeMessage(kind nKind, int64_t t0, int64_t t1)
+			{
+				message<T> msg;
+				msg.header.id = wire::ControlId<T>;
+				msg << t0 << t1 << int64_t(0) << uint8_t(nKind);
+				return msg;
+			}
+
+			// Fills in the send time just before the message goes on the wire, so time
+			// spent queued behind other messages doesn't count against the estimates
+			template <typename T>
+			void StampSendTime(message<T>& msg)
+			{
+				if (msg.body.size() != BodySize)
+					return;
+
+				int64_t tNow = Now();
+				if (kind(msg.body[BodySize - 1]) == kind::probe)
+					std::memcpy(msg.body.data(), &tNow, sizeof(tNow));
+				else
+					std::memcpy(msg.body.data() + 2 * sizeof(int64_t), &tNow, sizeof(tNow));
+			}
+
+			// Round trip time, jitter and clock offset for one connection. Updated from the
+			// asio thread and read from any other, so results are kept in atomics
+			class clock_estimator
+			{
+			public:
+				// Samples kept for the offset, the one with the shortest round trip wins
+				static constexpr size_t FilterSize = 8;
+
+				// t0 probe sent and t3 reply received are local times, t1 probe received
+				// and t2 reply sent are the remote's
+				void AddSample(int64_t t0, int64_t t1, int64_t t2, int64_t t3)
+				{
+					int64_t nRtt = std::max<int64_t>((t3 - t0) - (t2 - t1), 0);
+					int64_t nOffset = ((t1 - t0) + (t2 - t3)) / 2;
+
+					// Smoothed like TCP's retransmit timer (RFC 6298)
+					if (m_nSamples == 0)
+					{
+						m_nSmoothedRtt = nRtt;
+						m_nRttVariation = nRtt / 2;
+					}
+					else
+					{
+						m_nRttVariation = (3 * m_nRttVariation + std::abs(m_nSmoothedRtt - nRtt)) / 4;
+						m_nSmoothedRtt = (7 * m_nSmoothedRtt + nRtt) / 8;
+					}
+
+					// Queueing delays make the offset lopsided, the quickest exchange is the most symmetric
+					m_aFilter[m_nSamples % FilterSize] = { nRtt, nOffset };
+					m_nSamples++;
+
+					const sample* pBest = &m_aFilter[0];
+					for (size_t i = 1; i < std::min<size_t>(m_nSamples, FilterSize); i++)
+						if (m_aFilter[i].nRtt < pBest->nRtt)
+							pBest = &m_aFilter[i];
+
+					m_nRtt.store(m_nSmoothedRtt, std::memory_order_relaxed);
+					m_nJitter.store(m_nRttVariation, std::memory_order_relaxed);
+					m_nOffset.store(pBest->nOffset, std::memory_order_relaxed);
+					m_bHasSample.store(true, std::memory_order_release);
+				}
+
+				bool HasSample() const
+				{
+					return m_bHasSample.load(std::memory_order_acquire);
+				}
+
+				std::chrono::nanoseconds RoundTripTime() const
+				{
+					return std::chrono::nanoseconds(m_nRtt.load(std::memory_order_relaxed));
+				}
+
+				std::chrono::nanoseconds Jitter() const
+				{
+					return std::chrono::nanoseconds(m_nJitter.load(std::memory_order_relaxed));
+				}
+
+				// How far the remote's steady_clock is ahead of ours
+				std::chrono::nanoseconds ClockOffset() const
+				{
+					return std::chrono::nanoseconds(m_nOffset.load(std::memory_order_relaxed));
+				}
+
+			private:
+				struct sample
+				{
+					int64_t nRtt = 0;
+					int64_t nOffset = 0;
+				};
+
+				std::array<sample, FilterSize> m_aFilter{};
+				size_t m_nSamples = 0;
+				int64_t m_nSmoothedRtt = 0;
+				int64_t m_nRttVariation = 0;
+
+				std::atomic<int64_t> m_nRtt{ 0 };
+				std::atomic<int64_t> m_nJitter{ 0 };
+				std::atomic<int64_t> m_nOffset{ 0 };
+				std::atomic<bool> m_bHasSample{ false };
+			};
+		}
+	}
+}
\ No newline at end of file
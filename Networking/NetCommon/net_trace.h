@@ -0,0 +1,222 @@
+#pragma once
+#include "net_common.h"
+
+// Define ASR_NET_TRACE to record a timestamped event at each stage a message passes through.
+// Without it the trace points compile away to nothing
+#if defined(ASR_NET_TRACE) && (defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86))
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#define ASR_NET_TRACE_TSC
+#endif
+
+namespace asr
+{
+	namespace net
+	{
+		namespace trace
+		{
+			// Points in a message's life that get recorded
+			enum class stage : uint8_t
+			{
+				// A whole message has come off the socket
+				read_complete,
+				// It has been put on the incoming queue
+				enqueue,
+				// Update has taken it off the queue
+				dequeue,
+				// OnMessage was called for it, and returned
+				handler_begin,
+				handler_end,
+				// Send was called
+				send_posted,
+				// It has been written to the socket
+				write_complete
+			};
+
+			inline const char* StageName(stage nStage)
+			{
+				switch (nStage)
+				{
+				case stage::read_complete: return "read_complete";
+				case stage::enqueue: return "enqueue";
+				case stage::dequeue: return "dequeue";
+				case stage::handler_begin:
+				case stage::handler_end: return "OnMessage";
+				case stage::send_posted: return "send_posted";
+				case stage::write_complete: return "write_complete";
+				}
+				return "unknown";
+			}
+
+			// Time stamp counter where there is one, it is far cheaper to read than a clock
+			inline uint64_t Ticks()
+			{
+#ifdef ASR_NET_TRACE_TSC
+				return __rdtsc();
+#else
+				return uint64_t(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+			}
+
+			struct event
+			{
+				uint64_t nTicks = 0;
+				uint32_t nID = 0;
+				stage nStage = stage::read_complete;
+			};
+
+			// Events from a single thread. Only the owning thread writes, so recording takes
+			// no lock. Once full the oldest events are overwritten
+			class ring
+			{
+			public:
+				static constexpr size_t Capacity = size_t(1) << 16;
+
+				ring(uint32_t nThread)
+					: m_nThread(nThread), m_vEvents(Capacity)
+				{
+
+				}
+
+			public:
+				void record(stage nStage, uint32_t nID)
+				{
+					uint64_t nHead = m_nHead.load(std::memory_order_relaxed);
+					event& e = m_vEvents[nHead & (Capacity - 1)];
+					e.nTicks = Ticks();
+					e.nID = nID;
+					e.nStage = nStage;
+					m_nHead.store(nHead + 1, std::memory_order_release);
+				}
+
+				// Copies out what has been recorded, oldest first. Events being written while
+				// this runs may come out torn, dump once traffic has stopped for a clean trace
+				void copy(std::vector<event>& vOut) const
+				{
+					uint64_t nHead = m_nHead.load(std::memory_order_acquire);
+					uint64_t nFirst = nHead > Capacity ? nHead - Capacity : 0;
+					for (uint64_t n = nFirst; n < nHead; n++)
+						vOut.push_back(m_vEvents[n & (Capacity - 1)]);
+				}
+
+				uint32_t thread() const
+				{
+					return m_nThread;
+				}
+
+			private:
+				uint32_t m_nThread;
+				std::atomic<uint64_t> m_nHead{ 0 };
+				std::vector<event> m_vEvents;
+			};
+
+			// Every thread's ring, kept after the thread exits so its events can still be written out
+			class registry
+			{
+			public:
+				static registry& get()
+				{
+					static registry instance;
+					return instance;
+				}
+
+				ring& add()
+				{
+					std::scoped_lock lock(m_mux);
+					m_vRings.push_back(std::make_unique<ring>(uint32_t(m_vRings.size() + 1)));
+					return *m_vRings.back();
+				}
+
+				// Writes every thread's events as Chrome trace JSON, which chrome://tracing
+				// and ui.perfetto.dev both open. Times are microseconds since tracing began
+				void WriteChromeTrace(std::ostream& os)
+				{
+					// Ticks may be TSC cycles, measure their rate over the whole run
+					double dElapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - m_tStart).count();
+					double dTicksPerMicro = double(Ticks() - m_nStartTicks) / std::max(dElapsed, 1.0);
+					if (dTicksPerMicro <= 0.0)
+						dTicksPerMicro = 1.0;
+
+					std::scoped_lock lock(m_mux);
+					std::vector<event> vEvents;
+					bool bFirst = true;
+					char sLine[192];
+
+					os << "{\"traceEvents\":[";
+					for (auto& pRing : m_vRings)
+					{
+						vEvents.clear();
+						pRing->copy(vEvents);
+
+						for (const event& e : vEvents)
+						{
+							const char* sPhase = "i";
+							if (e.nStage == stage::handler_begin)
+								sPhase = "B";
+							else if (e.nStage == stage::handler_end)
+								sPhase = "E";
+
+							double dTime = double(int64_t(e.nTicks - m_nStartTicks)) / dTicksPerMicro;
+							std::snprintf(sLine, sizeof(sLine),
+								"%s\n{\"name\":\"%s\",\"ph\":\"%s\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"id\":%u}}",
+								bFirst ? "" : ",", StageName(e.nStage), sPhase, dTime, pRing->thread(), e.nID);
+							os << sLine;
+							bFirst = false;
+						}
+					}
+					os << "\n]}\n";
+				}
+
+			private:
+				registry()
+					: m_nStartTicks(Ticks()), m_tStart(std::chrono::steady_clock::now())
+				{
+
+				}
+
+			private:
+				std::mutex m_mux;
+				std::vector<std::unique_ptr<ring>> m_vRings;
+				uint64_t m_nStartTicks;
+				std::chrono::steady_clock::time_point m_tStart;
+			};
+
+			// The calling thread's ring, registered the first time it records anything
+			inline ring& ThreadRing()
+			{
+				thread_local ring& r = registry::get().add();
+				return r;
+			}
+
+			inline void Record(stage nStage, uint32_t nID)
+			{
+				ThreadRing().record(nStage, nID);
+			}
+
+			inline void WriteChromeTrace(std::ostream& os)
+			{
+				registry::get().WriteChromeTrace(os);
+			}
+
+			// Returns false if the file couldn't be written
+			inline bool WriteChromeTrace(const std::string& sPath)
+			{
+				std::ofstream file(sPath, std::ios::binary);
+				if (!file)
+					return false;
+
+				WriteChromeTrace(file);
+				return bool(file);
+			}
+		}
+	}
+}
+
+#ifdef ASR_NET_TRACE
+#define ASR_NET_TRACE_EVENT(s, id) ::asr::net::trace::Record(::asr::net::trace::stage::s, uint32_t(id))
+#else
+#define ASR_NET_TRACE_EVENT(s, id) ((void)0)
+#endif
\ No newline at end of file
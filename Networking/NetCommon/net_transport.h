@@ -0,0 +1,84 @@
+#pragma once
+#include "net_common.h"
+
+namespace asr
+{
+	namespace net
+	{
+		// Transports tell connections, servers and clients which asio protocol to use, so the
+		// same framing, handshake and queues run over anything stream oriented. A transport
+		// provides the protocol type, PrepareListen(), which readies an endpoint for binding,
+		// and ConfigureSocket(), which tunes every connected socket. cluster_server also needs
+		// SameHost(), to tell its peers' links from anyone else's
+
+		// TCP over IPv4/IPv6, the default
+		struct tcp_transport
+		{
+			using protocol = asio::ip::tcp;
+
+			// Endpoint a server listens on when it is only given a port
+			static protocol::endpoint ListenEndpoint(uint16_t port)
+			{
+				return protocol::endpoint(asio::ip::tcp::v4(), port);
+			}
+
+			static const protocol::endpoint& PrepareListen(const protocol::endpoint& endpoint)
+			{
+				return endpoint;
+			}
+
+			// Headers and bodies go out as separate small writes, which Nagle's algorithm
+			// would otherwise hold back waiting for an ack
+			static void ConfigureSocket(protocol::socket& socket)
+			{
+				asio::error_code ec;
+				socket.set_option(asio::ip::tcp::no_delay(true), ec);
+			}
+
+			// Whether two endpoints are on the same host, ports aside. IPv4 addresses seen
+			// through an IPv6 socket count as the IPv4 address
+			static bool SameHost(const protocol::endpoint& a, const protocol::endpoint& b)
+			{
+				return Unmapped(a.address()) == Unmapped(b.address());
+			}
+
+		private:
+			static asio::ip::address Unmapped(const asio::ip::address& address)
+			{
+				if (address.is_v6() && address.to_v6().is_v4_mapped())
+					return asio::ip::make_address_v4(asio::ip::v4_mapped, address.to_v6());
+				return address;
+			}
+		};
+
+#if defined(ASIO_HAS_LOCAL_SOCKETS)
+		// Unix domain sockets, for sidecars on the same host. Skips the TCP/IP stack entirely
+		struct local_transport
+		{
+			using protocol = asio::local::stream_protocol;
+
+			// A socket file left behind by a previous run would stop the bind, so remove it.
+			// Only a socket nothing is listening on counts, anything else fails the bind as it should
+			static const protocol::endpoint& PrepareListen(const protocol::endpoint& endpoint)
+			{
+				std::error_code ec;
+				if (std::filesystem::status(endpoint.path(), ec).type() != std::filesystem::file_type::socket)
+					return endpoint;
+
+				asio::io_context context;
+				protocol::socket probe(context);
+				asio::error_code ecConnect;
+				probe.connect(endpoint, ecConnect);
+				if (ecConnect == asio::error::connection_refused)
+					std::filesystem::remove(endpoint.path(), ec);
+				return endpoint;
+			}
+
+			static void ConfigureSocket(protocol::socket&)
+			{
+
+			}
+		};
+#endif
+	}
+}
\ No newline at end of file
@@ -1,5 +1,6 @@
 #pragma once
 #include "net_common.h"
+#include "net_readiness.h"
 
 namespace asr
 {
@@ -32,20 +33,23 @@ namespace asr
 			void push_front(const T& item)
 			{
 				std::scoped_lock lock(muxQueue);
-				deqQueue.emplace_front(std::move(item));
-
-				std::unique_lock<std::mutex> ul(muxBlocking);
-				cvBlocking.notify_one();
+				deqQueue.emplace_front(item);
+				signal();
 			}
 
 			// Pushes an item to the back of the Queue
 			void push_back(const T& item)
 			{
 				std::scoped_lock lock(muxQueue);
-				deqQueue.emplace_back(std::move(item));
+				deqQueue.emplace_back(item);
+				signal();
+			}
 
-				std::unique_lock<std::mutex> ul(muxBlocking);
-				cvBlocking.notify_one();
+			void push_back(T&& item)
+			{
+				std::scoped_lock lock(muxQueue);
+				deqQueue.emplace_back(std::move(item));
+				signal();
 			}
 
 			// Returns true if Queue is empty
@@ -67,6 +71,7 @@ namespace asr
 			{
 				std::scoped_lock lock(muxQueue);
 				deqQueue.clear();
+				unsignal();
 			}
 
 			// Removes and returns item from front of Queue
@@ -75,16 +80,102 @@ namespace asr
 				std::scoped_lock lock(muxQueue);
 				auto t = std::move(deqQueue.front());
 				deqQueue.pop_front();
+				if (deqQueue.empty())
+					unsignal();
 				return t;
 			}
 
+			// Moves up to nMaxItems from the front of the Queue into deqOut under a single
+			// lock, returns the number of items moved
+			size_t pop_batch(std::deque<T>& deqOut, size_t nMaxItems = -1)
+			{
+				std::scoped_lock lock(muxQueue);
+				size_t nCount = std::min(nMaxItems, deqQueue.size());
+
+				// Taking everything is just a swap
+				if (nCount == deqQueue.size() && deqOut.empty())
+				{
+					deqOut.swap(deqQueue);
+				}
+				else
+				{
+					std::move(deqQueue.begin(), deqQueue.begin() + nCount, std::back_inserter(deqOut));
+					deqQueue.erase(deqQueue.begin(), deqQueue.begin() + nCount);
+				}
+
+				if (deqQueue.empty())
+					unsignal();
+				return nCount;
+			}
+
+			// Blocks until the Queue has an item
 			void wait()
 			{
-				while (empty())
+				std::unique_lock<std::mutex> ul(muxQueue);
+				cvBlocking.wait(ul, [this]() { return !deqQueue.empty(); });
+			}
+
+			// Blocks until the Queue has an item or the timeout passes, returns true if there is an item
+			template <typename Rep, typename Period>
+			bool wait_for(const std::chrono::duration<Rep, Period>& timeout)
+			{
+				std::unique_lock<std::mutex> ul(muxQueue);
+				return cvBlocking.wait_for(ul, timeout, [this]() { return !deqQueue.empty(); });
+			}
+
+			// Blocks until the Queue has an item or the deadline passes, returns true if there is an item
+			template <typename Clock, typename Duration>
+			bool wait_until(const std::chrono::time_point<Clock, Duration>& deadline)
+			{
+				std::unique_lock<std::mutex> ul(muxQueue);
+				return cvBlocking.wait_until(ul, deadline, [this]() { return !deqQueue.empty(); });
+			}
+
+			// OS handle that is signalled while the Queue has items, for use in an external
+			// event loop. Created on first use so queues nobody polls pay nothing
+			readiness_event::native_handle_type readiness()
+			{
+				std::scoped_lock lock(muxQueue);
+				if (!evReady)
 				{
-					std::unique_lock<std::mutex> ul(muxBlocking);
-					cvBlocking.wait(ul);
+					evReady = std::make_unique<readiness_event>();
+					if (!deqQueue.empty() || bHeld)
+						evReady->set();
 				}
+				return evReady->native_handle();
+			}
+
+			// Marks that the consumer still has items it took from the Queue, keeping the
+			// readiness event signalled until it has worked through them
+			void hold(bool bHolding)
+			{
+				std::scoped_lock lock(muxQueue);
+				bHeld = bHolding;
+				if (!evReady)
+					return;
+
+				if (bHeld)
+					evReady->set();
+				else if (deqQueue.empty())
+					evReady->reset();
+			}
+
+		protected:
+			// Wake waiters after a push, muxQueue must be held
+			void signal()
+			{
+				cvBlocking.notify_one();
+
+				// The readiness event only changes when the Queue stops being empty
+				if (evReady && deqQueue.size() == 1)
+					evReady->set();
+			}
+
+			// The Queue has been emptied, muxQueue must be held
+			void unsignal()
+			{
+				if (evReady && !bHeld)
+					evReady->reset();
 			}
 
 		protected:
@@ -92,7 +183,8 @@ namespace asr
 			std::deque<T> deqQueue;
 
 			std::condition_variable cvBlocking;
-			std::mutex muxBlocking;
+			std::unique_ptr<readiness_event> evReady;
+			bool bHeld = false;
 		};
 	}
 }
\ No newline at end of file
@@ -0,0 +1,351 @@
+#pragma once
+#include "net_common.h"
+#include "net_log.h"
+
+// Define ASR_NET_IO_URING before including the library to build the io_uring receive path.
+// Servers still only use it once asked to with SetIoUring, and fall back to epoll if the
+// kernel can't provide it
+#if defined(ASR_NET_IO_URING) && defined(__linux__)
+	#define ASR_NET_HAS_IO_URING
+	#include <linux/io_uring.h>
+	#include <sys/eventfd.h>
+	#include <sys/mman.h>
+	#include <sys/syscall.h>
+	#include <sys/utsname.h>
+	#include <unistd.h>
+	#include <cerrno>
+	#include <cstdio>
+	#include <cstring>
+#endif
+
+#ifdef ASR_NET_HAS_IO_URING
+namespace asr
+{
+	namespace net
+	{
+		// Receives for many sockets through one io_uring. Each socket has a multishot receive
+		// that stays armed, and takes a buffer from a ring of them registered with the kernel
+		// only when data arrives, so idle sockets hold none. Completions are signalled on an
+		// eventfd the io_context waits on, and handled on its thread.
+		//
+		// Needs Linux 6.0 for multishot receives. Everything but Forget must be called from the
+		// io_context's thread
+		class uring_receiver
+		{
+		public:
+			// Called with each chunk received (nResult bytes at pData), or once the receive
+			// ends with 0 for end of stream or -errno. bMore is false on the last call
+			using handler = std::function<void(int nResult, const uint8_t* pData, bool bMore)>;
+
+			static constexpr uint32_t DefaultEntries = 4096;
+			static constexpr uint32_t DefaultBuffers = 1024;
+			static constexpr uint32_t DefaultBufferSize = 4096;
+
+			// Null if the kernel doesn't support what is needed, the caller keeps using epoll
+			static std::shared_ptr<uring_receiver> Create(asio::io_context& context,
+				uint32_t nBuffers = DefaultBuffers, uint32_t nBufferSize = DefaultBufferSize)
+			{
+				if (!KernelAtLeast(6, 0))
+					return nullptr;
+
+				std::shared_ptr<uring_receiver> pReceiver(new uring_receiver(context));
+				if (!pReceiver->Setup(nBuffers, nBufferSize))
+					return nullptr;
+
+				pReceiver->WaitForCompletions();
+				return pReceiver;
+			}
+
+			uring_receiver(const uring_receiver&) = delete;
+			uring_receiver& operator = (const uring_receiver&) = delete;
+
+			~uring_receiver()
+			{
+				asio::error_code ec;
+				m_descEvent.close(ec);
+
+				if (m_pBufRing)
+					munmap(m_pBufRing, m_nBufRingBytes);
+				if (m_pSqes)
+					munmap(m_pSqes, m_nSqesBytes);
+				if (m_pRing)
+					munmap(m_pRing, m_nRingBytes);
+				if (m_fdRing >= 0)
+					close(m_fdRing);
+			}
+
+		public:
+			// Starts receiving from a socket, returns the key to stop it with or 0 on failure
+			uint64_t Receive(int fd, handler fn)
+			{
+				std::scoped_lock lock(m_mux);
+				uint64_t nKey = ++m_nLastKey;
+
+				io_uring_sqe sqe{};
+				sqe.opcode = IORING_OP_RECV;
+				sqe.fd = fd;
+				sqe.ioprio = IORING_RECV_MULTISHOT;
+				sqe.flags = IOSQE_BUFFER_SELECT;
+				sqe.buf_group = BufferGroup;
+				sqe.user_data = nKey;
+				if (!Submit(sqe))
+					return 0;
+
+				m_mapHandlers.emplace(nKey, std::move(fn));
+				return nKey;
+			}
+
+			// Cancels a receive. Whatever was already received is still handed over, then the
+			// handler is called a last time
+			void Stop(uint64_t nKey)
+			{
+				std::scoped_lock lock(m_mux);
+				Cancel(nKey);
+			}
+
+			// Cancels a receive and drops its handler, for a socket being closed. Any thread
+			void Forget(uint64_t nKey)
+			{
+				std::scoped_lock lock(m_mux);
+				if (m_mapHandlers.erase(nKey))
+					Cancel(nKey);
+			}
+
+		private:
+			uring_receiver(asio::io_context& context)
+				: m_descEvent(context)
+			{}
+
+			static bool KernelAtLeast(int nMajor, int nMinor)
+			{
+				utsname name{};
+				int nHave[2] = { 0, 0 };
+				if (uname(&name) != 0 || std::sscanf(name.release, "%d.%d", &nHave[0], &nHave[1]) != 2)
+					return false;
+				return nHave[0] > nMajor || (nHave[0] == nMajor && nHave[1] >= nMinor);
+			}
+
+			bool Setup(uint32_t nBuffers, uint32_t nBufferSize)
+			{
+				io_uring_params params{};
+				m_fdRing = int(syscall(__NR_io_uring_setup, DefaultEntries, &params));
+				if (m_fdRing < 0 || !(params.features & IORING_FEAT_SINGLE_MMAP))
+				{
+					ASR_NET_LOG(warn, "[URING] Setup failed: ", std::strerror(errno));
+					return false;
+				}
+
+				// One mapping covers both rings, the submission entries have their own
+				m_nRingBytes = std::max(params.sq_off.array + params.sq_entries * sizeof(uint32_t),
+					params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+				void* pRing = mmap(nullptr, m_nRingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fdRing, IORING_OFF_SQ_RING);
+				m_nSqesBytes = params.sq_entries * sizeof(io_uring_sqe);
+				void* pSqes = mmap(nullptr, m_nSqesBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fdRing, IORING_OFF_SQES);
+				if (pRing == MAP_FAILED || pSqes == MAP_FAILED)
+				{
+					ASR_NET_LOG(warn, "[URING] Ring mapping failed: ", std::strerror(errno));
+					if (pRing != MAP_FAILED)
+						munmap(pRing, m_nRingBytes);
+					if (pSqes != MAP_FAILED)
+						munmap(pSqes, m_nSqesBytes);
+					return false;
+				}
+				m_pRing = static_cast<uint8_t*>(pRing);
+				m_pSqes = static_cast<io_uring_sqe*>(pSqes);
+
+				m_pSqHead = reinterpret_cast<uint32_t*>(m_pRing + params.sq_off.head);
+				m_pSqTail = reinterpret_cast<uint32_t*>(m_pRing + params.sq_off.tail);
+				m_pSqArray = reinterpret_cast<uint32_t*>(m_pRing + params.sq_off.array);
+				m_nSqMask = *reinterpret_cast<uint32_t*>(m_pRing + params.sq_off.ring_mask);
+				m_nSqEntries = params.sq_entries;
+				m_pCqHead = reinterpret_cast<uint32_t*>(m_pRing + params.cq_off.head);
+				m_pCqTail = reinterpret_cast<uint32_t*>(m_pRing + params.cq_off.tail);
+				m_pCqes = reinterpret_cast<io_uring_cqe*>(m_pRing + params.cq_off.cqes);
+				m_nCqMask = *reinterpret_cast<uint32_t*>(m_pRing + params.cq_off.ring_mask);
+
+				// The kernel picks receive buffers from this ring, one whole buffer per completion
+				if (nBuffers == 0 || nBuffers > 32768 || (nBuffers & (nBuffers - 1)) != 0)
+					return false;
+				m_nBuffers = nBuffers;
+				m_nBufferSize = nBufferSize;
+				m_vBuffers.resize(size_t(nBuffers) * nBufferSize);
+				m_nBufRingBytes = nBuffers * sizeof(io_uring_buf);
+				void* pBufRing = mmap(nullptr, m_nBufRingBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+				if (pBufRing == MAP_FAILED)
+					return false;
+				m_pBufRing = static_cast<io_uring_buf*>(pBufRing);
+
+				io_uring_buf_reg reg{};
+				reg.ring_addr = reinterpret_cast<uint64_t>(m_pBufRing);
+				reg.ring_entries = nBuffers;
+				reg.bgid = BufferGroup;
+				if (syscall(__NR_io_uring_register, m_fdRing, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+				{
+					ASR_NET_LOG(warn, "[URING] Buffer ring registration failed: ", std::strerror(errno));
+					return false;
+				}
+
+				for (uint16_t nBuffer = 0; nBuffer < nBuffers; nBuffer++)
+					RecycleBuffer(nBuffer);
+
+				// Completions are announced on an eventfd, which asio can wait on like a socket
+				int fdEvent = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+				if (fdEvent < 0)
+					return false;
+				m_descEvent.assign(fdEvent);
+				if (syscall(__NR_io_uring_register, m_fdRing, IORING_REGISTER_EVENTFD, &fdEvent, 1) < 0)
+				{
+					ASR_NET_LOG(warn, "[URING] Eventfd registration failed: ", std::strerror(errno));
+					return false;
+				}
+				return true;
+			}
+
+			// ASYNC - Handle completions whenever the eventfd says there are some
+			void WaitForCompletions()
+			{
+				m_descEvent.async_wait(asio::posix::stream_descriptor::wait_read,
+					[this](std::error_code ec)
+					{
+						if (ec)
+							return;
+
+						uint64_t nCount = 0;
+						if (read(m_descEvent.native_handle(), &nCount, sizeof(nCount)) < 0 && errno != EAGAIN)
+							ASR_NET_LOG(warn, "[URING] Eventfd read failed: ", std::strerror(errno));
+
+						Drain();
+						WaitForCompletions();
+					}
+				);
+			}
+
+			void Drain()
+			{
+				while (true)
+				{
+					io_uring_cqe cqe;
+					handler fn;
+					{
+						std::scoped_lock lock(m_mux);
+						uint32_t nHead = *m_pCqHead;
+						if (nHead == __atomic_load_n(m_pCqTail, __ATOMIC_ACQUIRE))
+							return;
+
+						// Free the slot before calling out, the handler may submit more
+						cqe = m_pCqes[nHead & m_nCqMask];
+						__atomic_store_n(m_pCqHead, nHead + 1, __ATOMIC_RELEASE);
+
+						auto it = m_mapHandlers.find(cqe.user_data);
+						if (it != m_mapHandlers.end())
+						{
+							fn = it->second;
+							if (!(cqe.flags & IORING_CQE_F_MORE))
+								m_mapHandlers.erase(it);
+						}
+					}
+
+					const bool bBuffer = (cqe.flags & IORING_CQE_F_BUFFER) != 0;
+					const uint16_t nBuffer = uint16_t(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+					if (fn)
+						fn(cqe.res, bBuffer ? m_vBuffers.data() + size_t(nBuffer) * m_nBufferSize : nullptr, (cqe.flags & IORING_CQE_F_MORE) != 0);
+
+					// The handler has copied what it needs out
+					if (bBuffer)
+					{
+						std::scoped_lock lock(m_mux);
+						RecycleBuffer(nBuffer);
+					}
+				}
+			}
+
+			// Hands a buffer back to the kernel. Called with m_mux held
+			void RecycleBuffer(uint16_t nBuffer)
+			{
+				io_uring_buf& buf = m_pBufRing[m_nBufTail & (m_nBuffers - 1)];
+				buf.addr = reinterpret_cast<uint64_t>(m_vBuffers.data() + size_t(nBuffer) * m_nBufferSize);
+				buf.len = m_nBufferSize;
+				buf.bid = nBuffer;
+				m_nBufTail++;
+				__atomic_store_n(&m_pBufRing[0].resv, m_nBufTail, __ATOMIC_RELEASE);
+			}
+
+			// Called with m_mux held
+			void Cancel(uint64_t nKey)
+			{
+				io_uring_sqe sqe{};
+				sqe.opcode = IORING_OP_ASYNC_CANCEL;
+				sqe.fd = -1;
+				sqe.addr = nKey;
+				sqe.user_data = CancelKey;
+				Submit(sqe);
+			}
+
+			// Queues one entry and hands it to the kernel straight away. Called with m_mux held
+			bool Submit(const io_uring_sqe& sqe)
+			{
+				uint32_t nTail = *m_pSqTail;
+				if (nTail - __atomic_load_n(m_pSqHead, __ATOMIC_ACQUIRE) >= m_nSqEntries)
+					return false;
+
+				uint32_t nIndex = nTail & m_nSqMask;
+				m_pSqes[nIndex] = sqe;
+				m_pSqArray[nIndex] = nIndex;
+				__atomic_store_n(m_pSqTail, nTail + 1, __ATOMIC_RELEASE);
+
+				long nResult;
+				do
+				{
+					nResult = syscall(__NR_io_uring_enter, m_fdRing, 1, 0, 0, nullptr, 0);
+				} while (nResult < 0 && errno == EINTR);
+
+				if (nResult < 0)
+				{
+					ASR_NET_LOG(warn, "[URING] Submit failed: ", std::strerror(errno));
+					return false;
+				}
+				return true;
+			}
+
+		private:
+			// Receive keys start at 1, completions of cancel requests carry this one
+			static constexpr uint64_t CancelKey = 0;
+			static constexpr uint16_t BufferGroup = 0;
+
+			int m_fdRing = -1;
+			uint8_t* m_pRing = nullptr;
+			size_t m_nRingBytes = 0;
+			io_uring_sqe* m_pSqes = nullptr;
+			size_t m_nSqesBytes = 0;
+
+			uint32_t* m_pSqHead = nullptr;
+			uint32_t* m_pSqTail = nullptr;
+			uint32_t* m_pSqArray = nullptr;
+			uint32_t m_nSqMask = 0;
+			uint32_t m_nSqEntries = 0;
+			uint32_t* m_pCqHead = nullptr;
+			uint32_t* m_pCqTail = nullptr;
+			io_uring_cqe* m_pCqes = nullptr;
+			uint32_t m_nCqMask = 0;
+
+			// Receive buffers and the ring that offers them to the kernel
+			std::vector<uint8_t> m_vBuffers;
+			// Kept as plain entries, as io_uring_buf_ring's flexible array is laid out
+			// differently in C++. The ring's tail overlays the first entry's resv
+			io_uring_buf* m_pBufRing = nullptr;
+			size_t m_nBufRingBytes = 0;
+			uint32_t m_nBuffers = 0;
+			uint32_t m_nBufferSize = 0;
+			uint16_t m_nBufTail = 0;
+
+			asio::posix::stream_descriptor m_descEvent;
+
+			// Handlers of armed receives by key. Guards the submission queue too, as sockets
+			// can be forgotten from whichever thread lets go of their connection
+			std::unordered_map<uint64_t, handler> m_mapHandlers;
+			uint64_t m_nLastKey = 0;
+			std::mutex m_mux;
+		};
+	}
+}
+#endif
\ No newline at end of file
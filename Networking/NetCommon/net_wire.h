@@ -0,0 +1,219 @@
+#pragma once
+#include "net_common.h"
+#include "net_message.h"
+
+namespace asr
+{
+	namespace net
+	{
+		namespace wire
+		{
+			// Capability bits negotiated during the handshake. A peer that doesn't
+			// understand negotiation is treated as having no capabilities at all
+			enum capability : uint8_t
+			{
+				none = 0x00,
+				compact_header = 0x01,
+				checksum = 0x02,
+				// Timestamped probes measuring round trip time and clock offset
+				time_sync = 0x04,
+				// Sessions that survive reconnects, replaying whatever the remote missed
+				resume = 0x08,
+				// Bodies may be compressed, flagged in the compact header's size field
+				compression = 0x10
+			};
+
+			// Top byte of a server challenge that advertises capabilities. The low 48 bits
+			// stay random, the byte below the magic carries the offered capability bits
+			constexpr uint64_t HandshakeMagic = 0xA5;
+
+			// Largest possible compact header, 10 bytes for a 64 bit id and 5 for the size
+			constexpr size_t MaxCompactHeaderSize = 16;
+
+			// Bytes of the crc32c trailer that follows each message when checksums are negotiated
+			constexpr size_t ChecksumSize = 4;
+
+			// Bytes of the check that follows each header when checksums are negotiated, the low
+			// bits of the header's own crc32c. The size field isn't trusted until it matches
+			constexpr size_t HeaderCheckSize = 2;
+
+			// Maximum bytes a varint may use for each header field
+			constexpr size_t MaxSizeVarintBytes = 5;
+
+			// Unsigned integer type used to put a message id on the wire
+			template <typename T, bool = std::is_enum<T>::value>
+			struct id_traits
+			{
+				using type = std::make_unsigned_t<T>;
+			};
+
+			template <typename T>
+			struct id_traits<T, true>
+			{
+				using type = std::make_unsigned_t<std::underlying_type_t<T>>;
+			};
+
+			template <typename T>
+			using id_int_t = typename id_traits<T>::type;
+
+			template <typename T>
+			constexpr size_t MaxIdVarintBytes = (sizeof(id_int_t<T>) * 8 + 6) / 7;
+
+			// Id reserved for the library's own messages once time_sync or resume is
+			// negotiated, these never reach the application
+			template <typename T>
+			constexpr T ControlId = T(std::numeric_limits<id_int_t<T>>::max());
+
+			// True if the negotiated capabilities reserve ControlId
+			inline bool HasControlMessages(uint8_t nNegotiated)
+			{
+				return (nNegotiated & (time_sync | resume)) != 0;
+			}
+
+			// Compression needs the compact header to carry its flag
+			inline bool HasCompression(uint8_t nNegotiated)
+			{
+				return (nNegotiated & (compact_header | compression)) == (compact_header | compression);
+			}
+
+			// Builds the challenge a server sends, advertising the capabilities it offers
+			inline uint64_t MakeChallenge(uint64_t nRandom, uint8_t nCapabilities)
+			{
+				return (HandshakeMagic << 56) | (uint64_t(nCapabilities) << 48) | (nRandom & 0x0000FFFFFFFFFFFF);
+			}
+
+			// Returns true if the challenge came from a server that understands negotiation
+			inline bool IsNegotiatingChallenge(uint64_t nChallenge)
+			{
+				return (nChallenge >> 56) == HandshakeMagic;
+			}
+
+			// Capabilities offered by a negotiating challenge
+			inline uint8_t OfferedCapabilities(uint64_t nChallenge)
+			{
+				return uint8_t(nChallenge >> 48);
+			}
+
+			// Writes v as a little-endian base 128 varint, returns the number of bytes used
+			inline size_t EncodeVarint(uint64_t v, uint8_t* pOut)
+			{
+				size_t n = 0;
+				while (v >= 0x80)
+				{
+					pOut[n++] = uint8_t(v) | 0x80;
+					v >>= 7;
+				}
+				pOut[n++] = uint8_t(v);
+				return n;
+			}
+
+			// Reads a varint of at most nMaxBytes, returns bytes consumed or 0 if it is
+			// truncated or overlong
+			inline size_t DecodeVarint(const uint8_t* pIn, size_t nLen, size_t nMaxBytes, uint64_t& v)
+			{
+				// Most ids and sizes fit in one byte
+				if (nLen > 0 && pIn[0] < 0x80)
+				{
+					v = pIn[0];
+					return 1;
+				}
+
+				uint64_t nResult = 0;
+				size_t nEnd = std::min(nLen, nMaxBytes);
+				for (size_t i = 0; i < nEnd; i++)
+				{
+					nResult |= uint64_t(pIn[i] & 0x7F) << (7 * i);
+					if (pIn[i] < 0x80)
+					{
+						v = nResult;
+						return i + 1;
+					}
+				}
+				return 0;
+			}
+
+			// Counts finished varints in a buffer, used to work out how many more bytes
+			// of a compact header are still to come
+			inline size_t CountVarints(const uint8_t* pIn, size_t nLen)
+			{
+				size_t nCount = 0;
+				for (size_t i = 0; i < nLen; i++)
+					nCount += pIn[i] < 0x80;
+				return nCount;
+			}
+
+			// Checksum trailers are stored little-endian
+			inline void StoreChecksum(uint32_t nChecksum, uint8_t* pOut)
+			{
+				pOut[0] = uint8_t(nChecksum);
+				pOut[1] = uint8_t(nChecksum >> 8);
+				pOut[2] = uint8_t(nChecksum >> 16);
+				pOut[3] = uint8_t(nChecksum >> 24);
+			}
+
+			inline uint32_t LoadChecksum(const uint8_t* pIn)
+			{
+				return uint32_t(pIn[0]) | uint32_t(pIn[1]) << 8 | uint32_t(pIn[2]) << 16 | uint32_t(pIn[3]) << 24;
+			}
+
+			inline void StoreHeaderCheck(uint32_t nChecksum, uint8_t* pOut)
+			{
+				pOut[0] = uint8_t(nChecksum);
+				pOut[1] = uint8_t(nChecksum >> 8);
+			}
+
+			inline bool HeaderCheckMatches(uint32_t nChecksum, const uint8_t* pIn)
+			{
+				return pIn[0] == uint8_t(nChecksum) && pIn[1] == uint8_t(nChecksum >> 8);
+			}
+
+			// Compact header: varint id followed by varint body size
+			template <typename T>
+			size_t EncodeHeader(const message_header<T>& header, uint8_t* pOut)
+			{
+				size_t n = EncodeVarint(uint64_t(id_int_t<T>(header.id)), pOut);
+				n += EncodeVarint(header.size, pOut + n);
+				return n;
+			}
+
+			// With compression negotiated the size is shifted up a bit, the low bit set if the
+			// body is compressed. The size is then that of the body as sent
+			template <typename T>
+			size_t EncodeHeader(id_int_t<T> nId, uint32_t nSize, bool bCompressed, uint8_t* pOut)
+			{
+				size_t n = EncodeVarint(uint64_t(nId), pOut);
+				n += EncodeVarint((uint64_t(nSize) << 1) | uint64_t(bCompressed), pOut + n);
+				return n;
+			}
+
+			// Returns bytes consumed, or 0 if the header is malformed. Pass pCompressed once
+			// compression is negotiated, to read the flag
+			template <typename T>
+			size_t DecodeHeader(const uint8_t* pIn, size_t nLen, message_header<T>& header, bool* pCompressed = nullptr)
+			{
+				uint64_t nId = 0, nSize = 0;
+
+				size_t nIdBytes = DecodeVarint(pIn, nLen, MaxIdVarintBytes<T>, nId);
+				if (nIdBytes == 0 || nId > std::numeric_limits<id_int_t<T>>::max())
+					return 0;
+
+				size_t nSizeBytes = DecodeVarint(pIn + nIdBytes, nLen - nIdBytes, MaxSizeVarintBytes, nSize);
+				if (nSizeBytes == 0)
+					return 0;
+
+				if (pCompressed)
+				{
+					*pCompressed = (nSize & 1) != 0;
+					nSize >>= 1;
+				}
+
+				if (nSize > std::numeric_limits<uint32_t>::max())
+					return 0;
+
+				header.id = T(id_int_t<T>(nId));
+				header.size = uint32_t(nSize);
+				return nIdBytes + nSizeBytes;
+			}
+		}
+	}
+}
\ No newline at end of file
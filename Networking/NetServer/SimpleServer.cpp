@@ -10,10 +10,10 @@ enum class CustomMsgTypes : uint32_t
 	ServerMessage
 };
 
-class CustomServer : public asr::net::server_interface<CustomMsgTypes>
+class CustomServer : public asr::net::cluster_server<CustomMsgTypes>
 {
 public:
-	CustomServer(uint16_t nPort) : asr::net::server_interface<CustomMsgTypes>(nPort)
+	CustomServer(uint16_t nPort, uint32_t nNodeID, uint16_t nPeerPort) : asr::net::cluster_server<CustomMsgTypes>(nPort, nNodeID, nPeerPort)
 	{
 
 	}
@@ -30,7 +30,7 @@ public:
 
 	virtual void OnClientDisconnect(std::shared_ptr<asr::net::connection<CustomMsgTypes>> client)
 	{
-		std::cout << "Removing client [" << client->GetID() << "]\n";
+		ASR_NET_LOG(info, "Removing client [", client->GetID(), "]");
 	}
 
 	// Called when a message arrives
@@ -40,7 +40,7 @@ public:
 		{
 		case CustomMsgTypes::ServerPing:
 		{
-			std::cout << "[" << client->GetID() << "]: Server ping\n";
+			ASR_NET_LOG(info, "[", client->GetID(), "]: Server ping");
 
 			// Send message back to client
 			client->Send(msg);
@@ -48,21 +48,39 @@ public:
 		break;
 		case CustomMsgTypes::MessageAll:
 		{
-			std::cout << "[" << client->GetID() << "] Message all\n";
+			ASR_NET_LOG(info, "[", client->GetID(), "] Message all");
 
 			asr::net::message<CustomMsgTypes> msg;
 			msg.header.id = CustomMsgTypes::ServerMessage;
 			msg << client->GetID();
-			MessageAllClients(msg, client);
+			MessageAllNodes(msg, client);
 		}
 		break;
 		}
 	}
 };
 
-int main()
+// SimpleServer [port] [node id] [peer port] [node id:host:peer port]...
+// Without arguments runs a single node on port 60000
+int main(int argc, char* argv[])
 {
-	CustomServer server(60000);
+	uint16_t nPort = argc > 1 ? uint16_t(std::atoi(argv[1])) : 60000;
+	uint32_t nNodeID = argc > 2 ? uint32_t(std::atoi(argv[2])) : 1;
+	uint16_t nPeerPort = argc > 3 ? uint16_t(std::atoi(argv[3])) : 0;
+
+	CustomServer server(nPort, nNodeID, nPeerPort);
+	for (int i = 4; i < argc; i++)
+	{
+		std::string sPeer = argv[i];
+		size_t nFirst = sPeer.find(':'), nLast = sPeer.rfind(':');
+		if (nFirst == std::string::npos || nFirst == nLast)
+			continue;
+
+		server.AddPeer(uint32_t(std::stoul(sPeer.substr(0, nFirst))), sPeer.substr(nFirst + 1, nLast - nFirst - 1), uint16_t(std::stoul(sPeer.substr(nLast + 1))));
+	}
+
+	// Clients show the round trip time, which needs time probes
+	server.SetCapabilities(asr::net::wire::compact_header | asr::net::wire::time_sync);
 	server.Start();
 
 	while (1)